@@ -20,6 +20,47 @@
  *  V2.10   4/26/00 Added support for alternate (direction reversed) rotary encoder.
  *  V2.20   6/8/01  Fixed error in parser that updates min_value and max_value limits (param_ptr_temp).
  *                  Removed "Calibrate". Added "Erase Mem".
+ *  V2.21   Added "slotsn" deterministic (slotted) serial number discovery and "loudsn".
+ *  V2.22   Fixed parser leaving the DSP functions off when a UserFIR or program command is
+ *                  aborted. Added PARSE_TIMEOUT and PARSE_STATS ("parsestat").
+ *  V2.23   Added binary command frames (BIN_SYNC) with CRC16 for fast parameter and UserFIR loads.
+ *  V2.24   Added symmetric/antisymmetric and delta UserFIR uploads. Records are variable length
+ *                  with packed UserFIR taps (RECORD_VERSION).
+ *  V2.25   Added "begin" and "commit" commands to change several parameters with one DSP update.
+ *  V2.26   compute_fir() abandons a stale encoder update when a newer value arrives.
+ *  V2.27   param_struct_search() uses an index of the parameter names built by initialize().
+ *  V2.28   RS-232 transmit is interrupt driven from a ring buffer (xmit() no longer waits).
+ *  V2.29   Larger receive buffer with XON/XOFF flow control, receive error counters ("serstat").
+ *  V2.30   Added "dump" command and binary frames to read and load all settings at once.
+ *  V2.31   Added "telem" command: periodic binary frames with peak levels, clipping and CPU headroom.
+ *  V2.32   Added group addressing ("at grp:3", "group" command) and the "ack" command. The group
+ *                  is saved in the FLASH records (RECORD_VERSION 225, 224 records are still read).
+ *  V2.33   Store saves a delta record (changed words only) relative to the last full record of
+ *                  the location. The FLASH refresh compacts each location into one full record.
+ *  V2.34   The FLASH records are indexed at power up (index_records()), so store and recall no
+ *                  longer walk the records.
+ *  V2.35   The records alternate between FLASH sectors 3 and 8: the refresh compacts them into
+ *                  the idle sector and switches to it, so the current sector is never erased.
+ *  V2.36   The FLASH wait states are only set for each FLASH access (with interrupts off), so the
+ *                  filters keep running while settings are stored and recalled.
+ *  V2.37   100 memory locations (0 to 99). The refresh writes a base record of the current settings
+ *                  and saves each location as a delta record relative to it. "Erase Mem" is one refresh.
+ *  V2.38   FAST_BOOT: the filters of location 0 start from a snapshot of the DSP state saved in
+ *                  the FLASH records, before the display and sign on.
+ *  V2.39   Binary firmware update (BIN_FW_BEGIN ...): the image is streamed into the backup code
+ *                  sectors with a CRC32 per block, verified, then installed into the main sectors.
+ *  V2.40   Differential firmware update: BIN_FW_HASH sends the CRC32s of the installed image blocks
+ *                  and BIN_FW_KEEP copies an unchanged block, so only changed blocks are sent.
+ *  V2.41   A record sector (3 or 8) written with "program:" is indexed at once (record images
+ *                  built by vf_rec.m are used without cycling power).
+ *  V2.42   Added "morph" command: moves the filters to the settings of a memory location over a
+ *                  given time (interpolated gains and frequencies) without muting the outputs.
+ *  V2.43   disp_text() and disp_num() write a copy of the LCD (lcd_buf[]). lcd_flush() sends the
+ *                  changed characters from the main loop and wait(), so nothing waits on the LCD.
+ *  V2.44   Messages of store(), recall(), "Cancelled", the program error and the beeps no longer
+ *                  wait: the display is restored by a deferred task (defer(), run_tasks()).
+ *  V2.45   Fast knob spins change frequencies in 1/12 to 1/3 octave steps (knob_step()); the
+ *                  filter is computed once the knob settles.
  *
  **************************************************************************/
 
@@ -30,16 +71,83 @@
 #define ENCODER_TYPE    1   /* Rotary encoder type: 0 - panasonic, 1 - Switch Channel */
 #define SIGN_ON_FLAG_Versa_Filter   1   /* set to one for standard sign on message */
 #define SIGN_ON_FLAG_AccuQuest      0   /* set to one for AccuQuest sign on message */
+#define PARSE_STATS     0   /* set to one to time the command parser (see "parsestat" command) */
+#define FAST_BOOT       1   /* set to one to start the location 0 filters from a snapshot at power up */
 
 /******* Program Parameters ***********************************************/
-#define VERSION 220             /* Firmware Version # (3 digit#: 123 = V1.23) */
+#define VERSION 245             /* Firmware Version # (3 digit#: 123 = V1.23) */
+#define RECORD_VERSION 225      /* FLASH record format version (records of other versions are erased) */
+#define RECORD_VERSION_MIN 224  /* oldest record format version still read (224: no group words) */
+#define RECORD_GROUPS 225       /* first record format version with the group words */
+#define RECORD_DELTA 0x8000     /* set in the record format version word of a delta record (see store()) */
+#define DELTA_MAX 128           /* max. delta record length in words (more changes are stored as a full record) */
+#define DELTA_BUF 0x1000        /* a delta record is built in flash_data[DELTA_BUF ...] */
+#define BASE_LOC 0x00ff         /* loc_code of the base record written by the refresh (see store()) */
+#define SNAP_LOC 0x00fe         /* loc_code of the DSP state snapshot record (see snap_save()) */
+#define SNAP_LENGTH (23 + 256 + 256)    /* length of the snapshot record */
+#define GROUP_LOC 0x00fd        /* loc_code of the group record written by "group" (see group_save()) */
+#define GROUP_LENGTH 8          /* length of the group record */
+#define SECTOR_TAG 0x5653       /* ("VS") programmed last into a record sector's header to make it valid */
+#define SECTOR_OK(h) (((h)[1]==SECTOR_TAG)&&((h)[0]<0x8000))   /* valid record sector header */
 #define CURSOR_PERIOD 50        /* cursor flashing period (in multiples of 10ms) */
 /*#define HOLD_TIME 300         /* hold time for push/hold to become active (in multiples of 10ms) */
 #define OVERFLOW_STICK 20       /* overload LED stick time (on after overload) (in multiples of 5ms) */
 #define VU_DECAY 2              /* decay time between 6dB decrements of VU Meter (in multiples of 5ms) */
+#define TELEM_MIN 4             /* shortest "telem" interval (in multiples of 5ms) */
+#define MORPH_FIRST 14          /* first params[][] row interpolated by "morph" (NFgain) */
+#define MORPH_ROWS  26          /* number of rows interpolated by "morph" (NFgain to INgain) */
+#define MORPH_CHUNK 8           /* FIR coef. pairs written per interrupts-off interval by fir_live() */
+#define NTASKS 6                /* max. number of deferred tasks (see defer()) */
+#define KNOB_SLOW 0.03          /* knob turns further apart than this (in sec., see knob_samples) are slow */
+#define KNOB_FAST 25000         /* knob turns closer than this (in us) take frequency steps (see knob_step()) */
+#define KNOB_SETTLE 10          /* the knob has settled after this (in multiples of 5ms) without turns */
+#define LCD_USEC 40             /* LCD busy time after a character or instruction (in us, see lcd_flush()) */
+#define IDLE_USEC 1000          /* idle_spins() measuring time (in us) */
 #define SENDSN_WAIT 22          /* (~0.75sec.) max wait time for sendsn command (in multiples of 32767us) */
+#define SLOTSN_BITS 5           /* default number of slot bits for the slotsn command (2^5 = 32 slots) */
+#define SLOTSN_CHARS 13         /* slotsn slot length in character times (10 char SN + CR + 2 guard chars) */
+#define ACK_CHARS 4             /* "ack" slot length in character times (2 chars + 2 guard chars) */
+#define TELEM_CHARS 28          /* telemetry slot length in character times (25 char frame + 3 guard chars) */
+#define GROUP_SET   0x0001      /* group_mask bit: group_slot was assigned by "group" (needed by "telem") */
 #define SW_DEBOUNCE  500            /* switch/encoder debounce interval in us (set to ~1000) */
-#define SERIAL_BUF_LEN 128          /* (128) length of serial input command buffer (MUST BE POWER OF 2) */
+#define SERIAL_BUF_LEN 256          /* (256) length of serial input command buffer (MUST BE POWER OF 2) */
+#define RX_FLOW     MAIN            /* set to one to pace the host with XON/XOFF when serial_in_buf[] fills
+                                       (off in the recovery build, where only "program:" is used) */
+#define RX_XOFF_ROOM (SERIAL_BUF_LEN/4) /* send XOFF when this much room is left in serial_in_buf[] */
+#define RX_XON_LEVEL (SERIAL_BUF_LEN/8) /* send XON when serial_in_buf[] has emptied to this */
+#define XON         0x11
+#define XOFF        0x13
+#define TX_BUF_LEN  128             /* length of serial transmit ring buffer (MUST BE POWER OF 2) */
+#define TX_ECHO     1               /* 1 - the module hears its own transmissions (multi-drop bus), so receive
+                                       ints. are off until the transmit buffer has been sent,
+                                       0 - receive while transmitting (point to point RS-232) */
+#define PARSE_TIMEOUT 400           /* (2 sec.) abort a UserFIR or program command (while the DSP
+                                       functions are off) or a binary frame that stops sending
+                                       (in multiples of 5ms) */
+#define BIN_SYNC    0x02            /* first byte of a binary command frame (ASCII STX) */
+#define BIN_ALL     0xffffffL       /* binary frame address of all modules */
+#define BIN_GROUP   0xfff000L       /* binary frame address of group g (1 to 15) is BIN_GROUP + g */
+#define BIN_MAX_LEN 4096            /* max. binary frame payload length in bytes (held in flash_data[]) */
+#define BIN_PARAMS  1               /* binary frame opcode: set parameters */
+#define BIN_USERFIR 2               /* binary frame opcode: load UserFIR coefs. */
+#define BIN_UFPACKED 3              /* binary frame opcode: load UserFIR coefs. (symmetric and/or delta) */
+#define BIN_DUMP    4               /* binary frame opcode: send all settings (reply is BIN_DUMP + BIN_ACK) */
+#define BIN_LOAD    5               /* binary frame opcode: load all settings (from a BIN_DUMP reply) */
+#define BIN_TELEM   6               /* opcode of a telemetry frame (sent as BIN_TELEM + BIN_ACK, see telem_update()) */
+#define BIN_FW_BEGIN 7              /* binary frame opcode: start a firmware update (see fw_begin()) */
+#define BIN_FW_BLOCK 8              /* binary frame opcode: firmware image block (see fw_block()) */
+#define BIN_FW_STATUS 9             /* binary frame opcode: send the firmware update progress */
+#define BIN_FW_COMMIT 10            /* binary frame opcode: verify and install the firmware image (see fw_commit()) */
+#define BIN_FW_HASH 11              /* binary frame opcode: send the CRC32s of the installed image blocks */
+#define BIN_FW_KEEP 12              /* binary frame opcode: copy an unchanged image block (see fw_keep()) */
+#define BIN_ACK     0x80            /* added to the opcode of a reply frame */
+#define FW_SLOT     0x8000          /* an update is received into the backup code sectors 4, 5 and 7
+                                       (image word w at FLASH word FW_SLOT + w, see fw_begin()) */
+#define FW_BLOCK    1024            /* max. image words in a BIN_FW_BLOCK frame */
+#define FW_SIG      0x5ff8          /* image offset of the signature (not used by the code in sector 2);
+                                       also the max. image length */
+#define FW_TAG      0x4657          /* ("FW") first word of a valid signature */
+#define USERFIR_FUNC 8              /* index of "UserFIR" in func_text[] */
 /* #define ORDER_MIN 2              /* minimum FIR filter order */
 /* #define ORDER_MAX 127            /* maximum FIR filter order */
 #define FCUT_MIN    200.0/48000.0   /* 600 minimum cutoff freq. for LP and HP (fraction of sampling rate) */
@@ -54,14 +162,18 @@
 #define FNFWIDTH_MIN  10.0/48000.0      /* 10 minimum width of notch filter (fraction of sampling rate) */
 #define FNFWIDTH_MAX  10000.0/48000.0   /* 10000 maximum width of notch filter (fraction of sampling rate) */
 #define GAIN_MAX    10000       /* maximum gain: 100 */
-#define LAST_MEM_LOC 4          /* last memory loction for store and recall functions
-                                   (9 max because of retrieved_flag[] ) */
+#define LAST_MEM_LOC 99         /* last memory loction for store and recall functions
+                                   (the index takes 3 words per location) */
 
 /*#define FIR_LENGTH 256    /* temp */
 
 #define SERIAL_LOC  0x0040      /* location of serial number in code space */
 #define XTAL        12.288e6    /* frequency of DSP crystal */
 #define FLASH_WAITS 4           /* Number of FLASH memory wait states (7 max.) */
+#define FLASH_ON    {asm(" setc INTM"); portfffc = (IO_WAITS*0x0200 + FLASH_WAITS*0x0040 + 0*0x0008 + 0);}
+                                /* start a FLASH access: interrupts off, then FLASH wait states */
+#define FLASH_OFF   {portfffc = (IO_WAITS*0x0200 + 0*0x0040 + 0*0x0008 + 0); asm(" clrc INTM");}
+                                /* end a FLASH access: 0 wait states, then interrupts on */
 #define IO_WAITS    1           /* Number of I/O wait states (7 max.) */
 /*#define CLKOUT1       2.0*XTAL    /* frequency of master DSP clock = (1/cycle time) */
 /*#define PSCPERIOD (16.0*1e6)/(CLKOUT1) /* set the period out of the prescaler (in microseconds) */
@@ -189,8 +301,8 @@ struct pstruct param_struct[]={
 /*  8 */    {"Master Mode:",    0, (unsigned int)master_mode_text},
 /*  9%      {"Calibrate:",      0x4000, (unsigned int)calibrate_text}, */
 /*  9%*/    {"Initialize:",     0x4000,  (unsigned int)initialize_text},
-/* 10 */    {"Store:  # press ",0x4000, 0},
-/* 11 */    {"Recall: # press ",0x4000, 0},
+/* 10 */    {"Store: ## press ",0x4000, 0},
+/* 11 */    {"Recall:## press ",0x4000, 0},
 /* 12%*/    {"Firmware:  V",    0, (unsigned int)null_text},
 /* 13%*/    {"Serial No:",      0, (unsigned int)null_text},
 
@@ -249,6 +361,8 @@ int param_ptr_end[]=  {14, 15, 18, 21, 27, 33, 36, 39, 42, 45}; /* this should a
 
 #define NPARAMSTRUCT    (sizeof param_struct)/(sizeof param_struct[0])
 #define NPARAMS         NPARAMSTRUCT + 128      /* reserve additional space for user filter coefs. */
+#define NAME_HASH       32      /* number of parameter name index chains (power of 2) */
+#define NAME_KEY(c)     (tolower(c)&(NAME_HASH-1))  /* name index chain of a parameter name's first letter */
 #define NPARAMSM6       NPARAMS + NPARAMS + NPARAMS + NPARAMS + NPARAMS + NPARAMS
 
 /* define the array that holds all parameter values and user filter coefs. */
@@ -284,6 +398,24 @@ int sw_down, sw_down_old, sw_pressed, sw_released; /* used by txrxint_c */
 int gray_code, gray_code_old, cw, ccw, testcount;
 int flash_locked;   /* lock programming of FLASH memory when set */
 int cursor_pos, cursor_pos_vu, cursor_flag, flash_cursor_flag, down_turn_flag, press_flag;
+char lcd_buf[16];       /* characters to display (positions 1 to 16), written by disp_text() */
+char lcd_shown[16];     /* characters on the LCD (sent by lcd_flush()) */
+int lcd_addr;           /* LCD address: position - 1 (0 to 15), 16 - after position 16, 17 - other */
+int lcd_cursor;         /* cursor on the LCD is on */
+int lcd_on;             /* lcd_flush() may write to the LCD (set by reset_lcd()) */
+int lcd_flushing;       /* set while lcd_flush() writes (wait() may call it from the delta interrupt) */
+unsigned lcd_time;      /* timer value at the last LCD write */
+void (*task_func[NTASKS])(void);    /* deferred tasks (0 - free) */
+int task_ticks[NTASKS];     /* time left before each task runs (in multiples of 5ms) */
+int knob_held;          /* knob turns and presses are ignored (see hold_knob()) */
+int knob_idle;          /* time since the last knob turn (in multiples of 5ms, up to KNOB_SETTLE) */
+unsigned knob_samples;  /* samples since the last knob turn (counted by the sample int., up to 0x7fff) */
+unsigned knob_slow;     /* KNOB_SLOW in samples (see set_fsample()) */
+unsigned knob_time, knob_dt;    /* timer value at the last knob turn and the time between the last two (in us) */
+int knob_steps;         /* frequency steps of a fast spin for knob_step() (in 1/12 octaves, + is up) */
+int knob_spin, spin_ptr, spin_ab;   /* a frequency step (param_ptr, index_ab) waits for the knob to settle */
+int beep_count;         /* speaker half periods left (see beep()) */
+unsigned beep_period, beep_time;    /* speaker half period (in us) and timer value at the last toggle */
 int param_ptr, write_ptr, read_ptr, p_state, flag_options;
 int index_ab;           /* flag to specify current menu state:
                         0 - function A
@@ -296,21 +428,74 @@ int params_changed;     /* flag to indicate how params chaged:
                         2 - parameter has changed
                         3 - button press action has been confirmed                  */
 int params_changed_copy;
+int encoder_update;     /* set while main() updates the DSP for a new parameter value (params_changed==2) */
+int update_ptr, update_ab;  /* param_ptr and index_ab of the update in progress (see newer_value()) */
 int led_counter, vu_counter;
 int max_in_level;   /* used to hold calibration constant */
 long min_value, max_value;  /* used to limit min and max values of current parameter */
 long p_long, p_sum, serial_number;  /* used in the parse function: */
 unsigned p_uint1, p_uint2;
 int sn_ok_flag, quietsn_flag;
+unsigned group_slot, group_mask;    /* "ack" slot (0 to 31) and groups (bit g set: member of group g, 1 to 15) */
+unsigned record_groups[2];          /* group_slot and group_mask of the last unpacked record (see main()) */
+int ack_count, ack_error;           /* commands executed and error flag since the last "ack" command */
 int serial_error_flag;
+unsigned rx_overruns, rx_framing, rx_full;  /* receive error counters (see "serstat" command) */
+int rx_stopped;         /* XOFF has been sent */
+unsigned rx_bin_pos, rx_bin_len;    /* byte position (0 - none) and payload length of a binary frame
+                                       in the receive int. (XON and XOFF are data in a frame) */
+unsigned tx_flow;       /* XON or XOFF to send ahead of tx_buf[] (0 - none) */
+unsigned tx_flow_echo;  /* XON/XOFF sent whose echo is still to come (TX_ECHO) */
+int rx_raw;             /* set by parse_command() in the "program:" states (40-49): the receive int.
+                           then stores every byte (XON, XOFF and BIN_SYNC are program data) */
 unsigned data_count;
 int sign_mult, index_ab_p;
+int uf_flags, uf_order, uf_prev;    /* UserFIR upload: flags (1 - symmetric, 2 - antisymmetric, 4 - delta),
+                                       order (if symmetric), previous coef. (if delta) */
 long check_sum;
 unsigned func_addr_temp_a, func_addr_temp_b;
+unsigned bin_hdr[6];    /* binary frame header: address (3 bytes), opcode, length (2 bytes) */
+unsigned bin_len, bin_crc;  /* binary frame payload length and running CRC16 */
+int fw_state;           /* firmware update: 1 - receiving blocks (after BIN_FW_BEGIN), else 0 */
+unsigned fw_len, fw_next;   /* image length and next image word expected (in words) */
+unsigned long fw_image_crc; /* CRC32 of the whole image (see fw_crc()) */
+int txn_flag;           /* set between "begin" and "commit": serial parameter changes are
+                           held in params[][] and the DSP is updated once at "commit" */
+int changed_banks;      /* channels with changed params[][] not yet updated by apply_changes():
+                           bit 0 - A, bit 1 - B, bit 2 - Common, bit 3 - all (SampleRate or Mode) */
+int p_suspend;          /* set while the parser has the DSP functions off (UserFIR coefs. or program data) */
+int p_idle;             /* time since last character while p_suspend is set (in multiples of 5ms) */
+#if(PARSE_STATS)
+long parse_chars, parse_usec;   /* number of characters parsed and total state machine time */
+unsigned parse_usec_max;        /* longest state machine time for one character */
+unsigned exec_usec_max;         /* longest command execute time (rolls over at 32767us) */
+unsigned parse_aborts;          /* number of aborted commands that had the DSP functions off */
+#endif
 float fsample;  /* current sampling rate in Hz*/
 char serial_str[11];    /* serial number string of module (including check sums and terminating null) */
 char serial_in_buf[SERIAL_BUF_LEN]; /* RS-232 serial input buffer */
+char tx_buf[TX_BUF_LEN];    /* RS-232 transmit ring buffer (sent by txrxint_c()) */
+int tx_write_ptr, tx_read_ptr;
+int tx_busy;                /* set from the first character put in tx_buf[] until the last has been sent */
+int telem_period, telem_count;  /* "telem" interval and counter (in multiples of 5ms, 0 - off) */
+unsigned telem_peak[4], telem_clip; /* peak levels (in A, in B, out A, out B) and CLIP bits since the last frame */
+unsigned idle_max;          /* idle_spins() with the DSP functions off (see initialize()) */
+int morph_ticks, morph_count;   /* "morph" length and time so far (in multiples of 5ms, morph_ticks 0 - off) */
+int morph_banks;            /* banks being morphed (bit 0 - A, bit 1 - B, bit 2 - Common) */
+int morph_next;             /* bank morph_step() tries first */
+int morph_clip;             /* banks whose FIR taps fir_live() clipped (same bits as morph_banks) */
+long morph_from[MORPH_ROWS][3], morph_to[MORPH_ROWS][3];  /* start and end of params[MORPH_FIRST ...][] */
+int live_flag;              /* compute_fir() and compute_notch() load the coefs. without muting (see morph_update()) */
+int live_coefs[128];        /* quantized coefs. for fir_live() */
 char parameter_str[17], value_str[17];  /* used by cammand parser to hold incomming command strings */
+int name_first[NAME_HASH];      /* parameter name index: first param_struct[] row of each chain */
+int name_next[NPARAMSTRUCT];    /* next row with the same name key (-1 ends a chain), see param_struct_search() */
+unsigned crc16_table[]={0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+                        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef};   /* used by crc16() */
+unsigned long crc32_table[]={0x00000000L, 0x1db71064L, 0x3b6e20c8L, 0x26d930acL,
+                             0x76dc4190L, 0x6b6b51f4L, 0x4db26158L, 0x5005713cL,
+                             0xedb88320L, 0xf00f9344L, 0xd6d6a3e8L, 0xcb61b38cL,
+                             0x9b64c2b0L, 0x86d3d2d4L, 0xa00ae278L, 0xbdbdf21cL};   /* used by crc32() */
 char vu_chars[]={' ', 8, 9, 10, 11, 12, 13, 14, 15, 'X', 'X', 'X', 'X'};    /* used by vu_update() */
 unsigned gopt_a, gopt_b, aopt_a, aopt_b;    /* optimal CODEC gain and attenuation settings */
 unsigned in_a_vu_level, in_b_vu_level, out_a_vu_level, out_b_vu_level;
@@ -319,8 +504,22 @@ int auto_vu_count;
 int iorder_old;
 float window[128];      /* holds first half of pre-computed modified-Blackman-window */
 
-#define RECORD_LENGTH   6 + NPARAMSM6       /*  Set to (6 + 6*NPARAMS) = (6 + 6*(46+128)) = 1050 */
+#define RECORD_LENGTH   (6 + 6*NPARAMSTRUCT + 3 + 3*256 + 2)  /* max. record length (no UserFIR taps packed):
+                                                       (6 + 6*46 + 3 + 3*256 + 2) = 1055 */
 unsigned record[RECORD_LENGTH];
+unsigned delta_record[DELTA_MAX+2]; /* a delta record read by read_record() */
+
+/* Index of the FLASH records (see index_records()): */
+unsigned rec_ptr[LAST_MEM_LOC+1];   /* latest record of each location (0 if none) */
+unsigned rec_len[LAST_MEM_LOC+1];   /* length of the latest record */
+unsigned rec_base[LAST_MEM_LOC+1];  /* full record it is based on (rec_ptr[] if a full record) */
+unsigned rec_common;                /* base record of the refresh (0 if none) */
+unsigned rec_snap;                  /* DSP state snapshot (0 if none) */
+unsigned rec_group;                 /* latest group record (0 if none) */
+unsigned rec_last;                  /* last record (0 if none) */
+unsigned rec_end;                   /* first blank location */
+unsigned rec_sector;                /* start of the current record sector (0x6000 or 0xe000) */
+unsigned rec_gen;                   /* its generation (see store()) */
 
 /* float in_cal_levels_a[16], in_cal_levels_b[16], out_cal_a[32], out_cal_b[32];
 
@@ -378,6 +577,8 @@ void txrxint_c(void);
 int inc_dec_param_ptr(void);
 void inc_dec_mod(int *ptr, int mod);
 void add_sub_pow(long *ptr, int pow);
+int freq_param(int ptr);
+void knob_step(void);
 void initialize(void);
 void set_fsample(void);
 void init_params(void);
@@ -388,8 +589,10 @@ void reset_lcd(void);
 void update_disp_left(void);
 void update_disp_right(int pos);
 void disp_text(char *text, int position, int cursor_on);
+void lcd_flush(void);
 void disp_num(long num, int position, int width, int nfrac);
 char* num2string(long num, int nfrac, int *strlength, char *str17);
+int name_match(int i);
 void write_lcd_inst(int byte, int wait_usec);
 void write_lcd_data(int byte, int wait_usec);
 void write_lcd_nibble(int nibble, int wait_usec);
@@ -403,6 +606,43 @@ void load_userfir(int iorder, int index_ab_tmp);
 void compute_notch(float fn, float fw, int index_ab_tmp);
 void xmit(char *text);
 void parse_command(void);
+void parse_abort(void);
+void bin_execute(void);
+int set_param(int ptr, int bank, long value);
+void param_limits(int ptr, int bank);
+void apply_changes(void);
+int newer_value(void);
+unsigned crc16(unsigned crc, unsigned byte);
+unsigned long crc32(unsigned long crc, unsigned byte);
+unsigned long fw_crc(unsigned long crc, unsigned offset, unsigned *data, unsigned n);
+int fw_begin(unsigned *data, int nbytes);
+int fw_block(unsigned *data, int nbytes);
+int fw_keep(unsigned *data, int nbytes);
+void fw_hash(unsigned *data, int nbytes);
+int fw_commit(void);
+int fw_install(void);
+void xmit_byte(unsigned byte);
+void xmit_end(void);
+void xmit_flow(unsigned c);
+void xmit_flush(void);
+void xmit_frame(int opcode, unsigned *payload, int n);
+int bin_userfir(unsigned *data, unsigned *end, int bank, int flags, int n);
+int get_tap(int i, int bank);
+void set_tap(int i, int bank, int value);
+int userfir_expand(int n, int nrx, int bank, int flags);
+int pack_record(void);
+void unpack_record(void);
+void bin_dump(void);
+int bin_load(unsigned *data, int nbytes);
+void install_params(int dsp);
+void telem_update(void);
+int morph_start(unsigned loc, long msec);
+void morph_step(void);
+void morph_update(int bank);
+long morph_value(int i, int bank, float frac);
+void morph_finish(int done);
+void fir_live(float *coefs, int iorder, int index_ab_tmp);
+unsigned idle_spins(void);
 void update_dsp(int param_ptr_tmp, int index_ab_tmp);
 void set_all_gains(void);
 void gain(int index_ab_tmp);
@@ -412,8 +652,27 @@ void led_update(void);
 void store(void);
 void recall(void);
 void beep(unsigned duration, unsigned period);
+void beep_update(void);
+void defer(void (*func)(void), long usec);
+void run_tasks(void);
+void restore_disp(void);
+void hold_knob(long usec);
+void release_knob(void);
+void write_aborted(void);
+void store_all_task(void);
 int record_bad(void);
+unsigned read_record(unsigned ptr, unsigned n, unsigned *dest);
+int index_records(void);
+unsigned make_delta(unsigned *full, unsigned n, unsigned *base, unsigned nbase, unsigned base_ptr, unsigned *delta);
+void record_header(unsigned *rec, unsigned ptr, unsigned n, unsigned prev_loc, unsigned loc_code, int delta);
+int compact_records(unsigned current_loc, int all);
+void snap_save(void);
+void group_save(void);
+int snap_load(void);
 void store_all(void);
+void slotsn(void);
+void ack_reply(void);
+long get_number(char **sptr, long default_value);
 /* fcomplex Cadd(fcomplex a, fcomplex b);
 fcomplex Csub(fcomplex a, fcomplex b);
 fcomplex Cmul(fcomplex a, fcomplex b);
@@ -432,7 +691,6 @@ fcomplex RCmul(float x, fcomplex a); */
 void main(void) 
 {
 unsigned count_start;
-unsigned ptr;
 int itemp;
 float ftemp;
 
@@ -448,30 +706,50 @@ initialize();   /* initialize DSP hardware */
 
 #if(MAIN)
 
+/* Finish installing a firmware update if the power failed during fw_install(): */
+read_flash(FW_SLOT + FW_SIG, 5, record);
+if((record[0]==FW_TAG)&&(record[4]==0xffff)){
+  fw_install();
+}
+
 #if(1)     /* fix: make 1 if not */
-/* Check validity of FLASH data memory (sector 3), and write defaults if necessary: */
-/* Search for end of record data in FLASH */
-ptr = 0x6000;   /* point to first record */
-read_flash(ptr, 5, record);     /* read part of record header */
-itemp = 0;
-if(record[0]==0xffff){
+/* Check validity of FLASH data memory (sector 3 or 8), and write defaults if necessary: */
+itemp = index_records();    /* index the records */
+if(rec_group){              /* restore the group assignment first (a refresh below keeps it) */
+  read_flash(rec_group + 6, 2, record_groups);
+  group_slot = record_groups[0];
+  group_mask = record_groups[1];
+}
+if(rec_last==0){            /* blank, or the first record is bad (another module's or old version): */
   store_all();  /* store current settings to all flash memory locations */
 }
-while(record[0]!=0xffff){
-  /* Check for valid version and SN in each record: */
-  if(record_bad()){
-    store_all();    /* store current settings to all flash memory locations */
-    break;
-  }
-  ptr = record[0];              /* point to next location */
-  read_flash(ptr, 5, record);   /* read part of record header */
+else if(itemp){             /* a store was cut off by a power loss: */
+  compact_records(LAST_MEM_LOC+1, 0);   /* keep the good records (refresh them into the idle sector) */
 }
 
 
 /* Recall settings from memory location 0: */
 params[11][0] = 0;  /* load recall location value */
 params_changed_copy = 3;
-recall();           /* recall location 0 settings */
+#if(FAST_BOOT)
+itemp = snap_load();    /* start the filters of location 0 from the snapshot (if it is valid) */
+#else
+itemp = 0;
+#endif
+if(itemp&&read_record(rec_ptr[0], rec_len[0], record)){
+  unpack_record();  /* load params[][] from record[] (the filters are already running) */
+  install_params(0);
+}
+else{
+  recall();         /* recall location 0 settings */
+#if(FAST_BOOT)
+  snap_save();      /* save the DSP state for the next power up */
+#endif
+}
+if(rec_group==0){   /* no group record: the group words of location 0 (not changed by later recalls) */
+  group_slot = record_groups[0];
+  group_mask = record_groups[1];
+}
 
 #endif  /* #if(1) */
 
@@ -516,6 +794,20 @@ while(1){   /* Loop here and flash cursor until a parmeter change is detected or
         count_start = portfffa; /* grab current timer value to avoid delta_t() overflow (resets interval) */
       }
 
+      lcd_flush();              /* send a changed LCD character (if the LCD is ready) */
+      beep_update();            /* toggle the speaker when due */
+
+#if(RX_FLOW)
+      if(rx_stopped && (((write_ptr - read_ptr)&(SERIAL_BUF_LEN-1))<=RX_XON_LEVEL)){
+        rx_stopped = 0;
+        xmit_flow(XON);         /* host may send again */
+      }
+#endif
+
+      if(tx_busy && (tx_read_ptr==tx_write_ptr) && (portfff6&0x1000)){  /* last character has been sent */
+        xmit_end();             /* re-enable receive ints. */
+      }
+
       if(serial_error_flag==1){ /* RS-232 comm. error in txrxint_c() */
         serial_error_flag = 0;  /* reset flag */
 /*        disp_text("Reduce Baud Rate", 1, -1); */
@@ -526,6 +818,9 @@ while(1){   /* Loop here and flash cursor until a parmeter change is detected or
 /*        assembly_flag &= ~3;  /* Turn off the VU Meter */
 /*        auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
         reset_port();
+#if(RX_FLOW)
+        xmit_flow(XON);         /* in case the host was stopped */
+#endif
       }
 
 
@@ -535,16 +830,56 @@ while(1){   /* Loop here and flash cursor until a parmeter change is detected or
         params_changed_copy = params_changed;   /* make working copy for update_dsp() */
         params_changed = 0;     /* reset change flag */
         portfff5 |= 0x0200;     /* re-enable delta interupts */
+        encoder_update = (params_changed_copy==2);  /* compute_fir() may abandon this update for a newer value */
+        update_ptr = param_ptr;
+        update_ab = index_ab;
+        if(morph_ticks&&(params_changed_copy>1)){
+          morph_finish(0);  /* a parameter change ends the "morph" where it is */
+        }
         update_dsp(param_ptr, index_ab);    /* update the DSP's function to reflect current parameters */
+        encoder_update = 0;
         count_start = portfffa; /* grab current timer value to avoid delta_t() overflow (resets interval) */
       }
 #endif
     
     }   /* end while() */
 
+    if((p_suspend||(p_state>=60)) && ((++p_idle)>PARSE_TIMEOUT)){  /* command or frame stopped sending */
+      parse_abort();        /* turn the DSP functions back on (if off) and resync */
+    }
+
+    run_tasks();            /* run the deferred tasks that are due */
+
 #if(MAIN)
     led_update();           /* set overload LEDs to reflect the status of the overload bits */
 
+    if(telem_period){
+      telem_update();       /* collect peaks and send a telemetry frame when due */
+    }
+
+    if(knob_idle<KNOB_SETTLE){
+      ++knob_idle;
+    }
+    if(knob_steps){
+      knob_step();          /* take the frequency steps of a fast spin */
+    }
+    if(knob_spin){
+      if(morph_ticks){
+        morph_finish(0);    /* a knob spin ends the "morph" where it is */
+      }
+      if(knob_idle>=KNOB_SETTLE){   /* compute the settled frequency once: */
+        knob_spin = 0;
+        params_changed_copy = 2;
+        update_dsp(spin_ptr, spin_ab);
+        params_changed_copy = 1;
+        update_dsp(param_ptr, index_ab);    /* restore min_value and max_value of the current parameter */
+      }
+    }
+
+    if(morph_ticks){
+      morph_step();         /* move the filters one step towards the "morph" settings */
+    }
+
     portfff5 &= ~0x0200;    /* suspend delta interupts while testing VU flag and vu levels to display vu_update() */
     if(assembly_flag&3){
       vu_update();          /* update VU meters (this is usually called every 5ms) */
@@ -594,14 +929,24 @@ sw_down=0, sw_pressed=0, sw_released=0; /* used by txrxint_c */
 cw=0, ccw=0, testcount=0;
 down_turn_flag=0, press_flag=0;
 param_ptr=0, write_ptr=0, read_ptr=0, p_state=0, flag_options=0;
+p_suspend=0, p_idle=0;
+changed_banks=0, txn_flag=0;
+#if(PARSE_STATS)
+parse_chars=0, parse_usec=0, parse_usec_max=0, exec_usec_max=0, parse_aborts=0;
+#endif
 serial_error_flag = 0;  /* no RS-232 error */
+rx_overruns=0, rx_framing=0, rx_full=0;
 led_counter=0, vu_counter=0;
 in_a_vu_level=0, in_b_vu_level=0, out_a_vu_level=0, out_b_vu_level=0;
 quietsn_flag = 0;
+group_slot=0, group_mask=0, record_groups[0]=0, record_groups[1]=0;
+ack_count=0, ack_error=0;
+telem_period = 0;   /* no telemetry */
 iorder_old=0;
 flash_locked=1; /* lock programming of FLASH memory when set */
 flash_cursor_flag = 1;  /* start with cursor flashing */
 params_changed=2;   /* flag parameter has changed */
+encoder_update=0;
 max_in_level=20;    /* set calibration constant */
 min_value=LONG_MIN, max_value=LONG_MAX; /* limit min and max values of current parameter */
 
@@ -729,6 +1074,17 @@ for(i=0;i<NPARAMSTRUCT;i++){
   }
 }   /* end for(i=0;i<NPARAMSTRUCT;i++) */
 
+/* Index the parameter names for param_struct_search(); rows are chained by the first letter of
+   the name after any leading space, built backwards so each chain is in table order: */
+for(i=0;i<NAME_HASH;i++){
+  name_first[i] = -1;
+}
+for(i=NPARAMSTRUCT-1;i>=0;i--){
+  j = NAME_KEY(*(param_struct[i].text + (*param_struct[i].text==' ')));
+  name_next[i] = name_first[j];
+  name_first[j] = i;
+}
+
 
 /* Initialize calibration constants with ideal values. Table used, not pow() */
 /*for(i=0;i<16;i++){
@@ -745,6 +1101,9 @@ set_all_gains();    /* set optimal CODEC gains and attenuations */
 
 asm("   clrc    INTM        ; Enable interrupts");
 wait_n_samples(10); /* wait for ~10 sampling intervals (after turning on ints.) for in_error to update */
+#if(MAIN)
+idle_max = idle_spins();    /* reference for the telemetry CPU headroom (DSP functions are still off) */
+#endif
 in_error_stick = 0; /* reset the sticky bits */
 gray_code = 0x0003&portfff6;    /* put rotary encoder bits into gray_code so first sw action is taken */
 
@@ -843,6 +1202,7 @@ else{
   asm("     setc    XF      ; Set the CODEC sampling rate to 8 Ksps");
   fsample = 8000.0;         /* set new sampling rate */
 }
+knob_slow = (unsigned)(fsample*KNOB_SLOW);
 
 
 /* wait_n_samples(200); /* wait for ~200 sampling intervals for CODEC to recalibrate */
@@ -868,6 +1228,46 @@ portfff5 = (ASPCR_URST|ASPCR_DIM|ASPCR_RIM|ASPCR_CAD|ASPCR_CIO3);
 portfff5 = (ASPCR_URST|          ASPCR_RIM|ASPCR_CAD|ASPCR_CIO3);
 #endif
 portfff6 = 0x66f0;  /* IOSR: reset all bits */
+tx_write_ptr = tx_read_ptr = 0; /* drop anything not sent (transmit int. is off) */
+tx_busy = 0;
+tx_flow = 0, rx_stopped = 0;
+}
+
+
+/**************************************************************************
+ * xmit_end
+ * Called by main() when tx_buf[] is empty and the last character has
+ * been sent (TEMT). Re-enables the receive ints.
+ *
+ **************************************************************************/
+void xmit_end(void)
+{
+#if(TX_ECHO)
+portfff6 = 0x6700;      /* reset any async. serial port interrupt indicator bits (and our echo) */
+#endif
+portfff5 |= 0x0080;     /* re-enable receive ints. (also after "sendsn" and "slotsn") */
+tx_busy = 0;
+}
+
+
+/**************************************************************************
+ * xmit_flow
+ * Sends XON or XOFF ahead of anything waiting in tx_buf[] (called by
+ * txrxint_c() and main()).
+ *
+ **************************************************************************/
+void xmit_flow(unsigned c)
+{
+#if(TX_ECHO)
+tx_flow_echo++;             /* receive int. drops the echo (RIM stays on so the host is not missed) */
+#endif
+if(!(portfff5&ASPCR_TIM) && (portfff6&0x0800)){    /* transmitter idle (THRE): */
+  portfff4 = c;             /* send now */
+}
+else{
+  tx_flow = c;              /* send on the next THRE int. */
+}
+portfff5 |= ASPCR_TIM;
 }
 
 
@@ -881,7 +1281,7 @@ void sign_on(void)
 #if(MAIN)
 
 #if(SIGN_ON_FLAG_Versa_Filter)
-disp_text("Versa-Filter2-20", 1, -1);
+disp_text("Versa-Filter2-45", 1, -1);
 wait(1000000);  /* wait 1 sec. */
 #endif
 
@@ -937,18 +1337,25 @@ disp_text("", 16, 1);   /* turn on cusor in position 16 */
  **************************************************************************/
 void parse_command(void)
 {
-int i, j, itemp, iflag, cursortemp, execute_flag=0, program_flag=0, prog_err_flag=0;
+int i, j, itemp, iflag, cursortemp, execute_flag=0, program_flag=0, prog_err_flag=0, bin_flag=0;
 int param_ptr_temp, index_ab_temp, flag_options_temp, change_value_flag;
 long param_value;
 char *value_ptr, *cptr;
 char ctemp, craw;
 char carray[17];
 unsigned utemp;
+#if(PARSE_STATS)
+unsigned count_start;
+#endif
 
 /*portfff5 &= ~0x0200;  /* suspend delta interupts while updating display (disp_xxxx below) */
 cursortemp = cursor_pos;    /* save current cursor position */
+p_idle = 0;                 /* restart PARSE_TIMEOUT */
 
 while(write_ptr!=read_ptr){
+#if(PARSE_STATS)
+  count_start = portfffa;           /* grab current timer value (for parser timing) */
+#endif
   craw = serial_in_buf[read_ptr++]; /* get current character */
   ctemp = tolower(craw);            /* convert to lower case */
   read_ptr &= SERIAL_BUF_LEN-1; /* make shure that read_ptr was incremented modulo SERIAL_BUF_LEN */
@@ -958,6 +1365,11 @@ while(write_ptr!=read_ptr){
   switch(p_state){
   case 0:   /* Start of parse: */
     if(ctemp=='a') p_state = 1;
+    else if((craw&0xff)==BIN_SYNC){    /* start of binary frame */
+      bin_crc = 0xffff;
+      data_count = 0;
+      p_state = 60;
+    }
     sn_ok_flag = 0;
     break;
   case 1:   /* Received: a */
@@ -968,6 +1380,7 @@ while(write_ptr!=read_ptr){
   case 2:   /* Received: at */
     if(ctemp=='a') p_state = 3;
     else if(ctemp=='s') p_state = 5;
+    else if(ctemp=='g') p_state = 9;
     else if(ctemp==' ') p_state = 2;
     else p_state = 0;
     break;
@@ -1030,6 +1443,41 @@ while(write_ptr!=read_ptr){
     }
     break;
 
+  case 9:   /* Received: at g */
+    if(ctemp=='r') p_state = 10;
+    else p_state = 0;
+    break;
+  case 10:  /* Received: at gr */
+    if(ctemp=='p') p_state = 11;
+    else p_state = 0;
+    break;
+  case 11:  /* Received: at grp */
+    if(ctemp==':'){
+      p_long = 0;
+      p_state = 12;
+    }
+    else p_state = 0;
+    break;
+  case 12:  /* Received: at grp: (one or more group numbers, eg. at grp:3,5) */
+    if(isdigit(ctemp)){
+      p_long = 10*p_long + (long)(ctemp&0x0f);  /* convert character to number; next digit */
+    }
+    else if(ctemp==' ') p_state = 12;
+    else{
+      if((p_long>0)&&(p_long<16)&&((group_mask>>(int)p_long)&1)){
+        sn_ok_flag = 1;     /* member of this group */
+      }
+      p_long = 0;
+      if(ctemp!=','){
+        /* Modulo decrement read_ptr because current char could be the first char of command: */
+        if((read_ptr--)==0){
+          read_ptr = SERIAL_BUF_LEN-1;
+        }
+        p_state = 20;
+      }
+    }
+    break;
+
   case 20:  /* Received valid header and serial number (eg. at sn:132001) */
     if(isalpha(ctemp)){ /* if ctemp is a letter */
       for(i=0;i<17;i++){
@@ -1049,10 +1497,14 @@ while(write_ptr!=read_ptr){
     else if(ctemp==':'){    /* if parameter reception complete */
       p_state = 22;
       if(strncmp(parameter_str, "program",7)==0){;  /* if parameter_str == "program" */
+        func_addr_temp_a = func_addr_a;   /* save the current A function (restored if command is aborted) */
+        func_addr_temp_b = func_addr_b;   /* save the current B function */
+        p_suspend = 1;
         func_addr_a = (unsigned)&no_func_a;  /* set the functions to none to get maximum CPU time */
         func_addr_b = (unsigned)&no_func_b;  /* set the functions to none to get maximum CPU time */
         assembly_flag &= ~3;    /* turn off the VU Meter */
         /* auto_vu_count = (int)params[2][0];   /* restart counter; set to 0 or 1 depending on RevertToLevels */
+        rx_raw = 1;             /* raw program data follows "d:" (no flow control filtering) */
         p_state = 40;
       }
     }
@@ -1077,7 +1529,10 @@ while(write_ptr!=read_ptr){
       func_addr_temp_b = func_addr_b;   /* save the current B function */
       func_addr_a = (unsigned)&no_func_a;   /* set the functions to none to get maximum CPU time */
       func_addr_b = (unsigned)&no_func_b;
+      p_suspend = 1;
       data_count = 0;   /* clear coef. order counter */
+      uf_flags = 0;     /* not symmetric, not delta */
+      uf_prev = 0;
       p_state = 30;
     }
     else{
@@ -1104,6 +1559,15 @@ while(write_ptr!=read_ptr){
       p_long = (long)(ctemp&0x0f);  /* convert character to number */
     }
     else if(ctemp=='\r') goto p_cont1;
+    else if((ctemp=='s')||(ctemp=='a')){    /* 's#' symmetric or 'a#' antisymmetric (# = order) */
+      uf_flags |= (ctemp=='s') ? 1:2;       /* only the first (order+1)/2 coefs. follow */
+      uf_order = 0;
+      p_state = 32;
+    }
+    else if(ctemp=='d'){    /* 'd': coefs. that follow are differences from the previous coef. */
+      uf_flags |= 4;
+      p_state = 30;
+    }
     else p_state = 0;
     switch(parameter_str[0]){   /* look at first letter of parameter_str[] */
     case 'a':   /* 'afunc' likely */
@@ -1127,12 +1591,16 @@ while(write_ptr!=read_ptr){
     else if((ctemp==' ')||(ctemp=='\r')){   /* coef. ready */
       p_state = 30;
       p_long = sign_mult*p_long;        /* change sign if nessasary */
+      if(uf_flags&4){                   /* if delta coefs. */
+        p_long += uf_prev;
+      }
       if(p_long>32767){                 /* hard limit values */
         p_long = 32767;
       }
       if(p_long<-32768){
         p_long = -32768;
       }
+      uf_prev = (int)p_long;
       utemp = NPARAMSTRUCT + (data_count>>1);   /* offset plus data_count divided by 2 */
       if((data_count++)&0x0001){        /* if data count odd: 1, 3, 5,... */
         params[utemp][index_ab_p] |= (p_long<<16);  /* load odd coef. into MS Byte of array */
@@ -1154,15 +1622,26 @@ while(write_ptr!=read_ptr){
     else p_state = 0;
     if(ctemp=='\r'){    /* if ctemp carrage return, then we are done getting FIR coefs */
 p_cont1:
+      if(uf_flags&3){   /* if symmetric or antisymmetric, fill in the second half */
+        data_count = userfir_expand(uf_order, data_count, index_ab_p, uf_flags);
+      }
       if(data_count<3) data_count = 3;      /* 3 is the minimum filter order */
       params[40][index_ab_p] = data_count;  /* save order of the filter that was just loaded */
       params[41][index_ab_p] = 1L;  /* set coef. pointer to 1 when changing order */
       func_addr_a = func_addr_temp_a; /* reset the function */
       func_addr_b = func_addr_temp_b; /* reset the function */
+      p_suspend = 0;
       execute_flag = 1;
       p_state = 0;
     }
     break;
+  case 32:  /* Received 'func:UserFIR: s' or 'func:UserFIR: a', now get order */
+    if(isdigit(ctemp)){
+      uf_order = 10*uf_order + (int)(ctemp&0x0f);   /* convert character to number; next digit */
+    }
+    else if(ctemp==' ') p_state = 30;
+    else p_state = 0;
+    break;
 
   /* Read FLASH programming parameters: */
   case 40:  /* Received "program:" string */
@@ -1277,6 +1756,7 @@ p_cont1:
     if((data_count++) == 7){    /* full check sum received, verify: */
       if(p_sum==check_sum){ /* received check sum == calculated check sum */
         program_flag = 1;   /* set flag to program FLASH */
+        p_suspend = 0;      /* leave the DSP functions off while programming */
       }
       else{ /* bad check sum */
         prog_err_flag = 1;
@@ -1285,10 +1765,55 @@ p_cont1:
     }
     break;
 
+  /* Read binary frame: BIN_SYNC, address (3 bytes), opcode, length (2 bytes), payload, CRC16 (2 bytes).
+     Bytes are MS byte first. The CRC16 (CCITT) covers address through payload. */
+  case 60:  /* Received BIN_SYNC, now get header */
+    bin_crc = crc16(bin_crc, craw&0xff);
+    bin_hdr[data_count++] = craw&0xff;
+    if(data_count==6){
+      bin_len = (bin_hdr[4]<<8)|bin_hdr[5];
+      data_count = 0;
+      if(bin_len>BIN_MAX_LEN) p_state = 0;  /* bad length, look for next command */
+      else if(bin_len==0) p_state = 62;
+      else p_state = 61;
+    }
+    break;
+  case 61:  /* Received header, now load payload (one byte per word) into flash_data[] */
+    bin_crc = crc16(bin_crc, craw&0xff);
+    flash_data[data_count++] = craw&0xff;
+    if(data_count==bin_len){
+      data_count = 0;
+      p_state = 62;
+    }
+    break;
+  case 62:  /* Received payload, now get CRC (running CRC is 0 after both bytes if OK) */
+    bin_crc = crc16(bin_crc, craw&0xff);
+    if((data_count++)==1){
+      bin_flag = (bin_crc==0);
+      p_state = 0;
+    }
+    break;
+
   default:
     break;
   } /* end switch(p_state) */
 
+  if(rx_raw && ((p_state<40)||(p_state>49))){   /* "program:" data done (or aborted) */
+    rx_raw = 0;
+  }
+
+  if(p_suspend && (p_state<30)){    /* if UserFIR or program command was aborted (bad char.) */
+    parse_abort();                  /* turn the DSP functions back on */
+  }
+
+#if(PARSE_STATS)
+  utemp = (unsigned)delta_t(count_start);   /* state machine time for this character */
+  parse_chars++;
+  parse_usec += utemp;
+  if(utemp>parse_usec_max) parse_usec_max = utemp;
+  count_start = portfffa;                   /* grab current timer value (for execute timing) */
+#endif
+
 
 /* Execute serial Command section: */
 
@@ -1298,8 +1823,15 @@ disp_text(value_str, 9, -1); */
 
 #if(MAIN)
 
+  if(bin_flag){         /* Execute binary frame with good CRC */
+    bin_execute();
+    bin_flag = 0;
+  }
+
   if(sn_ok_flag && execute_flag){     /* Execute command in parameter_str and value_str (if valid) */
+    ack_count++;            /* reported by "ack" */
     if(strncmp(parameter_str, "reset", 5)==0){
+      xmit_flush(); /* finish sending any reply */
       initialize(); /* initialize DSP hardware */
       /* sign_on(); /* display the sign-on message */
     }
@@ -1325,9 +1857,95 @@ disp_text(value_str, 9, -1); */
       wait(SENDSN_WAIT*(long)rand());   /* wait a random ammout of time, rand() is 0 to 32767 */
       xmit(serial_str);     /* send serial number with check sums out the RS-232 port */
     }
+    else if(!quietsn_flag && strncmp(parameter_str, "slotsn", 6)==0){
+      slotsn();             /* send serial number in the slot selected by the serial number */
+    }
     else if(strncmp(parameter_str, "quietsn", 7)==0){
       quietsn_flag = 1;     /* don't send serial number on sucsesive "sendsn" commands */
     }
+    else if(strncmp(parameter_str, "loudsn", 6)==0){
+      quietsn_flag = 0;     /* answer "sendsn" and "slotsn" commands again */
+    }
+    else if(strncmp(parameter_str, "begin", 5)==0){
+      txn_flag = 1;         /* hold parameter changes until "commit" */
+    }
+    else if(strncmp(parameter_str, "commit", 6)==0){
+      txn_flag = 0;
+      apply_changes();      /* update the DSP: compute each changed channel once */
+    }
+    else if(strncmp(parameter_str, "group", 5)==0){
+      if(value_str[0]!='\0'){  /* "group:slot g1 g2 ...": set "ack" slot and groups (saved in FLASH, see group_save()) */
+        cptr = &value_str[0];
+        group_slot = (unsigned)get_number(&cptr, 0L)&0x1f;
+        group_mask = GROUP_SET;
+        while((i = (int)get_number(&cptr, 0L))!=0){
+          if(i<16) group_mask |= 1<<i;
+        }
+        group_save();       /* keep it over a power cycle */
+      }
+      else{     /* transmit (one per line): slot, groups (bit g set: member of group g) */
+        xmit(num2string((long)group_slot, 0, &i, (char*)&carray));
+        xmit(num2string((long)(group_mask&~GROUP_SET), 0, &i, (char*)&carray));
+      }
+    }
+    else if(strncmp(parameter_str, "ack", 3)==0){
+      ack_reply();          /* answer in our slot with the commands executed since the last "ack" */
+    }
+    else if(strncmp(parameter_str, "telem", 5)==0){
+      /* send a telemetry frame every value_str ms (0 - off), in the slot group_slot of the period */
+      cptr = &value_str[0];
+      telem_period = (int)(get_number(&cptr, 0L)/5);
+      if(telem_period && !(group_mask&GROUP_SET)){
+        telem_period = 0;       /* no slot assigned ("group"): the modules would all send at once */
+        assembly_flag &= ~0x10;
+        goto parse_error;
+      }
+      if(telem_period){
+        if(telem_period<TELEM_MIN) telem_period = TELEM_MIN;
+        i = (int)((TELEM_CHARS*160.0e6/(2.0*XTAL))*(float)portfff7/5000.0) + 1;    /* slot length (in 5ms ticks) */
+        if((int)(group_slot + 1)*i>telem_period){
+          telem_period = 0;     /* our slot does not fit in the period: telemetry off */
+          assembly_flag &= ~0x10;
+          goto parse_error;
+        }
+        telem_count = telem_period - 1 - (int)group_slot*i; /* first frame in our slot */
+        telem_peak[0]=0, telem_peak[1]=0, telem_peak[2]=0, telem_peak[3]=0;
+        telem_clip = 0;
+        assembly_flag |= 0x10;  /* peak hold on */
+      }
+      else{
+        assembly_flag &= ~0x10;
+      }
+    }
+    else if(strncmp(parameter_str, "morph", 5)==0){
+      /* "morph:loc msec": move to the settings of memory location loc over msec ms */
+      cptr = &value_str[0];
+      param_value = get_number(&cptr, -1L);
+      if((param_value<0)||(param_value>LAST_MEM_LOC)||morph_start((unsigned)param_value, get_number(&cptr, 0L))){
+        goto parse_error;
+      }
+    }
+    else if(strncmp(parameter_str, "dump", 4)==0){
+      bin_dump();           /* send all settings in a BIN_DUMP reply frame */
+    }
+    else if(strncmp(parameter_str, "serstat", 7)==0){
+      /* transmit (one per line): receive overruns, framing errors/breaks, buffer full, then clear */
+      xmit(num2string((long)rx_overruns, 0, &i, (char*)&carray));
+      xmit(num2string((long)rx_framing, 0, &i, (char*)&carray));
+      xmit(num2string((long)rx_full, 0, &i, (char*)&carray));
+      rx_overruns=0, rx_framing=0, rx_full=0;
+    }
+#if(PARSE_STATS)
+    else if(strncmp(parameter_str, "parsestat", 9)==0){
+      /* transmit (one per line): chars total_usec max_usec max_exec_usec aborts, then clear */
+      xmit(num2string(parse_chars, 0, &i, (char*)&carray));
+      xmit(num2string(parse_usec, 0, &i, (char*)&carray));
+      xmit(num2string((long)parse_usec_max, 0, &i, (char*)&carray));
+      xmit(num2string((long)exec_usec_max, 0, &i, (char*)&carray));
+      xmit(num2string((long)parse_aborts, 0, &i, (char*)&carray));
+      parse_chars=0, parse_usec=0, parse_usec_max=0, exec_usec_max=0, parse_aborts=0;
+    }
+#endif
     else if(strncmp(parameter_str, "echo", 4)==0){
       disp_text("                ", 1, -1);
       disp_text(value_str, 1, -1);
@@ -1339,7 +1957,7 @@ disp_text(value_str, 9, -1); */
       /* Do parameter search here: */
       param_ptr_temp = param_struct_search(&itemp); /* search param_struct[i].text for parameter_str[] */
       if(!itemp){   /* if no match */
-        goto parse_continue;    /* error in parameter_str[] */
+        goto parse_error;      /* error in parameter_str[] */
       }
       flag_options_temp = 0;
       if(itemp==3){         /* if 1-offset: " APgain"=="APgain" */
@@ -1357,7 +1975,7 @@ disp_text(value_str, 9, -1); */
           index_ab_temp = 1;
         }
         else{
-          goto parse_continue;  /* error in parameter_str[] */
+          goto parse_error;    /* error in parameter_str[] */
         }
       }
       
@@ -1368,11 +1986,11 @@ disp_text(value_str, 9, -1); */
         /* If received command does not correspond to current function, then error: */
         if(   (params[6][0]==0 && index_ab_temp!=2)     /* if Mode==A&B Common and no common param */
            || (params[6][0]!=0 && index_ab_temp==2) ){  /* if Mode!=A&B Common and common param */
-           goto parse_continue; /* error in parameter_str[] */
+           goto parse_error;   /* error in parameter_str[] */
         }     
         /* if received command not related to current function */
         if(param_ptr_temp&&(param_ptr_temp<param_ptr_start[itemp] || param_ptr_temp>param_ptr_end[itemp])){
-           goto parse_continue; /* error in parameter_str[] */
+           goto parse_error;   /* error in parameter_str[] */
         }     
       }
       /* A valid match to parameter was found. Now now get value: */
@@ -1396,7 +2014,7 @@ disp_text(value_str, 9, -1); */
           }
         }
         if(param_value<0){  /* if no match */
-          goto parse_continue;  /* error in parameter_str[] */
+          goto parse_error;    /* error in parameter_str[] */
         }
       }
       else{     /* display type: "text int" or "text float" */
@@ -1443,8 +2061,13 @@ disp_text(value_str, 9, -1); */
 
       
       if(change_value_flag){    /* update params[][] with param_value */
-        params[param_ptr][index_ab] = param_value;  /* load new parameter value */
-        params_changed = 3;     /* flag main loop to update DSP (because we changed parameter values) */
+        if(txn_flag && (set_param(param_ptr, index_ab, param_value)==0)){
+          ;     /* held in params[][] until "commit" (press options are done now, below) */
+        }
+        else{
+          params[param_ptr][index_ab] = param_value;  /* load new parameter value */
+          params_changed = 3;     /* flag main loop to update DSP (because we changed parameter values) */
+        }
       }
       else{ /* no value was specified, so x-mit current value out the RS-232 port */
         param_value = params[param_ptr][index_ab];  /* get current param value */
@@ -1479,21 +2102,23 @@ disp_text(value_str, 9, -1); */
 /*assembly_flag &= ~3;  /* turn off the VU Meter */
 /*auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
     }   /* end parameter search */
+    goto parse_continue;
     
-    
+parse_error:
+    ack_error = 1;          /* reported by "ack" */
 parse_continue:
     execute_flag = 0;
+#if(PARSE_STATS)
+    utemp = (unsigned)delta_t(count_start); /* command execute time */
+    if(utemp>exec_usec_max) exec_usec_max = utemp;
+#endif
   }
 #endif  /* #if(MAIN) */
 
 
   if(sn_ok_flag && prog_err_flag){
     disp_text("PARAMETER ERROR ", 1, -1);
-    wait(1000000);  /* wait 1 sec. */
-    disp_text("WRITE ABORTED!  ", 1, -1);
-    wait(2000000);  /* wait 2 sec. */
-    update_disp_left();     /* update display to reflect parameter settings */
-    update_disp_right(1);
+    defer(write_aborted, 1000000);  /* then "WRITE ABORTED!" for 2 sec. */
     params_changed = 2;     /* flag main loop to update DSP (because we changed func_addr_a and _b above) */
     prog_err_flag = 0;
 /*assembly_flag &= ~3;  /* turn off the VU Meter */
@@ -1537,6 +2162,11 @@ parse_continue:
     if(itemp==0){   /* if no error */
       disp_text("Sector   Prog OK", 1, -1);
       disp_num(p_uint1/8192, 7, 2 ,0);  /* update final Sector # */
+#if(MAIN)
+      if((p_uint1&0x7fff)==0x6000){     /* record sector 3 or 8 */
+        index_records();                /* use the new records */
+      }
+#endif
 /*    disp_text("Cycle power!    ", 1, -1); /* fix: send this message from PC after all sectors programmed */
 /*    wait(1000000);    /* wait 1 sec. */
 
@@ -1561,114 +2191,599 @@ if(cursor_pos!=cursortemp){     /* if cursor position was modified (by any disp_
 
 
 /**************************************************************************
- * txrxint_c (delta interrupt service routine)
- * This is the c-code part of the interrupt service routine that handles
- * the user input actions on both the RS-232 and switch inputs.
- * 
- * This interrupt is initially handled in assembly so that the
- * sample interrupts can be quickly turned back on so no
- * samples will be missed.
+ * parse_abort
+ * Abandons a partly received command. If the parser had turned the DSP
+ * functions off (while receiving UserFIR coefficients or program data),
+ * the saved functions are turned back on so the audio is not left muted.
+ * Coefficients already received stay in params[][] but are not loaded.
  *
  **************************************************************************/
-void txrxint_c(void)
+void parse_abort(void)
 {
-int i, j, temp_pos, type, nstart, n_offset, nlength, nfrac, nlabel;
-int io;
-int sum2, io0_sum, io1_sum, io2_sum;
-unsigned count_start;
-long jj;
-char carray[8];
-
-/***** Get RS-232 Action: *************************************************/
-if(iosr_copy&0x4000){   /* an "a" Detect Complete interrupt occurred */
-  portfff5 &= ~ASPCR_CAD;   /* reset the "calibrate "a" detect" (CAD) bit in the ASPCR*/
-  portfff6 = 0x4000;    /* reset the ""a" detect complete" (ADC) bit in the IOSR */
+if(p_suspend){
+  func_addr_a = func_addr_temp_a;   /* reset the functions */
+  func_addr_b = func_addr_temp_b;
+  p_suspend = 0;
+#if(PARSE_STATS)
+  parse_aborts++;
+#endif
+}
+p_idle = 0;
+p_state = 0;
+rx_bin_pos = 0;     /* resync the receive int. too */
+rx_raw = 0;
+tx_flow_echo = 0;
 }
 
-/* if(portfff6&0x2600){ /* a break, framing error, or receive overrun detected */
-/*  disp_text("OVERRUN ERROR!  ", 1, -1);
-  wait(1000000);
-  disp_num(portfff6,0,16,0);
-  wait(1000000);
-}   /* for testing */
 
-if(iosr_copy&0x0100){   /* a serial Data Ready interrupt occurred */
-  assembly_flag &= ~3;  /* Turn off the VU Meter to help avoid loosing data
-                           If the sample int. is bussy (full order filters, VU-meter, wtnoise on)
-                           then serial data will be missed if a new character is received too soon.
-                           38.4Kbaud seems to be the maximum in this case.                     */
+/**************************************************************************
+ * bin_execute
+ * Executes a binary frame (with good CRC) that is in bin_hdr[] and
+ * flash_data[] (payload, one byte per word). The address is a serial
+ * number, BIN_ALL or BIN_GROUP + group. Frames addressed to this
+ * module's serial number are answered with a reply frame:
+ * opcode + BIN_ACK and one status byte (0 - OK, 1 - bad opcode,
+ * 2 - bad length, 3 - bad parameter).
+ *
+ *  BIN_PARAMS  payload: n times: param index, bank (0 - A, 1 - B, 2 - Common),
+ *                       value (4 bytes, 2's comp.), set in order by set_param()
+ *                       (a BP/BS center or width moves f1 and f2, so the last
+ *                       of f1/f2 or center/width in the frame wins)
+ *  BIN_USERFIR payload: bank, n taps (2 bytes each, 2's comp.)
+ *  BIN_UFPACKED payload: bank, flags, order n (2 bytes), taps. flags: 1 - symmetric,
+ *                       2 - antisymmetric (only the first (n+1)/2 taps are sent),
+ *                       4 - taps are differences from the previous tap, sent as
+ *                       zigzag varints (7 bits per byte, LS first, bit 7 set if
+ *                       more bytes follow), else taps are 2 bytes each
+ *  BIN_DUMP    payload: none. Answered (unicast only) with the settings instead
+ *                       of a status byte (see bin_dump())
+ *  BIN_LOAD    payload: the payload of a BIN_DUMP reply
+ *  BIN_FW_BEGIN payload: image length in words (2 bytes), image CRC32 (4 bytes)
+ *  BIN_FW_BLOCK payload: image word offset (2 bytes), CRC32 of the block (4 bytes),
+ *                       1 to FW_BLOCK words (2 bytes each)
+ *  BIN_FW_STATUS payload: none. Answered (unicast only) with fw_state, fw_next
+ *                       (2 bytes) and fw_len (2 bytes) instead of a status byte
+ *  BIN_FW_COMMIT payload: none
+ *  BIN_FW_HASH payload: image word offset (2 bytes), number of blocks. Answered
+ *                       (unicast only) with the CRC32s instead of a status byte
+ *                       (see fw_hash())
+ *  BIN_FW_KEEP payload: image word offset (2 bytes), length in words (2 bytes),
+ *                       CRC32 of the block (4 bytes)
+ * The firmware update frames also answer 4 - CRC error, 5 - FLASH error.
+ *
+ **************************************************************************/
+void bin_execute(void)
+{
+long addr, value;
+int i, n, status;
+unsigned *bptr, reply[5];
 
-  serial_in_buf[write_ptr++] = portfff4;    /* read the serial data ADTR (also resets the DR bit in the IOSR) */
-  
-  write_ptr &= SERIAL_BUF_LEN-1;    /* make shure that write_ptr was incremented mod SERIAL_BUF_LEN */
+if(bin_hdr[3]&BIN_ACK){
+  return;               /* a reply (or telemetry) frame of a module, not a command */
+}
+addr = ((long)bin_hdr[0]<<16)|((long)bin_hdr[1]<<8)|(long)bin_hdr[2];
+if((addr!=BIN_ALL)&&(addr!=serial_number)){
+  i = (int)(addr - BIN_GROUP);
+  if((i<1)||(i>15)||!((group_mask>>i)&1)){
+    return;             /* not for this module or its groups */
+  }
+}
 
-  auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
+status = 0;
+switch(bin_hdr[3]){     /* switch on opcode */
+case BIN_PARAMS:        /* set parameters */
+  if(bin_len%6){
+    status = 2;
+    break;
+  }
+  for(bptr=flash_data;bptr<flash_data+bin_len;bptr+=6){
+    value = ((long)bptr[2]<<24)|((long)bptr[3]<<16)|((long)bptr[4]<<8)|(long)bptr[5];
+    if(set_param((int)bptr[0], (int)bptr[1], value)){
+      status = 3;       /* bad parameter (skipped) */
+    }
+  }
+  break;
 
-    
-  if(write_ptr==read_ptr || portfff6&0x2600){   /* Buffer was just overwritten or a break, framing error,
-                                                   or receive overrun detected */
-/*  if(write_ptr==read_ptr){    /* Buffer was just overwritten (FIX: garentee no overflow?) */
-    serial_error_flag = 1;  /* flag serial comm. error for main() */
+case BIN_USERFIR:       /* load UserFIR coefs. */
+  if((bin_len&1)==0){
+    status = 2;
+    break;
   }
+  status = bin_userfir(&flash_data[1], flash_data + bin_len, (int)flash_data[0], 0, (int)(bin_len - 1)>>1);
+  break;
 
-  return;   /* get out as soon as possible (when full DSP utilization, we have been missing chars) */
+case BIN_UFPACKED:      /* load UserFIR coefs. (symmetric and/or delta) */
+  if(bin_len<4){
+    status = 2;
+    break;
+  }
+  n = (int)((flash_data[2]<<8)|flash_data[3]);  /* order */
+  status = bin_userfir(&flash_data[4], flash_data + bin_len, (int)flash_data[0], (int)flash_data[1], n);
+  break;
 
-}
+case BIN_DUMP:          /* send all settings */
+  if(addr==serial_number){
+    bin_dump();
+  }
+  return;
 
+case BIN_LOAD:          /* load all settings */
+  status = bin_load(flash_data, (int)bin_len);
+  break;
 
-#if(MAIN)
-/***** Get Switch Action: *************************************************/
-if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
-  /***** Set appropriate SW Action flags (sw_pressed, sw_released, cw, ccw): */
-  sum2=0, io0_sum=0, io1_sum=0, io2_sum=0;  /* init. some vars. */
+case BIN_FW_BEGIN:      /* start a firmware update */
+  status = fw_begin(flash_data, (int)bin_len);
+  break;
 
-  io = iosr_copy;
-  count_start = portfffa;       /* grab current timer value (for debounce interval timing) */
-  while(delta_t(count_start)<SW_DEBOUNCE){  /* accumulate sw states over debounce interval (~1000uS) */
-  /* while(sum<100) */
-    io0_sum += 0x0001&io;       /* do runing sum of IO0 */
-    io1_sum += 0x0001&(io>>1);  /* do runing sum of IO1 */
-    io2_sum += 0x0001&(io>>2);  /* do runing sum of IO2 */
-    io = portfff6;              /* read iosr */
-    sum2++;
-  }
-  sum2 = sum2>>1;   /* divide sum by 2 */
+case BIN_FW_BLOCK:      /* firmware image block */
+  status = fw_block(flash_data, (int)bin_len);
+  break;
 
-  /* Update Switch and Rotary-Encoder Action parameters: */
-  sw_down_old = sw_down;            /* keep sw_down history */
-  sw_down = io2_sum<sum2;           /* get inverse of IO2, switch input bit */
-  if(sw_down&&(!sw_down_old)){  /* determine if sw pressed or released based on states */
-    sw_pressed = 1;
-  }
-  if((!sw_down)&&sw_down_old){
-    sw_released = 1;
+case BIN_FW_STATUS:     /* send the firmware update progress */
+  if(addr==serial_number){
+    reply[0] = fw_state;
+    reply[1] = fw_next>>8;
+    reply[2] = fw_next&0xff;
+    reply[3] = fw_len>>8;
+    reply[4] = fw_len&0xff;
+    xmit_frame(BIN_FW_STATUS + BIN_ACK, reply, 5);
   }
+  return;
 
-#if(ENCODER_TYPE==0)    /* Panasonic */
-  if(0x0010&iosr_copy){             /* quick return if only input 0 changed */
-   return;
-  }
+case BIN_FW_COMMIT:     /* verify and install the firmware image */
+  status = fw_commit();
+  break;
 
-  gray_code_old = gray_code; 
-  gray_code = ((io1_sum>sum2)<<1)|(io0_sum>sum2);   /* get code for Rotary Encoder (0,1,3,2) */
-  switch((gray_code_old<<2)|gray_code){
-  case 3:
-  case 12:
-  case 7:
-  case 8:
-    ccw = 1;
-    break;
-  case 6:
-  case 9:
-  case 2:
-  case 13:
-    cw = 1;
-    break;
+case BIN_FW_HASH:       /* send the CRC32s of the installed image blocks */
+  if(addr==serial_number){
+    fw_hash(flash_data, (int)bin_len);
   }
-#else   /* Switch Channel */
-  gray_code_old = gray_code; 
-  gray_code = ((io1_sum>sum2)<<1)|(io0_sum>sum2);   /* get code for Rotary Encoder (0,1,3,2) */
-  switch((gray_code_old<<2)|gray_code){
+  return;
+
+case BIN_FW_KEEP:       /* copy an unchanged image block */
+  status = fw_keep(flash_data, (int)bin_len);
+  break;
+
+default:
+  status = 1;
+  break;
+}
+
+apply_changes();        /* recompute each changed channel once */
+ack_count++;            /* reported by "ack" */
+if(status){
+  ack_error = 1;
+}
+
+if(addr==serial_number){
+  i = status;
+  xmit_frame(bin_hdr[3] + BIN_ACK, (unsigned*)&i, 1);
+}
+}
+
+
+/**************************************************************************
+ * bin_userfir
+ * Loads n UserFIR taps for bank from a binary frame payload (data to end,
+ * see bin_execute()) and sets FUNC:UserFIR. Returns the bin_execute()
+ * status: 0 - OK, 2 - bad length, 3 - bad parameter.
+ *
+ **************************************************************************/
+int bin_userfir(unsigned *data, unsigned *end, int bank, int flags, int n)
+{
+int i, nrx, shift;
+long value;
+unsigned long uvalue;
+
+if((bank<0)||(bank>2)||(flags&~7)){
+  return 3;
+}
+if((n<3)||(n>((params[6][0]==2) ? 256:128))){   /* allow long filters on Ch A Only */
+  return 2;
+}
+nrx = (flags&3) ? (n+1)>>1 : n;     /* number of taps sent */
+
+value = 0;
+for(i=0;i<nrx;i++){
+  if(flags&4){          /* zigzag varint of difference from previous tap */
+    uvalue = 0;
+    shift = 0;
+    do{
+      if(data>=end) return 2;
+      uvalue |= (unsigned long)(*data&0x7f)<<shift;
+      shift += 7;
+    } while(*data++&0x80);
+    value += (uvalue&1) ? -(long)((uvalue+1)>>1) : (long)(uvalue>>1);
+  }
+  else{                 /* 2 bytes, 2's comp. */
+    if(data+1>=end) return 2;
+    value = (long)(int)((data[0]<<8)|data[1]);
+    data += 2;
+  }
+  set_tap(i, bank, (int)value);
+}
+if(flags&3){
+  n = userfir_expand(n, nrx, bank, flags);  /* fill in the second half */
+}
+params[40][bank] = n;       /* save order of the filter that was just loaded */
+set_param(0, bank, (long)USERFIR_FUNC);     /* FUNC:UserFIR */
+return 0;
+}
+
+
+/**************************************************************************
+ * get_tap, set_tap
+ * Get and set UserFIR tap i (0 to 255) of bank. Two taps are packed in
+ * each params[NPARAMSTRUCT + i/2][bank]: even taps in the LS word, odd
+ * taps in the MS word.
+ *
+ **************************************************************************/
+int get_tap(int i, int bank)
+{
+long ltemp;
+
+ltemp = params[NPARAMSTRUCT + (i>>1)][bank];    /* get pair of coefs */
+if(i&1){
+  return (int)(ltemp>>16);              /* odd (1,3,...) coef */
+}
+return (int)(ltemp&0x0000ffff);         /* even (0,2,...) coef */
+}
+
+void set_tap(int i, int bank, int value)
+{
+long *lptr;
+
+lptr = &params[NPARAMSTRUCT + (i>>1)][bank];
+if(i&1){
+  *lptr = (*lptr&0x0000ffff)|((long)value<<16);         /* load odd coef. into MS word */
+}
+else{
+  *lptr = (*lptr&0xffff0000)|((long)value&0x0000ffff);  /* load even coef. into LS word */
+}
+}
+
+
+/**************************************************************************
+ * userfir_expand
+ * Fills in the second half of a symmetric (flags&1) or antisymmetric
+ * (flags&2) UserFIR of order n in bank, after the first nrx taps were
+ * received (missing first half taps are set to 0). Returns the order
+ * (limited to 256 for Ch A Only, else 128).
+ *
+ **************************************************************************/
+int userfir_expand(int n, int nrx, int bank, int flags)
+{
+int i, itemp;
+
+itemp = (params[6][0]==2) ? 256:128;    /* allow long filters on Ch A Only */
+if(n>itemp) n = itemp;
+if(n<3) n = 3;
+
+for(i=nrx;i<((n+1)>>1);i++){
+  set_tap(i, bank, 0);      /* first half taps not received */
+}
+for(i=0;i<(n>>1);i++){
+  itemp = get_tap(i, bank);
+  set_tap(n-1-i, bank, (flags&2) ? -itemp:itemp);
+}
+if((n&1)&&(flags&2)){
+  set_tap(n>>1, bank, 0);   /* center tap of antisymmetric filter is 0 */
+}
+return n;
+}
+
+
+/**************************************************************************
+ * set_param
+ * Sets params[ptr][bank] = value (limited to the parameter's min and max
+ * values) without updating the DSP. The channel is flagged in
+ * changed_banks and apply_changes() must be called after the last
+ * parameter is set, so each filter is computed once. Options that are
+ * cheap to update (or reset frequencies: SampleRate) are updated here.
+ * Returns 1 (and leaves params[][] unchanged) if the parameter can't be
+ * set this way: Levels, the press and read only options, and UFtap.
+ * A BP/BS center or width also sets f1 and f2 (as update_dsp() does),
+ * since apply_changes() computes the filter from f1 and f2.
+ *
+ **************************************************************************/
+int set_param(int ptr, int bank, long value)
+{
+float f1;
+
+if((ptr<0)||(ptr>=NPARAMSTRUCT)||(bank<0)||(bank>2)){
+  return 1;
+}
+if(morph_ticks){
+  morph_finish(0);      /* end the "morph" where it is */
+}
+if((ptr>=OPTIONS_START)&&(ptr<=OPTIONS_END)){   /* options are in bank 0 */
+  if(bank||(ptr==1)||(ptr>8)) return 1;
+}
+else if(ptr==41){
+  return 1;
+}
+
+param_limits(ptr, bank);   /* get min_value and max_value */
+if(value>max_value){    /* hard limit values */
+  value = max_value;
+}
+if(value<min_value){
+  value = min_value;
+}
+params[ptr][bank] = value;
+
+if((ptr<OPTIONS_START)||(ptr>OPTIONS_END)){ /* FUNC: or function parameter */
+  if((ptr==24)||(ptr==30)){     /* BPfcntr, BSfcntr: */
+    f1 = (float)value - (float)params[ptr+1][bank]/2.0;
+    params[ptr-2][bank] = (long)f1;                             /* f1 */
+    params[ptr-1][bank] = (long)(f1 + (float)params[ptr+1][bank]);  /* f2 */
+  }
+  else if((ptr==25)||(ptr==31)){    /* BPfwdth, BSfwdth: */
+    f1 = (float)params[ptr-1][bank] - (float)value/2.0;
+    if(f1<F1_MIN*fsample){      /* set f1 to minimum */
+      f1 = F1_MIN*fsample;
+    }
+    if(F2_MAX*fsample<f1 + (float)value){   /* set f2 to maximum */
+      f1 = F2_MAX*fsample - (float)value;
+    }
+    params[ptr-3][bank] = (long)f1;                     /* f1 */
+    params[ptr-2][bank] = (long)(f1 + (float)value);    /* f2 */
+  }
+  changed_banks |= 1<<bank;
+}
+else if(ptr==4){        /* SampleRate: */
+  set_fsample();        /* set CODEC sampling rate */
+  init_freq_params();   /* pull up factory default frequencies (may be set by later params) */
+  changed_banks |= 8;
+}
+else if(ptr==6){        /* Mode: */
+  changed_banks |= 8;
+}
+else{
+  params_changed_copy = 2;
+  update_dsp(ptr, 0);   /* update option now */
+}
+return 0;
+}
+
+
+/**************************************************************************
+ * param_limits
+ * Sets min_value and max_value of parameter ptr of bank (they may depend on
+ * other params[][] and on fsample). Not for Levels, the press and read only
+ * options, and UFtap.
+ *
+ **************************************************************************/
+void param_limits(int ptr, int bank)
+{
+unsigned utemp;
+
+utemp = param_struct[ptr].flag;     /* get the flag bits */
+if(utemp>>15){          /* display type: "text text" */
+  min_value = 0;
+  max_value = (long)(utemp&0xff) - 1;   /* number of label texts - 1 */
+}
+else{                   /* display type: "text int" or "text float" */
+  params_changed_copy = 1;
+  update_dsp(ptr, bank);    /* update min_value and max_value only */
+}
+}
+
+
+/**************************************************************************
+ * apply_changes
+ * Updates the DSP's functions after params[][] were changed by set_param().
+ * Each channel flagged in changed_banks that is used in the current Mode
+ * is initialized once (one filter computation per channel).
+ *
+ **************************************************************************/
+void apply_changes(void)
+{
+if(changed_banks==0){
+  return;
+}
+
+params_changed_copy = 2;
+if(changed_banks&8){            /* SampleRate or Mode changed: */
+  update_dsp(6, 0);             /* initialize the functions of all channels */
+}
+else if(params[6][0]==0){       /* Mode:A&B Common */
+  if(changed_banks&4) update_dsp(0, 2);
+}
+else{                           /* Mode:A&B Separate or Ch A Only */
+  if(changed_banks&1) update_dsp(0, 0);
+  if((changed_banks&2)&&(params[6][0]==1)) update_dsp(0, 1);
+}
+changed_banks = 0;
+
+/* Display top level function: */
+param_ptr = 0;      /* point function parameter */
+flag_options = 0;   /* don't point to options section */
+index_ab = params[6][0] ? 0:2;  /* if Mode:A&B Common (params[6][0]==0) then index common params, else index A params */
+params_changed_copy = 1;
+update_dsp(param_ptr, index_ab);    /* update min_value and max_value for the display */
+update_disp_left();     /* update display to reflect parameter settings */
+update_disp_right(1);
+}
+
+
+/**************************************************************************
+ * newer_value
+ * This function returns 1 if the DSP update in progress (from main()) is
+ * for an encoder value that has since been replaced by a newer one. The
+ * encoder interrupt only changes params[][] and sets params_changed, so
+ * compute_fir() can abandon its coefficients (before muting) and main()
+ * computes only the latest value.
+ *
+ **************************************************************************/
+int newer_value(void)
+{
+return(encoder_update && (params_changed==2) && (param_ptr==update_ptr) && (index_ab==update_ab));
+}
+
+
+/**************************************************************************
+ * txrxint_c (delta interrupt service routine)
+ * This is the c-code part of the interrupt service routine that handles
+ * the user input actions on both the RS-232 and switch inputs.
+ * 
+ * This interrupt is initially handled in assembly so that the
+ * sample interrupts can be quickly turned back on so no
+ * samples will be missed.
+ *
+ **************************************************************************/
+void txrxint_c(void)
+{
+int i, j, temp_pos, type, nstart, n_offset, nlength, nfrac, nlabel;
+int io;
+int sum2, io0_sum, io1_sum, io2_sum;
+unsigned count_start;
+long jj;
+char carray[8];
+
+/***** Get RS-232 Action: *************************************************/
+if(iosr_copy&0x4000){   /* an "a" Detect Complete interrupt occurred */
+  portfff5 &= ~ASPCR_CAD;   /* reset the "calibrate "a" detect" (CAD) bit in the ASPCR*/
+  portfff6 = 0x4000;    /* reset the ""a" detect complete" (ADC) bit in the IOSR */
+}
+
+/* if(portfff6&0x2600){ /* a break, framing error, or receive overrun detected */
+/*  disp_text("OVERRUN ERROR!  ", 1, -1);
+  wait(1000000);
+  disp_num(portfff6,0,16,0);
+  wait(1000000);
+}   /* for testing */
+
+if((iosr_copy&0x0800) && (portfff5&ASPCR_TIM)){ /* transmit register empty (THRE) while sending tx_buf[] */
+  if(tx_flow){
+    portfff4 = tx_flow;         /* send XON/XOFF first */
+    tx_flow = 0;
+  }
+  else if(tx_read_ptr!=tx_write_ptr){
+    portfff4 = tx_buf[tx_read_ptr++];   /* send next character (also resets THRE) */
+    tx_read_ptr &= TX_BUF_LEN-1;
+  }
+  else{
+    portfff5 &= ~ASPCR_TIM;     /* tx_buf[] empty: transmit int. off (main() calls xmit_end() when sent) */
+  }
+}
+
+if(iosr_copy&0x0100){   /* a serial Data Ready interrupt occurred */
+  assembly_flag &= ~3;  /* Turn off the VU Meter to help avoid loosing data
+                           If the sample int. is bussy (full order filters, VU-meter, wtnoise on)
+                           then serial data will be missed if a new character is received too soon.
+                           38.4Kbaud seems to be the maximum in this case.                     */
+
+  i = portfff4;         /* read the serial data ADTR (also resets the DR bit in the IOSR) */
+  io = !(portfff5&ASPCR_RIM);   /* receive ints. off while sending (TX_ECHO): our own echo, drop it */
+#if(RX_FLOW)
+  if(io){}
+  else if(tx_flow_echo && (((i&0xff)==XON)||((i&0xff)==XOFF))){
+    tx_flow_echo--;
+    io = 1;             /* echo of our own XON/XOFF, even inside a frame or program data (a host
+                           byte of the same value that comes first is dropped instead; same data) */
+  }
+  else if(rx_raw){}         /* "program:" data: store every byte */
+  else if(rx_bin_pos){       /* follow the binary frame (see parse()): address, opcode, length, payload, CRC */
+    if(rx_bin_pos==5) rx_bin_len = (i&0xff)<<8;
+    else if(rx_bin_pos==6) rx_bin_len |= i&0xff;
+    if((rx_bin_pos==6)&&(rx_bin_len>BIN_MAX_LEN)) rx_bin_pos = 0;  /* bad length, parse() drops it */
+    else if(rx_bin_pos==(rx_bin_len + 8)) rx_bin_pos = 0;         /* last CRC byte */
+    else rx_bin_pos++;
+  }
+  else if(((i&0xff)==XON)||((i&0xff)==XOFF)){
+    io = 1;             /* ignore flow control (our own, or another module's) */
+  }
+  else if((i&0xff)==BIN_SYNC){
+    rx_bin_pos = 1;
+    rx_bin_len = 0;
+  }
+#endif
+  j = (write_ptr + 1)&(SERIAL_BUF_LEN-1);
+  if(io){}
+  else if(j==read_ptr){ /* serial_in_buf[] full: drop the character */
+    rx_full++;
+    serial_error_flag = 1;  /* flag serial comm. error for main() */
+  }
+  else{
+    serial_in_buf[write_ptr] = i;
+    write_ptr = j;
+  }
+
+  auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
+
+  io = portfff6;
+  if(io&0x2600){        /* a break, framing error, or receive overrun detected */
+    if(io&0x0200) rx_overruns++;
+    if(io&0x2400) rx_framing++;
+    serial_error_flag = 1;  /* flag serial comm. error for main() */
+  }
+
+#if(RX_FLOW)
+  if(!rx_stopped && (((write_ptr - read_ptr)&(SERIAL_BUF_LEN-1))>=(SERIAL_BUF_LEN - RX_XOFF_ROOM))){
+    rx_stopped = 1;
+    xmit_flow(XOFF);    /* ask the host to pause */
+  }
+#endif
+
+  return;   /* get out as soon as possible (when full DSP utilization, we have been missing chars) */
+
+}
+
+
+#if(MAIN)
+/***** Get Switch Action: *************************************************/
+if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
+  /***** Set appropriate SW Action flags (sw_pressed, sw_released, cw, ccw): */
+  sum2=0, io0_sum=0, io1_sum=0, io2_sum=0;  /* init. some vars. */
+
+  io = iosr_copy;
+  count_start = portfffa;       /* grab current timer value (for debounce interval timing) */
+  while(delta_t(count_start)<SW_DEBOUNCE){  /* accumulate sw states over debounce interval (~1000uS) */
+  /* while(sum<100) */
+    io0_sum += 0x0001&io;       /* do runing sum of IO0 */
+    io1_sum += 0x0001&(io>>1);  /* do runing sum of IO1 */
+    io2_sum += 0x0001&(io>>2);  /* do runing sum of IO2 */
+    io = portfff6;              /* read iosr */
+    sum2++;
+  }
+  sum2 = sum2>>1;   /* divide sum by 2 */
+
+  /* Update Switch and Rotary-Encoder Action parameters: */
+  sw_down_old = sw_down;            /* keep sw_down history */
+  sw_down = io2_sum<sum2;           /* get inverse of IO2, switch input bit */
+  if(sw_down&&(!sw_down_old)){  /* determine if sw pressed or released based on states */
+    sw_pressed = 1;
+  }
+  if((!sw_down)&&sw_down_old){
+    sw_released = 1;
+  }
+
+#if(ENCODER_TYPE==0)    /* Panasonic */
+  if(0x0010&iosr_copy){             /* quick return if only input 0 changed */
+   return;
+  }
+
+  gray_code_old = gray_code; 
+  gray_code = ((io1_sum>sum2)<<1)|(io0_sum>sum2);   /* get code for Rotary Encoder (0,1,3,2) */
+  switch((gray_code_old<<2)|gray_code){
+  case 3:
+  case 12:
+  case 7:
+  case 8:
+    ccw = 1;
+    break;
+  case 6:
+  case 9:
+  case 2:
+  case 13:
+    cw = 1;
+    break;
+  }
+#else   /* Switch Channel */
+  gray_code_old = gray_code; 
+  gray_code = ((io1_sum>sum2)<<1)|(io0_sum>sum2);   /* get code for Rotary Encoder (0,1,3,2) */
+  switch((gray_code_old<<2)|gray_code){
   case 7:
   case 8:
     cw = 1;
@@ -1680,6 +2795,19 @@ if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
   }
 #endif
 
+  if(knob_held){    /* ignore the knob while a message or beep is pending (see hold_knob()) */
+    sw_pressed = 0;
+    cw = 0;
+    ccw = 0;
+  }
+
+  if(cw||ccw){      /* time the knob turns (delta_t() is good for 32ms only, knob_samples for longer) */
+    knob_dt = (knob_samples<knob_slow) ? delta_t(knob_time):32767;
+    knob_time = portfffa;
+    knob_samples = 0;
+    knob_idle = 0;
+  }
+
   /***** Done seting SW Action flags (sw_down, sw_pressed, sw_released, cw, ccw) *******/
 
 
@@ -1728,13 +2856,9 @@ if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
     }
     else if(cw||ccw){
       disp_text("Cancelled       ", 1, 0);  /* write LCD */
-      wait(750000);             /* wait .75 sec. */
-      update_disp_left();       /* display parameter state */
-      update_disp_right(1);
+      defer(restore_disp, 750000);  /* display parameter state after .75 sec. */
+      hold_knob(750000);
       press_flag = 0;
-      /* make shure that the first knob turn after this msg. increments the display: */
-      gray_code = 0x0003&portfff6;  /* put rotary encoder bits into gray_code so first sw action is taken */
-      portfff6 = 0x00f0;            /* clear pending delta interrupts */
     }
   }
   else if(sw_pressed||(sw_down&&cw)){
@@ -1788,10 +2912,7 @@ if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
       params_changed = 1;   /* set change flag to update only min_value and max_value vars. */
       if(i){    /* beep if a boudary was crossed in menu */
         beep(30, 550);
-        wait(200000);   /* wait for human to respond to beep */
-        /* make shure that the first knob turn after a beep increments the display: */
-        gray_code = 0x0003&portfff6;    /* put rotary encoder bits into gray_code so first sw action is taken */
-        portfff6 = 0x00f0;              /* clear pending delta interrupts */
+        hold_knob(200000);  /* wait for human to respond to beep */
       }
     }
     else{       /* currsor on right (somewhere), inc/dec parameter value: */
@@ -1800,6 +2921,7 @@ if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
         i = (int)params[param_ptr][index_ab];   /* get current parameter value for A, B, or Common */
         inc_dec_mod(&i, nlabel);        /* and increment mod nlabel */
         params[param_ptr][index_ab] = (long)i;
+        params_changed = 2;             /* set change flag to update all */
       }     /* end if (type==1) */
       else{ /* type==0 */
         if(nfrac==0){   /* display type: "text int" */
@@ -1813,10 +2935,19 @@ if(iosr_copy&0x00f0){   /* a delta (I/O pin state change) inturrupt occurred */
             i = nstart + nlength - cursor_pos - 2;
           }
         }
-        add_sub_pow(&params[param_ptr][index_ab], i);   /* add/sub 10^i to/from current parameter value */
+        if((knob_dt<KNOB_FAST)&&freq_param(param_ptr)){   /* fast spin: step the frequency in main() */
+          i = (knob_dt<6000) ? 4:((knob_dt<12000) ? 2:1);  /* 1/3, 1/6 or 1/12 octave */
+          knob_steps += cw ? i:-i;
+          spin_ptr = param_ptr;
+          spin_ab = index_ab;
+          knob_spin = 1;    /* the filter is computed when the knob settles */
+        }
+        else{
+          add_sub_pow(&params[param_ptr][index_ab], i);   /* add/sub 10^i to/from current parameter value */
+          params_changed = 2;           /* set change flag to update all */
+        }
       } /* end else type==0 */
       update_disp_right(cursor_pos);    /* write parameter value to LCD right */
-      params_changed = 2;               /* set change flag to update all */
     } /* end else cursor on right (somewhere) */
   } /* end else if((cw||ccw)&&(!down_turn_flag)) */
   
@@ -1848,6 +2979,8 @@ void reset_lcd(void)
 {
 int i, j;
 
+lcd_on = 0;     /* lcd_flush() waits for the reset */
+
 /* Perform SW reset of display (incase hardware reset failed): */
 write_lcd_nibble(0x3, 4100);    /* send 4 bit nibble to LCD instruction reg. */
 write_lcd_nibble(0x3, 100);     /* send 4 bit nibble to LCD instruction reg. */
@@ -1879,62 +3012,111 @@ for(i=7;i>=0;i--){
 write_lcd_inst(0x80, 40);   /* Set Display Data Address to beginning (home) */
 cursor_pos = 1;     /* Set global variable to current cursor position */
 
+for(i=0;i<16;i++){  /* the display is clear */
+  lcd_buf[i] = ' ';
+  lcd_shown[i] = ' ';
+}
+lcd_addr = 0;
+lcd_cursor = 0;
+lcd_time = portfffa;
+lcd_on = 1;
 }
 
 /**************************************************************************
  * disp_text
- *   This function writes a text string to the LCD.
+ *   This function writes a text string to the LCD copy lcd_buf[] (and
+ * sets the cursor state). lcd_flush() sends the changes to the LCD.
  *
  *   *text      -   Text string to write to LCD display
  *                  (if null string -> cursor put into position)
  *   position   -   1 to 16 - Position of first character
  *                  Final cursor position: one character to the right of the
  *                  end of the string.
- *                  (out-of-limits not checked)
+ *                  (characters after position 16 are dropped)
  *  cursor_on   -   Turns on/off curssor:
  *                  +1 - turns on cursor
  *                  -1 - turns off cursor
  *                   0 - cursor visibility not affected
  *
- * Possible speedup: Only update the part of the display that changed.
- *
  *************************************************************************/
 void disp_text(char *text, int position, int cursor_on)
 {
+int pos;
 unsigned port_temp;
 
-port_temp = portfff5;   /* save state of portfff5 */
-portfff5 &= ~0x0200;    /* Suspend delta interrupts while updating display
-                           This is because the delta int. also calls disp_text() and wait(). */
+port_temp = portfff5&0x0200;    /* save the delta interrupt mask bit */
+portfff5 &= ~0x0200;    /* Suspend delta interrupts while updating lcd_buf[]
+                           This is because the delta int. also calls disp_text(). */
 
 /* Turn on/off cursor: */
-if((cursor_on>0)&&(!cursor_flag)){
-  write_lcd_inst(0x0e, 40);     /* turn on cursor */
+if(cursor_on>0){
   cursor_flag = 1;              /* flag cursor on */
 }
-if((cursor_on<0)&&(cursor_flag)){
-  write_lcd_inst(0x0c, 40);     /* turn off cursor */
+if(cursor_on<0){
   cursor_flag = 0;              /* flag cursor off */
 }
 
-if(position!=cursor_pos){   /* Put cursor in "position" if not there */
-  if(position<9){
-    write_lcd_inst((0x80 - 1) + position, 40);
-    }
-  else{
-    write_lcd_inst((0xc0 - 9) + position, 40);
+pos = position;
+/* Write characters: */
+while((*text!='\0')&&(pos<=16)){ /* loop while not end of string (not null character) */
+  lcd_buf[pos-1] = *text++;
+  pos++;
+}
+cursor_pos = pos;
+
+portfff5 |= port_temp;  /* re-enable delta interrupts (if they were) */
+}
+
+
+/**************************************************************************
+ * lcd_flush
+ *   This function makes one write to the LCD if the LCD has had LCD_USEC
+ * since the last one: the next character of lcd_buf[] that differs from
+ * the LCD (positioning the LCD address first if needed), else the cursor
+ * on/off, else the cursor position. It is called from the main loop and
+ * from wait(), so the LCD follows lcd_buf[] without waiting on it.
+ *
+ *************************************************************************/
+void lcd_flush(void)
+{
+int i, j;
+
+if((!lcd_on)||lcd_flushing||(delta_t(lcd_time)<LCD_USEC)){
+  return;
+}
+lcd_flushing = 1;
+
+for(j=0;j<16;j++){  /* find the next changed character (from the LCD address on) */
+  i = (lcd_addr + j)&15;
+  if(lcd_buf[i]!=lcd_shown[i]){
+    break;
   }
-  cursor_pos = position;
 }
-/* Write characters: */
-while(*text!='\0'){ /* loop while not end of string (not null character) */
-  write_lcd_data(*text++, 40);
-  cursor_pos++;
-  if(cursor_pos==9){
-    write_lcd_inst(0xc0, 40);/* put the cursor in location 8 */
+if(j<16){
+  if(i!=lcd_addr){
+    write_lcd_inst((i<8) ? (0x80 + i):(0xc0 - 8 + i), 0);   /* move the LCD address */
+    lcd_addr = i;
+  }
+  else{
+    lcd_shown[i] = lcd_buf[i];
+    write_lcd_data(lcd_shown[i], 0);
+    lcd_addr = (i==7) ? 17:(i + 1); /* (position 9 is not next to position 8) */
   }
 }
-portfff5 = port_temp;   /* restore state of portfff5 (could unmask delta interrupts) */
+else if(cursor_flag!=lcd_cursor){
+  lcd_cursor = cursor_flag;
+  write_lcd_inst(lcd_cursor ? 0x0e:0x0c, 0);    /* turn on/off cursor */
+}
+else if(lcd_cursor&&(lcd_addr!=(cursor_pos - 1))){
+  lcd_addr = cursor_pos - 1;
+  write_lcd_inst((lcd_addr<8) ? (0x80 + lcd_addr):(0xc0 - 8 + lcd_addr), 0);    /* put the cursor in position */
+}
+else{
+  lcd_flushing = 0;
+  return;       /* the LCD is up to date */
+}
+lcd_time = portfffa;
+lcd_flushing = 0;
 }
 
 
@@ -2049,10 +3231,14 @@ return bufptr;
 void write_lcd_inst(int byte, int wait_usec)
 {
 int i, iend, nibh, nibl;
+unsigned port_temp;
 
 nibh = (byte&0xf0)>>4;  /* get high and low nibbles */
 nibl = byte&0x0f;
 
+port_temp = portfff5&0x0200;    /* save the delta interrupt mask bit */
+portfff5 &= ~0x0200;    /* the delta interrupt also changes port0_copy (speaker) */
+
 port0_copy = port0_copy&(~0x10);        /* Lower the RS pin */
 port0 = port0_copy;
 
@@ -2069,6 +3255,7 @@ port0 = port0_copy;
 
 port0_copy = (0xd0&port0_copy)|nibl;    /* Lower E pin on LCD and hold high */
 port0 = port0_copy;
+portfff5 |= port_temp;  /* re-enable delta interrupts (if they were) */
 
 wait((long)wait_usec);                      /* wait here for LCD not bussy */
 }
@@ -2087,10 +3274,14 @@ wait((long)wait_usec);                      /* wait here for LCD not bussy */
 void write_lcd_data(int byte, int wait_usec)
 {
 int i, iend, nibh, nibl;
+unsigned port_temp;
 
 nibh = (byte&0xf0)>>4;  /* get high and low nibbles */
 nibl = byte&0x0f;
 
+port_temp = portfff5&0x0200;    /* save the delta interrupt mask bit */
+portfff5 &= ~0x0200;    /* the delta interrupt also changes port0_copy (speaker) */
+
 port0_copy = port0_copy|0x10;       /* Raise the RS pin */
 port0 = port0_copy;
 
@@ -2107,6 +3298,7 @@ port0 = port0_copy;
 
 port0_copy = (0xd0&port0_copy)|nibl;    /* Lower E pin on LCD and hold high */
 port0 = port0_copy;
+portfff5 |= port_temp;  /* re-enable delta interrupts (if they were) */
 
 wait((long)wait_usec);                      /* wait here for LCD not bussy */
 }
@@ -2125,6 +3317,10 @@ wait((long)wait_usec);                      /* wait here for LCD not bussy */
 void write_lcd_nibble(int nibble, int wait_usec)
 {
 int i, iend;
+unsigned port_temp;
+
+port_temp = portfff5&0x0200;    /* save the delta interrupt mask bit */
+portfff5 &= ~0x0200;    /* the delta interrupt also changes port0_copy (speaker) */
 
 port0_copy = port0_copy&(~0x10);        /* Lower the RS pin */
 port0 = port0_copy;
@@ -2133,6 +3329,7 @@ port0_copy = (0xd0&port0_copy)|0x20|nibble; /* Raise E pin on LCD and write */
 port0 = port0_copy;
 port0_copy = (0xd0&port0_copy)|nibble;  /* Lower E pin on LCD and hold */
 port0 = port0_copy;
+portfff5 |= port_temp;  /* re-enable delta interrupts (if they were) */
 
 wait((long)wait_usec);                      /* wait here for LCD not bussy */
 }
@@ -2178,14 +3375,20 @@ wait_course = (int) (wait_usec>>14);        /* get course wait (multiples of 163
 wait_fine = (int) (wait_usec&0x00003fff);   /* get fine wait time */
 
 count_start = portfffa;     /* grab current timer value (for interval timing) */
-while(delta_t(count_start)<wait_fine);
+while(delta_t(count_start)<wait_fine){
+  lcd_flush();              /* keep the LCD up to date */
+  beep_update();
+}
 
 if(wait_course==0) return;
 
 /* Wait for an additional (wait_course*16384us): */
 for(i=0;i<wait_course;i++){
   count_start = portfffa;       /* grab current timer value (for interval timing) */
-  while(delta_t(count_start)<16384);
+  while(delta_t(count_start)<16384){
+    lcd_flush();
+    beep_update();
+  }
 }
   
 
@@ -2205,8 +3408,6 @@ wait(n*1000000/((long)fsample));    /* wait for ~four sampling intervals for COD
 
 /**************************************************************************
  * prog_flash
- * IMPORTANT: set func_addr_a and _b to no_func_a and _b before calling
- * (because of added wait states below)!
  * This function programs the Am29F010 FLASH memory. 32K Bytes of FLASH memory
  * is mapped to the global address space of the DSP starting at address 0x8000.
  * One of four possible blocks of FLASH are mapped to the DSP depending on the
@@ -2228,7 +3429,8 @@ wait(n*1000000/((long)fsample));    /* wait for ~four sampling intervals for COD
  * 0xa000 to 0xbfff             -   CODE (Backup) sector 5 (8K words)
  *
  * 0xc000 to 0xdfff     0   1   -   CODE (Backup) sector 7 (8K words)
- * 0xe000 to 0xffff             -   SPARE       sector 8 (8K words)
+ *                                  (sectors 4, 5 and 7 receive firmware updates, see fw_begin())
+ * 0xe000 to 0xffff             -   DATA        sector 8 (8K words) (with sector 3, see store())
  *
  *  start   -   Starting word location of FLASH storage to program (0 to 0xffff)
  *  length  -   Length in words to program (1 to 0x2000)
@@ -2297,12 +3499,13 @@ if(((start<0x2000)&&((start+length)>0x2000))||((start>=0x2000)&&((start+length)>
 }
 
 *greg_ptr = 0x0080; /* map flash memory to global data space: 0x8000 to 0xffff */ 
-portfffc = (IO_WAITS*0x0200 + FLASH_WAITS*0x0040 + 0*0x0008 + 0);   /* Increase # wait states in data mem. */
-/* Warning increasing wait states can keep the ISR from completing */
+/* Each FLASH access is made between FLASH_ON and FLASH_OFF (see read_flash()) */
 
+FLASH_ON;
 *((unsigned int *)(0x8000+0x5555)) = 0x00aa;    /* put FLASH into normal read state */
 *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
 *((unsigned int *)(0x8000+0x5555)) = 0x00f0;
+FLASH_OFF;
 
 if(out_atten&0x0008){   /* If CLIPA should be set: */
   /* Verify that CLIPA signal was actualy set by making sure that the FLASH serial number */
@@ -2311,7 +3514,9 @@ if(out_atten&0x0008){   /* If CLIPA should be set: */
   /* Read serial number section from FLASH: */
   j = 0;
   for(i=(2*SERIAL_LOC)+4;i<(2*SERIAL_LOC)+4+10;i++){
+    FLASH_ON;
     carray[j++] = (*((unsigned int *)(0x8000+i)))&0x00ff;   /* get bytes from FLASH */
+    FLASH_OFF;
   }
   if(valid_serial(carray)){ /* error if valid serial number found here */
     error_code = 6;
@@ -2328,34 +3533,45 @@ if(erase_flag){ /* Erase FLASH sector(s): */
   }
   
   /* Erase sector 0 or 1 (depending on sector_start): */
+  FLASH_ON;
   *((unsigned int *)(0x8000+0x5555)) = 0x00aa;  /* write unlock code to FLASH */
   *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
   *((unsigned int *)(0x8000+0x5555)) = 0x0080;
   *((unsigned int *)(0x8000+0x5555)) = 0x00aa;
   *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
   *((unsigned int *)(0x8000+sector_start)) = 0x0030;    /* write command to erase sector 0 */
+  FLASH_OFF;
   wait(100);    /* wait 100 uS */
   do{
+    FLASH_ON;
     status1 = *((unsigned int *)(0x8000+sector_start)); /* read two consecutive status bytes */
     status2 = *((unsigned int *)(0x8000+sector_start));
+    FLASH_OFF;
     if(((status1&0x0040)==(status2&0x0040))||(status1&0x0080)){ /* no change in DQ6: done toggling */
       goto pf_1;                                                /* or DQ7==1 */
     }
   }
   while(!(status1&0x00020));    /* loop unless timeout (DQ5==1) */
+  FLASH_ON;
   status1 = *((unsigned int *)(0x8000+sector_start));   /* read two consecutive status bytes */
+  FLASH_OFF;
   if(status1&0x0080){   /* DQ7==1 */
     goto pf_1;
   }
   error_code = 2;   /* erase timeout error */
   goto prog_error;
  pf_1:
+  FLASH_ON;
   *((unsigned int *)(0x8000+0x5555)) = 0x00aa;  /* put FLASH into normal read state */
   *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
   *((unsigned int *)(0x8000+0x5555)) = 0x00f0;
+  FLASH_OFF;
   /* Varify FLASH erased: */
   for(i=sector_start;i<(0x4000+sector_start);i++){
-    if(((*((unsigned int *)(0x8000+i)))&0x00ff)!=0x00ff){
+    FLASH_ON;
+    byte = (*((unsigned int *)(0x8000+i)))&0x00ff;
+    FLASH_OFF;
+    if(byte!=0x00ff){
       error_code = 3;   /* not erased error */
       goto prog_error;
     }
@@ -2374,28 +3590,36 @@ for(i=start;i<length;i++){
     word = datawords[j++];      /* get current word */
     byte = word>>8;             /* get MS byte */
   }
+  FLASH_ON;
   *((unsigned int *)(0x8000+0x5555)) = 0x00aa;  /* put FLASH into normal read state */
   *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
   *((unsigned int *)(0x8000+0x5555)) = 0x00f0;
   xbyte = (*((unsigned int *)(0x8000+i))^byte)&0x00ff;  /* current FLASH byte XOR with desired data */
+  if(xbyte&&!(xbyte&byte)){     /* data is different and can be programmed: */
+    *((unsigned int *)(0x8000+0x5555)) = 0x00aa;    /* write unlock code to FLASH */
+    *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
+    *((unsigned int *)(0x8000+0x5555)) = 0x00a0;
+    *((unsigned int *)(0x8000+i)) = byte;   /* program FLASH byte */
+  }
+  FLASH_OFF;
   if(xbyte){        /* data is different: must reprogram byte */
     if(xbyte&byte){ /* error: can't program 0 bit to 1 bit */
       error_code = 4;   /* programming 0 to 1 error */
       goto prog_error;
     }
-    *((unsigned int *)(0x8000+0x5555)) = 0x00aa;    /* write unlock code to FLASH */
-    *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
-    *((unsigned int *)(0x8000+0x5555)) = 0x00a0;
-    *((unsigned int *)(0x8000+i)) = byte;   /* program FLASH byte */
     do{ /* !data polling */
+      FLASH_ON;
       status1 = *((unsigned int *)(0x8000+i));
       status2 = *((unsigned int *)(0x8000+i));
+      FLASH_OFF;
       if(((status1&0x0040)==(status2&0x0040))||((status1&0x0080)==(byte&0x0080))){  /* no change in DQ6 */
         goto pf_3;                                                                  /* or DQ7==DATA7 */
       }
     }
     while(!(status1&0x00020));  /* loop unless timeout (DQ5==1) */
+    FLASH_ON;
     status1 = *((unsigned int *)(0x8000+i));
+    FLASH_OFF;
     if((status1&0x0080)==(byte&0x0080)){        /* done */
       goto pf_3;
     }
@@ -2407,8 +3631,6 @@ for(i=start;i<length;i++){
 }
 
 prog_out:
-portfffc = (IO_WAITS*0x0200 + 0*0x0040 + 0*0x0008 + 0); /* back to 0 wait states in data mem. */
-
 portfff5 &= ~0x0004;    /* make IO2 an input */
 wait(400);              /* wait for I02 to go high (4 RC's = 4*10K*0.01uF) */
 portfff6 = 0x00f0;      /* clear pending delta interrupts */
@@ -2425,9 +3647,11 @@ else{
 
 
 prog_error:
+FLASH_ON;
 *((unsigned int *)(0x8000+0x5555)) = 0x00aa;    /* put FLASH into normal read state */
 *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
 *((unsigned int *)(0x8000+0x5555)) = 0x00f0;
+FLASH_OFF;
 
 /*portfff5 &= ~0x0200;  /* suspend delta interrupts while updating display */
 disp_text("ProgERR", 1, -1);
@@ -2443,8 +3667,6 @@ goto prog_out;
 
 /**************************************************************************
  * read_flash
- * IMPORTANT: set func_addr_a and _b to no_func_a and _b before calling
- * (because of added wait states below)!
  * This function reads the Am29F010 FLASH memory. 32K Bytes of FLASH memory
  * is mapped to the global address space of the DSP starting at address 0x8000.
  * This function retrieves 16 bit words from two consecutive FLASH locations
@@ -2488,23 +3710,26 @@ wait_n_samples(20);     /* wait for ~20 sampling intervals for CLIP signals to p
                         /* wait for I02 state to settle (4 RC's = 4*10K*0.01uF) */
                         
 *greg_ptr = 0x0080; /* map flash memory to global data space: 0x8000 to 0xffff */ 
-portfffc = (IO_WAITS*0x0200 + FLASH_WAITS*0x0040 + 0*0x0008 + 0);   /* Increase # wait states in data mem. */
-/* Warning increasing wait states can keep the ISR from completing */
+/* The FLASH wait states would keep the ISR from completing, so they are only set */
+/* for each FLASH access, with the interrupts off (FLASH_ON to FLASH_OFF, under 1us). */
+/* The filter functions keep running between accesses. */
 
+FLASH_ON;
 *((unsigned int *)(0x8000+0x5555)) = 0x00aa;    /* put FLASH into normal read state (if should already be there) */
 *((unsigned int *)(0x8000+0x2aaa)) = 0x0055;
 *((unsigned int *)(0x8000+0x5555)) = 0x00f0;
+FLASH_OFF;
 
 /* Read FLASH: */
 j = 0;
 start = (start<<1);             /* set start to point to the starting byte in FLASH */
 length = start + (length<<1);   /* set length to last FLASH address + 1 */
 for(i=start;i<length;i+=2){
+  FLASH_ON;
   datawords[j++] = ((*((unsigned int *)(0x8000+i)))<<8) | ((*((unsigned int *)(0x8001+i))&0x00ff)); /* build word */
+  FLASH_OFF;
 }
 
-portfffc = (IO_WAITS*0x0200 + 0*0x0040 + 0*0x0008 + 0); /* back to 0 wait states in data mem. */
-
 portfff5 &= ~0x0004;    /* make IO2 an input */
 wait(400);              /* wait for I02 to go high (4 RC's = 4*10K*0.01uF) */
 portfff6 = 0x00f0;      /* clear pending delta interrupts */
@@ -2575,7 +3800,7 @@ void update_disp_left(void)
 
 #define BUFL 17
 
-int i, pos, pos2;
+int pos, pos2;
 char ctemp, ctemp1[BUFL], ctemp2[BUFL];
 char *c1ptr, *c2ptr;
 
@@ -2656,22 +3881,154 @@ disp_text("", pos , +1);    /* put cursor back into position and turn on */
 
 /**************************************************************************
  * beep
- * Beep the speaker.
+ * Beep the speaker: duration cycles of 2*period us. Returns at once,
+ * beep_update() toggles the speaker.
  *
  **************************************************************************/
 void beep(unsigned duration, unsigned period)
 {
+unsigned port_temp;
+
+port_temp = portfff5&0x0200;    /* save the delta interrupt mask bit */
+portfff5 &= ~0x0200;    /* the delta interrupt also beeps and clicks */
+beep_count = 0;
+beep_period = period;
+port0_copy |= 0x0040;
+port0 = port0_copy;
+beep_time = portfffa;
+beep_count = duration ? (2*duration - 1):0;
+portfff5 |= port_temp;  /* re-enable delta interrupts (if they were) */
+
+}
+
+
+/**************************************************************************
+ * beep_update
+ * Toggles the speaker when a half period of a beep() is over. Called from
+ * the main loop and from wait().
+ *
+ **************************************************************************/
+void beep_update(void)
+{
+unsigned port_temp;
+
+if(beep_count&&(delta_t(beep_time)>=beep_period)){
+  port_temp = portfff5&0x0200;  /* save the delta interrupt mask bit */
+  portfff5 &= ~0x0200;  /* the delta interrupt also changes port0_copy and beep_count (beep()) */
+  if(beep_count){
+    beep_time = portfffa;
+    port0_copy ^= 0x0040;
+    port0 = port0_copy;
+    beep_count--;
+  }
+  portfff5 |= port_temp;    /* re-enable delta interrupts (if they were) */
+}
+
+}
+
+
+/**************************************************************************
+ * defer
+ * Runs func from the main loop (run_tasks()) after usec us, instead of
+ * waiting for it. If func is already waiting, its time starts over. If
+ * all NTASKS are waiting, func runs now.
+ *
+ **************************************************************************/
+void defer(void (*func)(void), long usec)
+{
+int j;
+unsigned port_temp;
+
+port_temp = portfff5;   /* save state of portfff5 */
+portfff5 &= ~0x0200;    /* the delta interrupt also calls defer() */
+for(j=0;j<NTASKS;j++){
+  if(task_func[j]==func) break;
+}
+if(j==NTASKS){
+  for(j=0;j<NTASKS;j++){
+    if(task_func[j]==0) break;
+  }
+}
+if(j<NTASKS){
+  task_func[j] = func;
+  task_ticks[j] = (int)(usec/5000) + 1;
+}
+portfff5 = port_temp;   /* restore state of portfff5 (could unmask delta interrupts) */
+
+if(j==NTASKS){
+  (*func)();
+}
+}
+
+
+/**************************************************************************
+ * run_tasks
+ * Called every 5ms from the main loop. Runs the deferred tasks that are
+ * due (see defer()).
+ *
+ **************************************************************************/
+void run_tasks(void)
+{
 int i;
+unsigned port_temp;
+void (*func)(void);
+
+for(i=0;i<NTASKS;i++){
+  port_temp = portfff5;   /* save state of portfff5 */
+  portfff5 &= ~0x0200;    /* suspend delta interupts while testing the task */
+  func = 0;
+  if(task_func[i]&&((--task_ticks[i])<=0)){
+    func = task_func[i];
+    task_func[i] = 0;
+  }
+  portfff5 = port_temp;   /* restore state of portfff5 */
+  if(func){
+    (*func)();
+  }
+}
+}
 
-for(i=0;i<duration;i++){
-  port0_copy |= 0x0040;
-  port0 = port0_copy;
-  wait(period);
-  port0_copy &= ~0x0040;
-  port0 = port0_copy;
-  wait(period);
+
+/**************************************************************************
+ * restore_disp
+ * Deferred task: displays the parameter state again after a message.
+ *
+ **************************************************************************/
+void restore_disp(void)
+{
+update_disp_left();     /* display parameter state */
+update_disp_right(1);
+}
+
+
+/**************************************************************************
+ * hold_knob, release_knob
+ * The delta interrupt ignores knob turns and presses for usec us (while a
+ * message is read or after a beep). It keeps following the rotary encoder
+ * bits, so the first turn after that is taken.
+ *
+ **************************************************************************/
+void hold_knob(long usec)
+{
+knob_held = 1;
+defer(release_knob, usec);
+}
+
+void release_knob(void)
+{
+knob_held = 0;
 }
 
+
+/**************************************************************************
+ * write_aborted
+ * Deferred task: second part of the program error message.
+ *
+ **************************************************************************/
+void write_aborted(void)
+{
+disp_text("WRITE ABORTED!  ", 1, -1);
+defer(restore_disp, 2000000);   /* for 2 sec. */
 }
 
 
@@ -2683,6 +4040,20 @@ for(i=0;i<duration;i++){
 
 
 
+/**************************************************************************
+ * store_all_task
+ * Deferred task of "Erase Mem": stores the initial settings to all flash
+ * memory locations.
+ *
+ **************************************************************************/
+void store_all_task(void)
+{
+store_all();    /* store current settings to all flash memory locations */
+update_disp_left();     /* display parameter state */
+update_disp_right(1);
+}
+
+
 /**************************************************************************
  * store_all
  * This subroutine stores the current setting to all flash memory locations.
@@ -2691,1586 +4062,3187 @@ for(i=0;i<duration;i++){
 void store_all(void)
 {
 
-int itemp;
-
-record[0] = 0xffff;
-flash_locked = 0;   /* unlock flash */
-itemp = prog_flash(0x6000, 1, record, 1, "in Erase");   /* erase FLASH */
-if(itemp==0){   /* if no error */
-  for(itemp=LAST_MEM_LOC;itemp>=0;itemp--){
-    params[10][0] = itemp;  /* load store location value */
-    params_changed_copy = 3;
-    store();                /* store current settings */
-  }  
-}
+compact_records(0, 1);  /* write all locations as the current settings */
 }
 
 /**************************************************************************
  * xmit
- * This subroutine transimits the text string out of the RS-232 port
- * and follows with a charage return.
+ * This subroutine puts the text string, followed by a charage return,
+ * in the transmit ring buffer and returns (see xmit_byte()).
  *
  **************************************************************************/
 void xmit(char *text)
 {
 
-portfff5 &= ~0x0080;    /* suspend async. receive ints. so this module
-                           will not hear itself talking. This avoids serial
-                           receive buffer overflows. */
-
 while(*text!='\0'){
-  while(!(portfff6&0x1000));/* hold here until ADTR and AXSR are empty */
-  portfff4 = *text++;       /* send character out the RS-232 port */
+  xmit_byte(*text++);
 }
-portfff4 = '\r';    /* send CR last */
-while(!(portfff6&0x1000));/* hold here until ADTR and AXSR are empty (CR sent) */
-
-portfff6 = 0x6700;      /* reset any async. serial port interrupt indicator bits */
-portfff5 |= 0x0080;     /* re-enable receive ints. */
+xmit_byte('\r');   /* send CR last */
 
 }
 
 
 /**************************************************************************
- * param_struct_search()
- * This function searches param_struct[i].text for a parameter_str[] 
- * match as follows:
- *
- * match_type = 0   -   no match found
- *              1   -   0-offset match
- *              2   -   0-offset match except with space in first .text
- *                          " APgain"=="bAPgain"
- *              3   -   1-offset match with space in first .text
- *                          " APgain"=="APgain"
+ * xmit_byte
+ * Puts one byte in tx_buf[] and starts the transmit interrupt. The first
+ * byte suspends async. receive ints. so this module will not hear itself
+ * talking (TX_ECHO), until xmit_end().
+ *   If tx_buf[] is full this waits for the transmit int. to make room, so
+ * a reply longer than TX_BUF_LEN (bin_dump(), the "hash" frame) holds the
+ * main loop until all but the last TX_BUF_LEN bytes are sent (about 1 sec.
+ * per KB at 9600 baud). Only commands send such replies; telem_update()
+ * waits for room instead.
  *
  **************************************************************************/
-int param_struct_search(int *match_type)
+void xmit_byte(unsigned byte)
 {
-int i;
-char *cptr;
+int next;
 
-for(i=0;i<NPARAMSTRUCT;i++){            /* Search param_struct[i].text: */
+next = (tx_write_ptr + 1)&(TX_BUF_LEN-1);
+while(next==tx_read_ptr);   /* hold here while tx_buf[] is full (txrxint_c() is sending) */
 
-  cptr = param_struct[i].text;  /* get pointer value to beginning of ith parameter text */
+*imr_ptr &= ~EN_TXRXINT;    /* no serial int. between the THRE test and the enqueue */
+if(!tx_busy){
+  tx_busy = 1;
+#if(TX_ECHO)
+  portfff5 &= ~0x0080;      /* suspend async. receive ints. */
+#endif
+}
 
-  if(string_compare(cptr, &parameter_str[0])){  /* if 0-offset match */
-    *match_type = 1;
-    return(i);
-  }
-  else if(*cptr++==' '){        /* first character is a space */
-    if(string_compare(cptr, &parameter_str[0])){    /* if 1-offset match */
-      *match_type = 3;
-      return(i);
-    }
-    if(string_compare(cptr, &parameter_str[1])){    /* if 0-offset match (skipping first character) */
-      *match_type = 2;
-      return(i);
-    }
-  }
+if(!(portfff5&ASPCR_TIM) && (portfff6&0x0800)){    /* tx_buf[] empty and ADTR empty (THRE): */
+  portfff4 = byte;          /* send byte out the RS-232 port now */
+}
+else{
+  tx_buf[tx_write_ptr] = byte;
+  tx_write_ptr = next;
 }
 
-*match_type = 0;    /* no match found */
-return(0);
+portfff5 |= ASPCR_TIM;      /* (re)start the transmit int. */
+*imr_ptr |= EN_TXRXINT;     /* unmask the serial int. again */
 }
 
+
 /**************************************************************************
- * string_compare()
- * This function first converts both string to lower case and then compares
- * the strings up to end of the shortest string. Returns 1 if equal and
- * 0 if not equal. A null string matches anything.
+ * xmit_flush
+ * Waits until everything in tx_buf[] has been sent.
+ *
  **************************************************************************/
-int string_compare(char *s1, char *s2)
+void xmit_flush(void)
 {
-char ctemp1, ctemp2;
-  
-for(;;){
-  ctemp1 = tolower(*s1++);
-  ctemp2 = tolower(*s2++);
-  if((!ctemp1)||(!ctemp2)) return(1);
-  if(ctemp1 != ctemp2) return(0);
+while(tx_busy && !((tx_read_ptr==tx_write_ptr) && (portfff6&0x1000)));
+if(tx_busy){
+  xmit_end();
 }
 }
 
 
 /**************************************************************************
- * inc_dec_param_ptr
- * Increment/Decrement param_ptr and set index_ab based on cw
- *
- * If Mode:A&B Common then the sequence is:
- *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
- *
- *  Common  2           0               0   (FUNC)              beep
- *                                      param_ptr_start[func_c]
- *                                      . . .
- *                                      param_ptr_end[func_c]   
- *  Options 0           1               OPTIONS_START           beep
- *                                      . . .
- *                                      OPTIONS_END
- *
- * If Mode:A&B Separate then the sequence is:
- *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
- *
- *  A       0           0               0   (FUNC)              beep
- *                                      param_ptr_start[func_a]
- *                                      . . .
- *                                      param_ptr_end[func_a]   
- *  B       1           0               0   (FUNC)              beep
- *                                      param_ptr_start[func_b]
- *                                      . . .
- *                                      param_ptr_end[func_b]
- *  Options 0           1               OPTIONS_START           beep
- *                                      . . .
- *                                      OPTIONS_END
+ * xmit_frame
+ * Transmits a binary frame from this module (see parse_command() state 60):
+ * BIN_SYNC, serial number (3 bytes), opcode, n (2 bytes), payload[0..n-1]
+ * (one byte per word), CRC16 (2 bytes).
  *
- * If Mode: Ch A Only then the sequence is:
- *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
+ **************************************************************************/
+void xmit_frame(int opcode, unsigned *payload, int n)
+{
+unsigned hdr[6], crc;
+int i;
+
+hdr[0] = (unsigned)(serial_number>>16)&0xff;
+hdr[1] = (unsigned)(serial_number>>8)&0xff;
+hdr[2] = (unsigned)serial_number&0xff;
+hdr[3] = opcode;
+hdr[4] = (unsigned)n>>8;
+hdr[5] = (unsigned)n&0xff;
+
+xmit_byte(BIN_SYNC);
+crc = 0xffff;
+for(i=0;i<6;i++){
+  crc = crc16(crc, hdr[i]);
+  xmit_byte(hdr[i]);
+}
+for(i=0;i<n;i++){
+  crc = crc16(crc, payload[i]&0xff);
+  xmit_byte(payload[i]&0xff);
+}
+xmit_byte(crc>>8);
+xmit_byte(crc&0xff);
+}
+
+
+/**************************************************************************
+ * crc16
+ * Returns the CRC16 (CCITT: x^16 + x^12 + x^5 + 1, MS bit first) of crc
+ * updated with one byte. Start with crc = 0xffff. Computed 4 bits at a
+ * time from crc16_table[].
  *
- *  A       0           0               0   (FUNC)              beep
- *                                      param_ptr_start[func_a]
- *                                      . . .
- *                                      param_ptr_end[func_a]   
- *  Options 0           1               OPTIONS_START           beep
- *                                      . . .
- *                                      OPTIONS_END
+ **************************************************************************/
+unsigned crc16(unsigned crc, unsigned byte)
+{
+crc = (crc<<4)^crc16_table[(crc>>12)^(byte>>4)];
+crc = (crc<<4)^crc16_table[(crc>>12)^(byte&0x0f)];
+return crc;
+}
+
+
+/**************************************************************************
+ * crc32
+ * Returns the CRC32 (IEEE 802.3, LS bit first, as used by zip) of crc
+ * updated with one byte. Start with crc = 0xffffffff and invert the
+ * result. Computed 4 bits at a time from crc32_table[].
  *
- * Returns: 0 - if no boundary crossed
- *          1 - if boundary crossed: A <=> B <=> Options, or Common <=> Options ...
  **************************************************************************/
-int inc_dec_param_ptr(void)
+unsigned long crc32(unsigned long crc, unsigned byte)
 {
-int func_a, func_b, func_c;
+crc = (crc>>4)^crc32_table[(int)(crc^byte)&0x0f];
+crc = (crc>>4)^crc32_table[(int)(crc^(byte>>4))&0x0f];
+return crc;
+}
 
-func_a = (int)params[0][0]; /* get A function index */
-func_b = (int)params[0][1]; /* get B function index */
-func_c = (int)params[0][2]; /* get Common function index */
 
-switch((params[6][0]<<2)+(cw<<1)+flag_options){ /* compute a code for the switch */
-case 0:     /* A&BCommon, ccw, flag_options=0 */
-  if(param_ptr==0){
-    param_ptr = OPTIONS_END;
-    index_ab = 0;
-    flag_options = 1;
-  }
-  else if(param_ptr==param_ptr_start[func_c]){
-    param_ptr = 0;
-    return 1;
-  }
-  else{
-    param_ptr--;
+/**************************************************************************
+ * fw_crc
+ * Returns crc (see crc32()) updated with n firmware image words (MS byte
+ * first) that start at image word offset. The serial number words
+ * (SERIAL_LOC+2 to SERIAL_LOC+6 of sector 0) count as zero, because each
+ * module programs its own serial number there (see fw_block()).
+ *
+ **************************************************************************/
+unsigned long fw_crc(unsigned long crc, unsigned offset, unsigned *data, unsigned n)
+{
+unsigned i, word;
+
+for(i=0;i<n;i++){
+  word = data[i];
+  if(((offset+i)>=SERIAL_LOC+2)&&((offset+i)<SERIAL_LOC+7)){
+    word = 0;           /* serial number */
   }
-  break;
+  crc = crc32(crc, word>>8);
+  crc = crc32(crc, word&0xff);
+}
+return crc;
+}
 
-case 1:     /* A&BCommon, ccw, flag_options=1 */
-  if(param_ptr==OPTIONS_START){
-    param_ptr = param_ptr_end[func_c];
-    index_ab = 2;
-    flag_options = 0;
-  }
-  else{
-    param_ptr--;
-    if(param_ptr==OPTIONS_START){
-      return 1;
-    }
-  }
-  break;
-
-case 2:     /* A&BCommon, cw, flag_options=0 */
-  if(param_ptr==0){
-    param_ptr = param_ptr_start[func_c];
-  }
-  else if(param_ptr==param_ptr_end[func_c]){
-    param_ptr = OPTIONS_START;
-    index_ab = 0;
-    flag_options = 1;
-    return 1;
-  }
-  else{
-    param_ptr++;
-  }
-  break;
 
-case 3:     /* A&BCommon, cw, flag_options=1 */
-  if(param_ptr==OPTIONS_END){
-    param_ptr = 0;
-    index_ab = 2;
-    flag_options = 0;
-    return 1;
-  }
-  else{
-    param_ptr++;
-  }
-  break;
+/**************************************************************************
+ * fw_begin
+ * Starts a firmware update from a BIN_FW_BEGIN frame payload (data, nbytes;
+ * see bin_execute()). The image holds the main code sectors 0, 1 and 2 as
+ * programmed by the "program:" command (image word w is FLASH word w). It
+ * is received into the backup code sectors (FW_SLOT + w), so the running
+ * firmware and the main sectors are not touched until the whole image has
+ * been verified (see fw_commit()).
+ * Erases sectors 7, 5 and 4, in that order: the signature of an older
+ * image (in sector 7) is gone before any new image word is written.
+ * Returns the bin_execute() status.
+ *
+ **************************************************************************/
+int fw_begin(unsigned *data, int nbytes)
+{
+unsigned blank;
+int i, err;
 
-case 4:     /* A&BSeparate, ccw, flag_options=0 */
-  if(index_ab){
-    if(param_ptr==0){
-      param_ptr = param_ptr_end[func_a];
-      index_ab = 0;
-    }
-    else if(param_ptr==param_ptr_start[func_b]){
-      param_ptr = 0;
-      return 1;
-    }
-    else{
-      param_ptr--;
-    }
-  }
-  else{ /* index_ab==0 */
-    if(param_ptr==0){
-      param_ptr = OPTIONS_END;
-      index_ab = 0;
-      flag_options = 1;
-    }
-    else if(param_ptr==param_ptr_start[func_a]){
-      param_ptr = 0;
-      return 1;
-    }
-    else{
-      param_ptr--;
-    }
-  }
-  break;
+fw_state = 0;
+if(nbytes!=6){
+  return 2;
+}
+fw_len = (data[0]<<8)|data[1];
+fw_image_crc = ((unsigned long)data[2]<<24)|((unsigned long)data[3]<<16)|((unsigned long)data[4]<<8)|(unsigned long)data[5];
+if((fw_len==0)||(fw_len>FW_SIG)){
+  return 3;
+}
 
-case 5:     /* A&BSeparate, ccw, flag_options=1 */
-  if(param_ptr==OPTIONS_START){
-    param_ptr = param_ptr_end[func_b];
-    index_ab = 1;
-    flag_options = 0;
-  }
-  else{
-    param_ptr--;
-    if(param_ptr==OPTIONS_START){
-      return 1;
-    }
-  }
-  break;
+disp_text("Update: Erasing ", 1, -1);
+blank = 0xffff;
+err = 0;
+for(i=2;i>=0;i--){
+  flash_locked = 0;     /* unlock flash */
+  err |= prog_flash(FW_SLOT + 0x2000*i, 1, &blank, 1, "inUpdate");  /* erase (the blank word is not programmed) */
+}
+if(err){
+  return 5;
+}
 
-case 6:     /* A&BSeparate, cw, flag_options=0 */
-  if(index_ab){
-    if(param_ptr==0){
-      param_ptr = param_ptr_start[func_b];
-    }
-    else if(param_ptr==param_ptr_end[func_b]){
-      param_ptr = OPTIONS_START;
-      index_ab = 0;
-      flag_options = 1;
-      return 1;
-    }
-    else{
-      param_ptr++;
-    }
-  }
-  else{ /* index_ab==0 */
-    if(param_ptr==0){
-      param_ptr = param_ptr_start[func_a];
-    }
-    else if(param_ptr==param_ptr_end[func_a]){
-      param_ptr = 0;
-      index_ab = 1;
-      return 1;
-    }
-    else{
-      param_ptr++;
-    }
-  }
-  break;
+fw_next = 0;
+fw_state = 1;
+disp_text("Recvd    0 Words", 1, -1);
+return 0;
+}
 
-case 7:     /* A&BSeparate, cw, flag_options=1 */
-  if(param_ptr==OPTIONS_END){
-    param_ptr = 0;
-    flag_options = 0;
-    return 1;
-  }
-  else{
-    param_ptr++;
-  }
-  break;
 
-case 8:     /* Ch A Only, ccw, flag_options=0 */
-  if(param_ptr==0){
-    param_ptr = OPTIONS_END;
-    flag_options = 1;
-  }
-  else if(param_ptr==param_ptr_start[func_a]){
-    param_ptr = 0;
-    return 1;
-  }
-  else{
-    param_ptr--;
-  }
-  break;
+/**************************************************************************
+ * fw_block
+ * Programs one firmware image block from a BIN_FW_BLOCK frame payload
+ * (data, nbytes; see bin_execute()) into the backup code sectors. Blocks
+ * must arrive in order (offset==fw_next) and may not span two sectors.
+ * The CRC32 of the block (see fw_crc()) is checked before it is programmed
+ * and again on the words read back from the FLASH. A block that is
+ * refused (status 3) can be sent again from fw_next (see BIN_FW_STATUS);
+ * after a FLASH error the update starts over with BIN_FW_BEGIN.
+ * Returns the bin_execute() status.
+ *
+ **************************************************************************/
+int fw_block(unsigned *data, int nbytes)
+{
+unsigned offset, n, i, j;
+unsigned long crc;
 
-case 9:     /* Ch A Only, ccw, flag_options=1 */
-  if(param_ptr==OPTIONS_START){
-    param_ptr = param_ptr_end[func_a];
-    flag_options = 0;
-  }
-  else{
-    param_ptr--;
-    if(param_ptr==OPTIONS_START){
-      return 1;
-    }
-  }
-  break;
+if((nbytes<8)||(nbytes&1)||(nbytes>6+2*FW_BLOCK)){
+  return 2;
+}
+offset = (data[0]<<8)|data[1];
+crc = ((unsigned long)data[2]<<24)|((unsigned long)data[3]<<16)|((unsigned long)data[4]<<8)|(unsigned long)data[5];
+n = (unsigned)(nbytes - 6)>>1;
+if((fw_state!=1)||(offset!=fw_next)||(offset+n>fw_len)||((offset&0x1fff)+n>0x2000)){
+  return 3;
+}
 
-case 10:    /* Ch A Only, cw, flag_options=0 */
-  if(param_ptr==0){
-    param_ptr = param_ptr_start[func_a];
-  }
-  else if(param_ptr==param_ptr_end[func_a]){
-    param_ptr = OPTIONS_START;
-    flag_options = 1;
-    return 1;
-  }
-  else{
-    param_ptr++;
-  }
-  break;
+for(i=0;i<n;i++){       /* pack the bytes into words (in place) */
+  data[i] = (data[6+2*i]<<8)|data[7+2*i];
+}
+if((fw_crc(0xffffffffL, offset, data, n)^0xffffffffL)!=crc){
+  return 4;             /* transfer error */
+}
 
-case 11:    /* Ch A Only, cw, flag_options=1 */
-  if(param_ptr==OPTIONS_END){
-    param_ptr = 0;
-    flag_options = 0;
-    return 1;
+for(i=SERIAL_LOC+2;i<SERIAL_LOC+7;i++){ /* substitute this module's serial number */
+  if((i>=offset)&&(i<offset+n)){
+    j = (i - (SERIAL_LOC+2))<<1;
+    data[i-offset] = ((unsigned)serial_str[j]<<8)|(unsigned)serial_str[j+1];
   }
-  else{
-    param_ptr++;
-  }
-  break;
+}
 
-default:
-  break;
-}   /* end switch */
+flash_locked = 0;       /* unlock flash */
+if(prog_flash(FW_SLOT + offset, n, data, 0, "inUpdate")){
+  fw_state = 0;
+  return 5;
+}
+read_flash(FW_SLOT + offset, n, data);  /* verify */
+if((fw_crc(0xffffffffL, offset, data, n)^0xffffffffL)!=crc){
+  fw_state = 0;
+  return 5;
+}
 
+fw_next += n;
+disp_num((long)fw_next, 6, 5 ,0);   /* update "Recvd     Words" */
 return 0;
 }
 
 
 /**************************************************************************
- * inc_dec_mod (fix: posible shorter to use: "*ptr = ++(*ptr) % mod" for mod)
- * Increment/Decrement modulo mod based on cw
+ * fw_keep
+ * Copies an unchanged firmware image block from the main code sectors (the
+ * installed firmware) into the backup code sectors, for a BIN_FW_KEEP frame
+ * payload (data, nbytes; see bin_execute()). Takes the place of a
+ * BIN_FW_BLOCK frame for a block the host found unchanged with BIN_FW_HASH,
+ * so only the changed blocks are sent. The block (up to one sector) must be
+ * the next one (offset==fw_next), and its CRC32 is checked on the installed
+ * words and again on the copy. Returns the bin_execute() status.
+ *
  **************************************************************************/
-void inc_dec_mod(int *ptr, int mod)
+int fw_keep(unsigned *data, int nbytes)
 {
-if(mod){
-  if(cw){
-    ++(*ptr);
-    if((*ptr)>=mod) *ptr = 0;
-  }
-  else{
-    --(*ptr);
-    if((*ptr)<0) *ptr = mod - 1;
-  }
+unsigned offset, n;
+unsigned long crc;
+
+if(nbytes!=8){
+  return 2;
 }
-else{
-  *ptr = 0;     /* if mod==0, return 0 */
+offset = (data[0]<<8)|data[1];
+n = (data[2]<<8)|data[3];
+crc = ((unsigned long)data[4]<<24)|((unsigned long)data[5]<<16)|((unsigned long)data[6]<<8)|(unsigned long)data[7];
+if((fw_state!=1)||(offset!=fw_next)||(n==0)||(offset+n>fw_len)||((offset&0x1fff)+n>0x2000)){
+  return 3;
+}
+
+read_flash(offset, n, flash_data);
+if((fw_crc(0xffffffffL, offset, flash_data, n)^0xffffffffL)!=crc){
+  return 4;             /* the installed block is not the one the host expects */
 }
+flash_locked = 0;       /* unlock flash */
+if(prog_flash(FW_SLOT + offset, n, flash_data, 0, "inUpdate")){
+  fw_state = 0;
+  return 5;
+}
+read_flash(FW_SLOT + offset, n, flash_data);    /* verify */
+if((fw_crc(0xffffffffL, offset, flash_data, n)^0xffffffffL)!=crc){
+  fw_state = 0;
+  return 5;
+}
+
+fw_next += n;
+disp_num((long)fw_next, 6, 5 ,0);   /* update "Recvd     Words" */
+return 0;
 }
 
 
 /**************************************************************************
- * add_sub
- * Add/Subtract 10^pow to long based on cw (where: 0<=pow<=9)
+ * fw_hash
+ * Answers a BIN_FW_HASH frame payload (data, nbytes; see bin_execute()):
+ * image word offset (2 bytes) and number of blocks (1 to 24). Sends a
+ * reply frame with the CRC32 (4 bytes, see fw_crc()) of each FW_BLOCK words
+ * of the main code sectors (the installed firmware) from offset, or a
+ * status byte (2 - bad length, 3 - bad parameter). The host compares them
+ * with the blocks of the new image and sends BIN_FW_KEEP for the equal ones.
+ *
  **************************************************************************/
-void add_sub_pow(long *ptr, int pow)
+void fw_hash(unsigned *data, int nbytes)
 {
-long delta;
+unsigned offset, reply[4*24];
+unsigned long crc;
+int i, nblocks, status;
 
-switch(pow){
-case 0:
-  delta = 1;
-  break;
-case 1:
-  delta = 10;
-  break;
-case 2:
-  delta = 100;
-  break;
-case 3:
-  delta = 1000;
-  break;
-case 4:
-  delta = 10000;
-  break;
-case 5:
-  delta = 100000;
-  break;
-case 6:
-  delta = 1000000;
-  break;
-case 7:
-  delta = 10000000;
-  break;
-case 8:
-  delta = 100000000;
-  break;
-case 9:
-  delta = 1000000000;
-  break;
-default:
-  delta = 1;
-  break;
+status = 0;
+if(nbytes!=3){
+  status = 2;
 }
-
-if(cw){
-  (*ptr) += delta;
+else{
+  offset = (data[0]<<8)|data[1];
+  nblocks = (int)data[2];
+  if((nblocks<1)||(nblocks>24)||(offset&(FW_BLOCK-1))||(offset>=0x6000)||
+     ((unsigned)nblocks*FW_BLOCK>0x6000-offset)){  /* (no 16 bit overflow) */
+    status = 3;
+  }
 }
-  else{
-  (*ptr) -= delta;
+if(status){
+  xmit_frame(BIN_FW_HASH + BIN_ACK, (unsigned*)&status, 1);
+  return;
 }
 
-if((*ptr)>max_value){
-  (*ptr) = max_value;
+for(i=0;i<nblocks;i++){
+  read_flash(offset, FW_BLOCK, flash_data);
+  crc = fw_crc(0xffffffffL, offset, flash_data, FW_BLOCK)^0xffffffffL;
+  reply[4*i] = (unsigned)(crc>>24)&0xff;
+  reply[4*i+1] = (unsigned)(crc>>16)&0xff;
+  reply[4*i+2] = (unsigned)(crc>>8)&0xff;
+  reply[4*i+3] = (unsigned)crc&0xff;
+  offset += FW_BLOCK;
+}
+xmit_frame(BIN_FW_HASH + BIN_ACK, reply, 4*nblocks);
 }
 
-if((*ptr)<min_value){
-  (*ptr) = min_value;
+
+/**************************************************************************
+ * fw_commit
+ * Verifies the whole firmware image in the backup code sectors against
+ * the CRC32 sent with BIN_FW_BEGIN, then programs its signature (FW_TAG,
+ * length, CRC32 and an install word left at 0xffff) and installs it (see
+ * fw_install()). Nothing is installed unless the image read back from the
+ * FLASH is complete and correct. Returns the bin_execute() status.
+ *
+ **************************************************************************/
+int fw_commit(void)
+{
+unsigned offset, n, sig[4];
+unsigned long crc;
+
+if((fw_state!=1)||(fw_next!=fw_len)){
+  return 3;             /* not all blocks received */
+}
+fw_state = 0;
+
+disp_text("Verifying...    ", 1, -1);
+crc = 0xffffffffL;
+for(offset=0;offset<fw_len;offset+=n){
+  n = fw_len - offset;
+  if(n>0x2000) n = 0x2000;
+  read_flash(FW_SLOT + offset, n, flash_data);
+  crc = fw_crc(crc, offset, flash_data, n);
+}
+if((crc^0xffffffffL)!=fw_image_crc){
+  disp_text("Update CRC Error", 1, -1);
+  return 4;
 }
 
+sig[0] = FW_TAG;
+sig[1] = fw_len;
+sig[2] = (unsigned)(fw_image_crc>>16);
+sig[3] = (unsigned)fw_image_crc;
+flash_locked = 0;       /* unlock flash */
+if(prog_flash(FW_SLOT + FW_SIG, 4, sig, 0, "inUpdate")){
+  return 5;
+}
+return fw_install();
 }
 
 
 /**************************************************************************
- * update_dsp
- * This function updates the DSP's function to reflect current parameter
- * values.
+ * fw_install
+ * Copies the signed firmware image in the backup code sectors into the
+ * main code sectors (the ones that boot), one sector at a time, and checks
+ * the CRC32 of the copy. The install word of the signature is programmed
+ * to 0 when done. The backup sectors now hold the same verified firmware
+ * (instead of the recovery firmware): if the power fails during the copy,
+ * the module boots it with the knob pressed and main() installs it again.
+ * Returns the bin_execute() status.
  *
  **************************************************************************/
-void update_dsp(int param_ptr_tmp, int index_ab_tmp)
+int fw_install(void)
 {
-long ltemp;
-int itemp, iorder, cursor_temp;
-float f1, f2, fcenter, fwidth, ftemp;
+unsigned offset, n, sig[5];
+unsigned long crc;
+int err;
 
-/* Update the DSP's function: */
-switch(param_ptr_tmp){
-case 0: /* FUNC: */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  gain(index_ab_tmp);   /* Calculate setting of gain constant and output attenuator based on current func and index_ab_tmp */
-  update_dsp(param_ptr_start[(int)params[0][index_ab_tmp]],index_ab_tmp);   /* Initialize the current function with recursive call */
-  break;
+read_flash(FW_SLOT + FW_SIG, 5, sig);
+if((sig[0]!=FW_TAG)||(sig[1]==0)||(sig[1]>FW_SIG)){
+  return 3;             /* no signed image */
+}
 
-case 1: /* Levels:In Out */
-  assembly_flag |= 1;   /* flag the VU Meter to turn on */
-  break;
+disp_text("Installing...   ", 1, -1);
+crc = 0xffffffffL;
+err = 0;
+for(offset=0;offset<sig[1];offset+=n){
+  n = sig[1] - offset;
+  if(n>0x2000) n = 0x2000;
+  read_flash(FW_SLOT + offset, n, flash_data);
+  flash_locked = 0;     /* unlock flash */
+  err |= prog_flash(offset, n, flash_data, 1, "inUpdate");
+  read_flash(offset, n, flash_data);
+  crc = fw_crc(crc, offset, flash_data, n);
+}
+if(err||((crc^0xffffffffL)!=(((unsigned long)sig[2]<<16)|(unsigned long)sig[3]))){
+  disp_text("Install Error!  ", 1, -1);
+  return 5;             /* install word left set: tried again at power up */
+}
 
-case 2: /* RevertToLevels: */
-  auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
-  break;
+sig[4] = 0;
+flash_locked = 0;       /* unlock flash */
+prog_flash(FW_SLOT + FW_SIG + 4, 1, &sig[4], 0, "inUpdate");    /* installed */
+disp_text("Cycle power!    ", 1, -1);
+return 0;
+}
 
-case 3: /* FullScalIn: */
-  min_value = 1;    /* set min and max value to bound paramter */
-  max_value = max_in_level;
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  set_all_gains();      /* set optimal CODEC gains and attenuations */
-  break;
 
-case 4: /* SampleRate: */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  set_fsample();        /* set CODEC sampling rate */
-  init_freq_params();   /* pull up factory default frequencies */
-  /* no "break;"           fall into case 6: below to init functions: */
+/**************************************************************************
+ * slotsn
+ * This subroutine answers the "slotsn" discovery command. Unlike "sendsn",
+ * which waits a random time, each module sends its serial number in a slot
+ * selected by the bits of its serial number, so the host can walk a binary
+ * tree of serial numbers (least significant bits first) without retries:
+ *
+ *      at all slotsn:nbits shift res
+ *
+ *  nbits   -   number of slot bits, 2^nbits slots (1 to 10, default SLOTSN_BITS)
+ *  shift   -   number of low serial number bits already resolved (0 to 20, default 0)
+ *  res     -   value of the resolved low bits (default 0)
+ *
+ * Only modules with (serial_number & (2^shift - 1)) == res answer. The module
+ * answers in slot = (serial_number>>shift) & (2^nbits - 1). If the host sees a
+ * garbled slot it asks again with shift+nbits and res + (slot<<shift).
+ * A slot is SLOTSN_CHARS character times long at the current (auto detected)
+ * baud rate: 10 bits*16*BRD/CLKOUT1 per character.
+ *
+ **************************************************************************/
+void slotsn(void)
+{
+int nbits, shift;
+long res, slot;
+char *cptr;
+float slot_usec;
+
+cptr = &value_str[0];
+nbits = (int)get_number(&cptr, SLOTSN_BITS);
+shift = (int)get_number(&cptr, 0L);
+res = get_number(&cptr, 0L);
+if((nbits<1)||(nbits>10)||(shift<0)||(shift>20)){
+  return;               /* bad parameters */
+}
 
-case 6: /* Mode: */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  /* Set the current function: */
-  if(params[6][0]==0){  /* Mode:A&B Common */
-    gain(2);    /* Calculate setting of gain constants and output attenuator based on current func */
-    update_dsp(param_ptr_start[(int)params[0][2]],2);   /* Initialize the current function with recursive call */
-  }
-  else if(params[6][0]==1){ /* Mode:A&B Separate */
-    if(params[17][0] > 128) params[17][0] = 127;    /* reset filter order to default if greater that 128 */
-    if(params[20][0] > 128) params[20][0] = 127;
-    if(params[26][0] > 128) params[26][0] = 127;
-    if(params[32][0] > 128) params[32][0] = 127;
-    if(params[40][0] > 128) params[40][0] = 127;
-    gain(0);    /* Calculate setting of gain constant and output attenuator based on current func */
-    update_dsp(param_ptr_start[(int)params[0][0]],0);   /* Initialize the current function with recursive call */
-    gain(1);    /* Calculate setting of gain constant and output attenuator based on current func */
-    update_dsp(param_ptr_start[(int)params[0][1]],1);   /* Initialize the current function with recursive call */
-  }
-  else{                 /* Mode:Ch A Only */
-    func_addr_b = (unsigned)&no_func_b; /* set Ch B to no_func so Ch A can run long filter */
-    gain(0);    /* Calculate setting of gain constant and output attenuator based on current func */
-    update_dsp(param_ptr_start[(int)params[0][0]],0);   /* Initialize the current function with recursive call */
-  }
-  break;
+if((serial_number&((1L<<shift) - 1))!=res){
+  return;               /* not in the branch of the tree being searched */
+}
+slot = (serial_number>>shift)&((1L<<nbits) - 1);
+slot_usec = (SLOTSN_CHARS*160.0e6/(2.0*XTAL))*(float)portfff7;  /* CLKOUT1 = 2.0*XTAL, BRD set by auto baud */
 
-case 5: /* InputSrc: */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  assembly_flag = (int)params[5][0] ? (assembly_flag|8):(assembly_flag&(~8));   /* set/clear the white noise flag for assembly code */
-  break;
+portfff5 &= ~0x0080;    /* suspend async. receive ints. so this module
+                           will not hear itself or other modules talking. */
+wait((long)((float)slot*slot_usec));    /* wait for our slot */
+xmit(serial_str);       /* send serial number with check sums out the RS-232 port */
+}
 
-case 7: /* Cascade Ch A&B */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  assembly_flag = (int)params[7][0] ? (assembly_flag|4):(assembly_flag&(~4));   /* set/clear the cascade flag for assembly code */
-  break;
 
-case 8: /* Master Mode */
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
+/**************************************************************************
+ * ack_reply
+ * Answers the "ack" command in slot group_slot (ACK_CHARS character times
+ * per slot) with two bytes:
+ *
+ *  0x80 + group_slot (+ 0x20 if a command failed since the last "ack")
+ *  0xc0 + number of commands executed since the last "ack" (modulo 64)
+ *
+ * A controller sends "at grp:3 ack" after a group's commands, and gets the
+ * delivery of all the modules of the group (one bit per slot) in one round.
+ *
+ **************************************************************************/
+void ack_reply(void)
+{
+float slot_usec;
 
-  break;
+slot_usec = (ACK_CHARS*160.0e6/(2.0*XTAL))*(float)portfff7;   /* CLKOUT1 = 2.0*XTAL, BRD set by auto baud */
 
-case 9: /* Erase Mem: */
-  if(params_changed_copy==3){
-    initialize();   /* initialize DSP hardware */
-    wait(500000);   /* wait to display "FUNC:AllPass" */
-    store_all();    /* store current settings to all flash memory locations */
-    update_disp_left();     /* display parameter state */
-    update_disp_right(1);
-  }
-  break;
+portfff5 &= ~0x0080;    /* suspend async. receive ints. so this module
+                           will not hear itself or other modules talking. */
+wait((long)((float)group_slot*slot_usec));  /* wait for our slot */
+xmit_byte(0x80|(ack_error ? 0x20:0)|group_slot);
+xmit_byte(0xc0|((ack_count - 1)&0x3f));     /* (not counting this "ack") */
+ack_count = 0;
+ack_error = 0;
+}
 
-case 10:    /* Store: */
-  store();  /* store settings if params_changed_copy==3 */
-  break;
 
-case 11:    /* Recall: */
-  recall(); /* recall settings if params_changed_copy==3 */
-  break;
+/**************************************************************************
+ * get_number
+ * Reads a positive decimal number from the string at *sptr (leading spaces
+ * are skipped) and advances *sptr past it. Returns default_value if no
+ * digits are found.
+ *
+ **************************************************************************/
+long get_number(char **sptr, long default_value)
+{
+long num;
+char *cptr;
 
-case 12:    /* Firmware:  V */
-/*  portfff5 &= ~0x0200;    /* suspend delta interupts while updating display */
-/*  if(params_changed_copy==1){ */
-    disp_num(VERSION, 13, 4, 2);
-    disp_text("", 1, 0);    /* position cursor home */
-/*  }
-  else if(params_changed_copy==2){
-    disp_text("", 13, 0);   /* position cursor to 13 */
-/*  } *
-/*  portfff5 |= 0x0200;     /* re-enable delta interupts */
-  break;
+cptr = *sptr;
+while(*cptr==' ') cptr++;   /* skip leading spaces */
+if(!isdigit(*cptr)){
+  *sptr = cptr;
+  return default_value;
+}
+num = 0;
+while(isdigit(*cptr)){
+  num = 10*num + (long)(*cptr++ & 0x0f);  /* convert character to number; next digit */
+}
+*sptr = cptr;
+return num;
+}
 
-case 13:    /* Serial No: */
-/*  portfff5 &= ~0x0200;    /* suspend delta interupts while updating display */
-/*  if(params_changed_copy==1){ */
-    disp_num(serial_number, 11, 6, 0);
-    disp_text("", 1, 0);    /* position cursor home */
-/*  }
-  else if(params_changed_copy==2){
-    disp_text("", 11, 0);   /* position cursor to 11 */
-/*  } */
-/*  portfff5 |= 0x0200;     /* re-enable delta interupts */
-  break;
 
-case 14:    /* NFgain: */
-  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
-  max_value = GAIN_MAX;
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  gain(index_ab_tmp);
-  /* Set function address to no function: */
-  itemp = index_ab_tmp + 1; /* itemp: 1-A, 2-B, 3-Common */
-  if(itemp&1){
-    func_addr_a = (unsigned)&no_func_a; /* set no function */
-  }
-  if(itemp&2){
-    func_addr_b = (unsigned)&no_func_b; /* set no function */
+/**************************************************************************
+ * param_struct_search()
+ * This function searches param_struct[i].text for a parameter_str[] 
+ * match as follows:
+ *
+ * match_type = 0   -   no match found
+ *              1   -   0-offset match
+ *              2   -   0-offset match except with space in first .text
+ *                          " APgain"=="bAPgain"
+ *              3   -   1-offset match with space in first .text
+ *                          " APgain"=="APgain"
+ *
+ * Only the rows chained under the first letter of parameter_str[] (0 and
+ * 1-offset matches) and under the second letter (a/b prefix) are compared,
+ * in table order, so the first matching row is the same as searching the
+ * whole table. A one letter parameter_str[] matches row 0 (" FUNC:").
+ *
+ **************************************************************************/
+int param_struct_search(int *match_type)
+{
+int i, j, k;
+
+i = name_first[NAME_KEY(parameter_str[0])];
+j = parameter_str[1] ? name_first[NAME_KEY(parameter_str[1])]:0;
+while((i>=0)||(j>=0)){      /* merge the two chains in table order */
+  if((j<0)||((i>=0)&&(i<j))){
+    k = i;
+    i = name_next[i];
   }
-  break;
-case 15:    /* APgain: */
-  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
-  max_value = GAIN_MAX;
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  gain(index_ab_tmp);
-  /* Set function address to allpass: */
-  itemp = index_ab_tmp + 1; /* itemp: 1-A, 2-B, 3-Common */
-  if(itemp&1){
-    func_addr_a = (unsigned)&allpass_func_a; /* send input to output */
+  else{
+    if(i==j) i = name_next[i];  /* row is on both chains */
+    k = j;
+    j = parameter_str[1] ? name_next[j]:-1;
   }
-  if(itemp&2){
-    func_addr_b = (unsigned)&allpass_func_b; /* send input to output */
+  if(*match_type = name_match(k)){
+    return(k);
   }
-  break;
+}
 
-case 18:    /* LPgain: */
-case 21:    /* HPgain: */
-case 27:    /* BPgain: */
-case 33:    /* BSgain: */
-case 36:    /* Ngain: */
-case 39:    /* INgain: */
-case 42:    /* UFgain: */
-case 45:    /* Samp: */
-  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
-  max_value = GAIN_MAX;
-  if(params_changed_copy==1) break; /* update only min_value and max_value */
-  gain(index_ab_tmp);
-  break;
+*match_type = 0;    /* no match found */
+return(0);
+}
 
-case 17:    /* LPorder: */
-case 20:    /* HPorder: */
-  min_value = (long)(3);    /* set min and max value to bound paramter */
-  if(params[6][0]==2){      /* if Ch A Only */
-    max_value = (long)(256);    /* allow long filters on Ch A */
-  }
-  else{
-    max_value = (long)(128);  
-  }
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current fcut */
-  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
-  goto compute_filt;
+/**************************************************************************
+ * name_match()
+ * This function compares param_struct[i].text with parameter_str[] and
+ * returns the match_type (see param_struct_search()).
+ *
+ **************************************************************************/
+int name_match(int i)
+{
+char *cptr;
 
-case 26:    /* BPorder: */
-case 32:    /* BSorder: */
-  min_value = (long)(3);    /* set min and max value to bound paramter */
-  if(params[6][0]==2){      /* if Ch A Only */
-    max_value = (long)(256);    /* allow long filters on Ch A */
+cptr = param_struct[i].text;    /* get pointer value to beginning of ith parameter text */
+
+if(string_compare(cptr, &parameter_str[0])){  /* if 0-offset match */
+  return(1);
+}
+else if(*cptr++==' '){          /* first character is a space */
+  if(string_compare(cptr, &parameter_str[0])){  /* if 1-offset match */
+    return(3);
   }
-  else{
-    max_value = (long)(128);  
+  if(string_compare(cptr, &parameter_str[1])){  /* if 0-offset match (skipping first character) */
+    return(2);
   }
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp-4][index_ab_tmp];    /* get current f1 */
-  f2 = (float)params[param_ptr_tmp-3][index_ab_tmp];    /* get current f2 */
-  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
-  goto compute_filt;
-
-case 16:    /* LPfcut: */
-case 19:    /* HPfcut: */
-  min_value = (long)(FCUT_MIN*fsample); /* set min and max value to bound paramter */
-  max_value = (long)(FCUT_MAX*fsample);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current fcut */
-  iorder = (int)params[param_ptr_tmp+1][index_ab_tmp];  /* get current order */
-  goto compute_filt;
+}
+return(0);
+}
 
-case 22:    /* BPf1: */
-case 28:    /* BSf1: */
-  min_value = (long)(F1_MIN*fsample);   /* set min and max value to bound paramter */
-  max_value = (long)(F1_MAX*fsample);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current f1 */
-  f2 = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get current f2 */
-  if((f2-f1)<FWIDTH_MIN*fsample){   /* "push" f2 up to maintain minimum width */
-    f2 = f1 + FWIDTH_MIN*fsample;
-    params[param_ptr_tmp+1][index_ab_tmp] = (long)f2;   /* save modified f2 */
-  }
-  params[param_ptr_tmp+2][index_ab_tmp] = (long)((f1+f2)/2.0);  /* save updated fcenter */
-  params[param_ptr_tmp+3][index_ab_tmp] = (long)(f2-f1);        /* save updated fwidth */
-  iorder = (int)params[param_ptr_tmp+4][index_ab_tmp];  /* get current order */
-  goto compute_filt;
+/**************************************************************************
+ * string_compare()
+ * This function first converts both string to lower case and then compares
+ * the strings up to end of the shortest string. Returns 1 if equal and
+ * 0 if not equal. A null string matches anything.
+ **************************************************************************/
+int string_compare(char *s1, char *s2)
+{
+char ctemp1, ctemp2;
+  
+for(;;){
+  ctemp1 = tolower(*s1++);
+  ctemp2 = tolower(*s2++);
+  if((!ctemp1)||(!ctemp2)) return(1);
+  if(ctemp1 != ctemp2) return(0);
+}
+}
 
-case 23:    /* BPf2: */
-case 29:    /* BSf2: */
-  min_value = (long)(F2_MIN*fsample);   /* set min and max value to bound paramter */
-  max_value = (long)(F2_MAX*fsample);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current f1 */
-  f2 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current f2 */
-  if((f2-f1)<FWIDTH_MIN*fsample){   /* "push" f1 down to maintain minimum width */
-    f1 = f2 - FWIDTH_MIN*fsample;
-    params[param_ptr_tmp-1][index_ab_tmp] = (long)f1;   /* save modified f1 */
+
+/**************************************************************************
+ * inc_dec_param_ptr
+ * Increment/Decrement param_ptr and set index_ab based on cw
+ *
+ * If Mode:A&B Common then the sequence is:
+ *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
+ *
+ *  Common  2           0               0   (FUNC)              beep
+ *                                      param_ptr_start[func_c]
+ *                                      . . .
+ *                                      param_ptr_end[func_c]   
+ *  Options 0           1               OPTIONS_START           beep
+ *                                      . . .
+ *                                      OPTIONS_END
+ *
+ * If Mode:A&B Separate then the sequence is:
+ *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
+ *
+ *  A       0           0               0   (FUNC)              beep
+ *                                      param_ptr_start[func_a]
+ *                                      . . .
+ *                                      param_ptr_end[func_a]   
+ *  B       1           0               0   (FUNC)              beep
+ *                                      param_ptr_start[func_b]
+ *                                      . . .
+ *                                      param_ptr_end[func_b]
+ *  Options 0           1               OPTIONS_START           beep
+ *                                      . . .
+ *                                      OPTIONS_END
+ *
+ * If Mode: Ch A Only then the sequence is:
+ *  Section index_ab    flag_options    param_ptr (name)        return 1 for beep
+ *
+ *  A       0           0               0   (FUNC)              beep
+ *                                      param_ptr_start[func_a]
+ *                                      . . .
+ *                                      param_ptr_end[func_a]   
+ *  Options 0           1               OPTIONS_START           beep
+ *                                      . . .
+ *                                      OPTIONS_END
+ *
+ * Returns: 0 - if no boundary crossed
+ *          1 - if boundary crossed: A <=> B <=> Options, or Common <=> Options ...
+ **************************************************************************/
+int inc_dec_param_ptr(void)
+{
+int func_a, func_b, func_c;
+
+func_a = (int)params[0][0]; /* get A function index */
+func_b = (int)params[0][1]; /* get B function index */
+func_c = (int)params[0][2]; /* get Common function index */
+
+switch((params[6][0]<<2)+(cw<<1)+flag_options){ /* compute a code for the switch */
+case 0:     /* A&BCommon, ccw, flag_options=0 */
+  if(param_ptr==0){
+    param_ptr = OPTIONS_END;
+    index_ab = 0;
+    flag_options = 1;
   }
-  params[param_ptr_tmp+1][index_ab_tmp] = (long)((f1+f2)/2.0);  /* save updated fcenter */
-  params[param_ptr_tmp+2][index_ab_tmp] = (long)(f2-f1);        /* save updated fwidth */
-  iorder = (int)params[param_ptr_tmp+3][index_ab_tmp];  /* get current order */
-  goto compute_filt;
+  else if(param_ptr==param_ptr_start[func_c]){
+    param_ptr = 0;
+    return 1;
+  }
+  else{
+    param_ptr--;
+  }
+  break;
 
-case 24:    /* BPfcntr: */
-case 30:    /* BSfcntr: */
-  fwidth = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get fwidth */
-  min_value = (long)((F1_MIN*fsample + fwidth/2.0) + 0.5);  /* set min and max value to bound paramter */
-  max_value = (long)((F2_MAX*fsample - fwidth/2.0) + 0.5);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  fcenter = (float)params[param_ptr_tmp][index_ab_tmp]; /* get fcenter */
-  ftemp = fwidth/2.0;
-  f1 = fcenter - ftemp;
-  f2 = fcenter + ftemp;
-/*    if(f1<F1_MIN*fsample){    /* set f1 to minimum */
-/*      f1 = F1_MIN*fsample;
+case 1:     /* A&BCommon, ccw, flag_options=1 */
+  if(param_ptr==OPTIONS_START){
+    param_ptr = param_ptr_end[func_c];
+    index_ab = 2;
+    flag_options = 0;
+  }
+  else{
+    param_ptr--;
+    if(param_ptr==OPTIONS_START){
+      return 1;
     }
-    if(f2>F2_MAX*fsample){  /* set f2 to maxmum */
-/*      f2 = F2_MAX*fsample;
-    } */
-  params[param_ptr_tmp-2][index_ab_tmp] = (long)f1;     /* save modified f1 */
-  params[param_ptr_tmp-1][index_ab_tmp] = (long)f2;     /* save modified f2 */
-  params[param_ptr_tmp+1][index_ab_tmp] = (long)(f2 - f1);  /* save modified fwidth */
-  iorder = (int)params[param_ptr_tmp+2][index_ab_tmp];  /* get current order */
-  goto compute_filt;
+  }
+  break;
 
-case 25:    /* BPfwdth: */
-case 31:    /* BSfwdth: */
-  min_value = (long)(FWIDTH_MIN*fsample);   /* set min and max value to bound paramter */
-  max_value = (long)((F2_MAX - F1_MIN)*fsample + 0.5);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  fcenter = (float)params[param_ptr_tmp-1][index_ab_tmp];   /* get fcenter */
-  fwidth = (float)params[param_ptr_tmp][index_ab_tmp];      /* get fwidth */
-  ftemp = fwidth/2.0;                                          
-  f1 = fcenter - ftemp;
-  f2 = fcenter + ftemp;
-  if(f1<F1_MIN*fsample){    /* set f1 to minimum */
-    f1 = F1_MIN*fsample;
-    f2 = f1 + fwidth;
+case 2:     /* A&BCommon, cw, flag_options=0 */
+  if(param_ptr==0){
+    param_ptr = param_ptr_start[func_c];
   }
-  if(F2_MAX*fsample<f2){    /* set f2 to maxmum */
-    f2 = F2_MAX*fsample;
-    f1 = f2 - fwidth;
+  else if(param_ptr==param_ptr_end[func_c]){
+    param_ptr = OPTIONS_START;
+    index_ab = 0;
+    flag_options = 1;
+    return 1;
+  }
+  else{
+    param_ptr++;
   }
-  params[param_ptr_tmp-3][index_ab_tmp] = (long)f1;     /* save modified f1 */
-  params[param_ptr_tmp-2][index_ab_tmp] = (long)f2;     /* save modified f2 */
-  params[param_ptr_tmp-1][index_ab_tmp] = (long)((f1 + f2)/2.0);    /* save modified fcenter */
-  iorder = (int)params[param_ptr_tmp+1][index_ab_tmp];  /* get current order */
- compute_filt:
-  compute_fir(f1, f2, iorder, index_ab_tmp);    /* Compute and load FIR filter coefficients for LP, HP, BP or BS */
   break;
 
-case 34:    /* Nfnotch: */
-case 37:    /* INfcntr: */
-  min_value = (long)(FNFNOTCH_MIN*fsample); /* set min and max value to bound paramter */
-  max_value = (long)(FNFNOTCH_MAX*fsample);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp][index_ab_tmp];      /* get current fnotch */
-  f2 = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get current fwdth */
-  goto compute_n;
-  
-case 35:    /* Nfwidth: */
-case 38:    /* INfwdth: */
-  min_value = (long)(FNFWIDTH_MIN*fsample); /* set min and max value to bound paramter */
-  max_value = (long)(FNFWIDTH_MAX*fsample);
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current fnotch */
-  f2 = (float)params[param_ptr_tmp][index_ab_tmp];      /* get current fwdth */
- compute_n:
-  compute_notch(f1, f2, index_ab_tmp);  /* compute and load notch coefficients */
+case 3:     /* A&BCommon, cw, flag_options=1 */
+  if(param_ptr==OPTIONS_END){
+    param_ptr = 0;
+    index_ab = 2;
+    flag_options = 0;
+    return 1;
+  }
+  else{
+    param_ptr++;
+  }
+  break;
+
+case 4:     /* A&BSeparate, ccw, flag_options=0 */
+  if(index_ab){
+    if(param_ptr==0){
+      param_ptr = param_ptr_end[func_a];
+      index_ab = 0;
+    }
+    else if(param_ptr==param_ptr_start[func_b]){
+      param_ptr = 0;
+      return 1;
+    }
+    else{
+      param_ptr--;
+    }
+  }
+  else{ /* index_ab==0 */
+    if(param_ptr==0){
+      param_ptr = OPTIONS_END;
+      index_ab = 0;
+      flag_options = 1;
+    }
+    else if(param_ptr==param_ptr_start[func_a]){
+      param_ptr = 0;
+      return 1;
+    }
+    else{
+      param_ptr--;
+    }
+  }
+  break;
+
+case 5:     /* A&BSeparate, ccw, flag_options=1 */
+  if(param_ptr==OPTIONS_START){
+    param_ptr = param_ptr_end[func_b];
+    index_ab = 1;
+    flag_options = 0;
+  }
+  else{
+    param_ptr--;
+    if(param_ptr==OPTIONS_START){
+      return 1;
+    }
+  }
   break;
 
-case 40:    /* UForder: */
-  min_value = (long)(3);    /* set min and max value to bound parameter */
-  if(params[6][0]==2){      /* if Ch A Only */
-    max_value = (long)(256);    /* allow long filters on Ch A */
+case 6:     /* A&BSeparate, cw, flag_options=0 */
+  if(index_ab){
+    if(param_ptr==0){
+      param_ptr = param_ptr_start[func_b];
+    }
+    else if(param_ptr==param_ptr_end[func_b]){
+      param_ptr = OPTIONS_START;
+      index_ab = 0;
+      flag_options = 1;
+      return 1;
+    }
+    else{
+      param_ptr++;
+    }
+  }
+  else{ /* index_ab==0 */
+    if(param_ptr==0){
+      param_ptr = param_ptr_start[func_a];
+    }
+    else if(param_ptr==param_ptr_end[func_a]){
+      param_ptr = 0;
+      index_ab = 1;
+      return 1;
+    }
+    else{
+      param_ptr++;
+    }
+  }
+  break;
+
+case 7:     /* A&BSeparate, cw, flag_options=1 */
+  if(param_ptr==OPTIONS_END){
+    param_ptr = 0;
+    flag_options = 0;
+    return 1;
+  }
+  else{
+    param_ptr++;
+  }
+  break;
+
+case 8:     /* Ch A Only, ccw, flag_options=0 */
+  if(param_ptr==0){
+    param_ptr = OPTIONS_END;
+    flag_options = 1;
+  }
+  else if(param_ptr==param_ptr_start[func_a]){
+    param_ptr = 0;
+    return 1;
+  }
+  else{
+    param_ptr--;
+  }
+  break;
+
+case 9:     /* Ch A Only, ccw, flag_options=1 */
+  if(param_ptr==OPTIONS_START){
+    param_ptr = param_ptr_end[func_a];
+    flag_options = 0;
+  }
+  else{
+    param_ptr--;
+    if(param_ptr==OPTIONS_START){
+      return 1;
+    }
+  }
+  break;
+
+case 10:    /* Ch A Only, cw, flag_options=0 */
+  if(param_ptr==0){
+    param_ptr = param_ptr_start[func_a];
+  }
+  else if(param_ptr==param_ptr_end[func_a]){
+    param_ptr = OPTIONS_START;
+    flag_options = 1;
+    return 1;
+  }
+  else{
+    param_ptr++;
+  }
+  break;
+
+case 11:    /* Ch A Only, cw, flag_options=1 */
+  if(param_ptr==OPTIONS_END){
+    param_ptr = 0;
+    flag_options = 0;
+    return 1;
+  }
+  else{
+    param_ptr++;
+  }
+  break;
+
+default:
+  break;
+}   /* end switch */
+
+return 0;
+}
+
+
+/**************************************************************************
+ * inc_dec_mod (fix: posible shorter to use: "*ptr = ++(*ptr) % mod" for mod)
+ * Increment/Decrement modulo mod based on cw
+ **************************************************************************/
+void inc_dec_mod(int *ptr, int mod)
+{
+if(mod){
+  if(cw){
+    ++(*ptr);
+    if((*ptr)>=mod) *ptr = 0;
+  }
+  else{
+    --(*ptr);
+    if((*ptr)<0) *ptr = mod - 1;
+  }
+}
+else{
+  *ptr = 0;     /* if mod==0, return 0 */
+}
+}
+
+
+/**************************************************************************
+ * add_sub
+ * Add/Subtract 10^pow to long based on cw (where: 0<=pow<=9)
+ **************************************************************************/
+void add_sub_pow(long *ptr, int pow)
+{
+long delta;
+
+switch(pow){
+case 0:
+  delta = 1;
+  break;
+case 1:
+  delta = 10;
+  break;
+case 2:
+  delta = 100;
+  break;
+case 3:
+  delta = 1000;
+  break;
+case 4:
+  delta = 10000;
+  break;
+case 5:
+  delta = 100000;
+  break;
+case 6:
+  delta = 1000000;
+  break;
+case 7:
+  delta = 10000000;
+  break;
+case 8:
+  delta = 100000000;
+  break;
+case 9:
+  delta = 1000000000;
+  break;
+default:
+  delta = 1;
+  break;
+}
+
+if(cw){
+  (*ptr) += delta;
+}
+  else{
+  (*ptr) -= delta;
+}
+
+if((*ptr)>max_value){
+  (*ptr) = max_value;
+}
+
+if((*ptr)<min_value){
+  (*ptr) = min_value;
+}
+
+}
+
+
+/**************************************************************************
+ * freq_param
+ * Returns 1 if param_struct[ptr] is a frequency (its text ends in "Hz").
+ *
+ **************************************************************************/
+int freq_param(int ptr)
+{
+return (param_struct[ptr].text[14]=='H')&&(param_struct[ptr].text[15]=='z');
+}
+
+
+/**************************************************************************
+ * knob_step
+ * Called from the main loop with the steps the delta interrupt counted in
+ * knob_steps during a fast spin (the float math is kept out of the
+ * interrupt). Multiplies the frequency by 2^(knob_steps/12), changes it
+ * by at least 1, limits it to min_value and max_value and displays it.
+ * The main loop computes the filter once the knob settles (knob_spin).
+ *
+ **************************************************************************/
+void knob_step(void)
+{
+long ltemp, *ptr;
+float ratio;
+int n;
+
+n = knob_steps;
+ratio = exp((float)n*0.05776227);   /* 2^(n/12) */
+
+portfff5 &= ~0x0200;    /* suspend delta interupts (they change knob_steps and the value) */
+knob_steps -= n;
+if((spin_ptr==param_ptr)&&(spin_ab==index_ab)&&(cursor_pos!=1)){  /* (else dropped: the knob moved on) */
+  ptr = &params[spin_ptr][spin_ab];
+  ltemp = (long)((float)(*ptr)*ratio + 0.5);
+  if((n>0)&&(ltemp<=(*ptr))){
+    ltemp = (*ptr) + 1;
+  }
+  if((n<0)&&(ltemp>=(*ptr))){
+    ltemp = (*ptr) - 1;
+  }
+  if(ltemp>max_value){
+    ltemp = max_value;
+  }
+  if(ltemp<min_value){
+    ltemp = min_value;
+  }
+  (*ptr) = ltemp;
+  update_disp_right(cursor_pos);    /* write parameter value to LCD right */
+}
+portfff5 |= 0x0200;     /* re-enable delta interupts */
+}
+
+
+/**************************************************************************
+ * update_dsp
+ * This function updates the DSP's function to reflect current parameter
+ * values.
+ *
+ **************************************************************************/
+void update_dsp(int param_ptr_tmp, int index_ab_tmp)
+{
+long ltemp;
+int itemp, iorder, cursor_temp;
+float f1, f2, fcenter, fwidth, ftemp;
+
+/* Update the DSP's function: */
+switch(param_ptr_tmp){
+case 0: /* FUNC: */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  gain(index_ab_tmp);   /* Calculate setting of gain constant and output attenuator based on current func and index_ab_tmp */
+  update_dsp(param_ptr_start[(int)params[0][index_ab_tmp]],index_ab_tmp);   /* Initialize the current function with recursive call */
+  break;
+
+case 1: /* Levels:In Out */
+  assembly_flag |= 1;   /* flag the VU Meter to turn on */
+  break;
+
+case 2: /* RevertToLevels: */
+  auto_vu_count = (int)params[2][0];    /* restart counter; set to 0 or 1 depending on RevertToLevels */
+  break;
+
+case 3: /* FullScalIn: */
+  min_value = 1;    /* set min and max value to bound paramter */
+  max_value = max_in_level;
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  set_all_gains();      /* set optimal CODEC gains and attenuations */
+  break;
+
+case 4: /* SampleRate: */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  set_fsample();        /* set CODEC sampling rate */
+  init_freq_params();   /* pull up factory default frequencies */
+  /* no "break;"           fall into case 6: below to init functions: */
+
+case 6: /* Mode: */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  /* Set the current function: */
+  if(params[6][0]==0){  /* Mode:A&B Common */
+    gain(2);    /* Calculate setting of gain constants and output attenuator based on current func */
+    update_dsp(param_ptr_start[(int)params[0][2]],2);   /* Initialize the current function with recursive call */
+  }
+  else if(params[6][0]==1){ /* Mode:A&B Separate */
+    if(params[17][0] > 128) params[17][0] = 127;    /* reset filter order to default if greater that 128 */
+    if(params[20][0] > 128) params[20][0] = 127;
+    if(params[26][0] > 128) params[26][0] = 127;
+    if(params[32][0] > 128) params[32][0] = 127;
+    if(params[40][0] > 128) params[40][0] = 127;
+    gain(0);    /* Calculate setting of gain constant and output attenuator based on current func */
+    update_dsp(param_ptr_start[(int)params[0][0]],0);   /* Initialize the current function with recursive call */
+    gain(1);    /* Calculate setting of gain constant and output attenuator based on current func */
+    update_dsp(param_ptr_start[(int)params[0][1]],1);   /* Initialize the current function with recursive call */
+  }
+  else{                 /* Mode:Ch A Only */
+    func_addr_b = (unsigned)&no_func_b; /* set Ch B to no_func so Ch A can run long filter */
+    gain(0);    /* Calculate setting of gain constant and output attenuator based on current func */
+    update_dsp(param_ptr_start[(int)params[0][0]],0);   /* Initialize the current function with recursive call */
+  }
+  break;
+
+case 5: /* InputSrc: */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  assembly_flag = (int)params[5][0] ? (assembly_flag|8):(assembly_flag&(~8));   /* set/clear the white noise flag for assembly code */
+  break;
+
+case 7: /* Cascade Ch A&B */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  assembly_flag = (int)params[7][0] ? (assembly_flag|4):(assembly_flag&(~4));   /* set/clear the cascade flag for assembly code */
+  break;
+
+case 8: /* Master Mode */
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+
+  break;
+
+case 9: /* Erase Mem: */
+  if(params_changed_copy==3){
+    initialize();   /* initialize DSP hardware */
+    defer(store_all_task, 500000);  /* display "FUNC:AllPass", then store to all locations */
+  }
+  break;
+
+case 10:    /* Store: */
+  store();  /* store settings if params_changed_copy==3 */
+  break;
+
+case 11:    /* Recall: */
+  recall(); /* recall settings if params_changed_copy==3 */
+  break;
+
+case 12:    /* Firmware:  V */
+/*  portfff5 &= ~0x0200;    /* suspend delta interupts while updating display */
+/*  if(params_changed_copy==1){ */
+    disp_num(VERSION, 13, 4, 2);
+    disp_text("", 1, 0);    /* position cursor home */
+/*  }
+  else if(params_changed_copy==2){
+    disp_text("", 13, 0);   /* position cursor to 13 */
+/*  } *
+/*  portfff5 |= 0x0200;     /* re-enable delta interupts */
+  break;
+
+case 13:    /* Serial No: */
+/*  portfff5 &= ~0x0200;    /* suspend delta interupts while updating display */
+/*  if(params_changed_copy==1){ */
+    disp_num(serial_number, 11, 6, 0);
+    disp_text("", 1, 0);    /* position cursor home */
+/*  }
+  else if(params_changed_copy==2){
+    disp_text("", 11, 0);   /* position cursor to 11 */
+/*  } */
+/*  portfff5 |= 0x0200;     /* re-enable delta interupts */
+  break;
+
+case 14:    /* NFgain: */
+  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
+  max_value = GAIN_MAX;
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  gain(index_ab_tmp);
+  /* Set function address to no function: */
+  itemp = index_ab_tmp + 1; /* itemp: 1-A, 2-B, 3-Common */
+  if(itemp&1){
+    func_addr_a = (unsigned)&no_func_a; /* set no function */
+  }
+  if(itemp&2){
+    func_addr_b = (unsigned)&no_func_b; /* set no function */
+  }
+  break;
+case 15:    /* APgain: */
+  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
+  max_value = GAIN_MAX;
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  gain(index_ab_tmp);
+  /* Set function address to allpass: */
+  itemp = index_ab_tmp + 1; /* itemp: 1-A, 2-B, 3-Common */
+  if(itemp&1){
+    func_addr_a = (unsigned)&allpass_func_a; /* send input to output */
+  }
+  if(itemp&2){
+    func_addr_b = (unsigned)&allpass_func_b; /* send input to output */
+  }
+  break;
+
+case 18:    /* LPgain: */
+case 21:    /* HPgain: */
+case 27:    /* BPgain: */
+case 33:    /* BSgain: */
+case 36:    /* Ngain: */
+case 39:    /* INgain: */
+case 42:    /* UFgain: */
+case 45:    /* Samp: */
+  min_value = -GAIN_MAX;    /* set min and max value to bound paramter */
+  max_value = GAIN_MAX;
+  if(params_changed_copy==1) break; /* update only min_value and max_value */
+  gain(index_ab_tmp);
+  break;
+
+case 17:    /* LPorder: */
+case 20:    /* HPorder: */
+  min_value = (long)(3);    /* set min and max value to bound paramter */
+  if(params[6][0]==2){      /* if Ch A Only */
+    max_value = (long)(256);    /* allow long filters on Ch A */
+  }
+  else{
+    max_value = (long)(128);  
+  }
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current fcut */
+  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
+  goto compute_filt;
+
+case 26:    /* BPorder: */
+case 32:    /* BSorder: */
+  min_value = (long)(3);    /* set min and max value to bound paramter */
+  if(params[6][0]==2){      /* if Ch A Only */
+    max_value = (long)(256);    /* allow long filters on Ch A */
+  }
+  else{
+    max_value = (long)(128);  
+  }
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp-4][index_ab_tmp];    /* get current f1 */
+  f2 = (float)params[param_ptr_tmp-3][index_ab_tmp];    /* get current f2 */
+  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
+  goto compute_filt;
+
+case 16:    /* LPfcut: */
+case 19:    /* HPfcut: */
+  min_value = (long)(FCUT_MIN*fsample); /* set min and max value to bound paramter */
+  max_value = (long)(FCUT_MAX*fsample);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current fcut */
+  iorder = (int)params[param_ptr_tmp+1][index_ab_tmp];  /* get current order */
+  goto compute_filt;
+
+case 22:    /* BPf1: */
+case 28:    /* BSf1: */
+  min_value = (long)(F1_MIN*fsample);   /* set min and max value to bound paramter */
+  max_value = (long)(F1_MAX*fsample);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current f1 */
+  f2 = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get current f2 */
+  if((f2-f1)<FWIDTH_MIN*fsample){   /* "push" f2 up to maintain minimum width */
+    f2 = f1 + FWIDTH_MIN*fsample;
+    params[param_ptr_tmp+1][index_ab_tmp] = (long)f2;   /* save modified f2 */
+  }
+  params[param_ptr_tmp+2][index_ab_tmp] = (long)((f1+f2)/2.0);  /* save updated fcenter */
+  params[param_ptr_tmp+3][index_ab_tmp] = (long)(f2-f1);        /* save updated fwidth */
+  iorder = (int)params[param_ptr_tmp+4][index_ab_tmp];  /* get current order */
+  goto compute_filt;
+
+case 23:    /* BPf2: */
+case 29:    /* BSf2: */
+  min_value = (long)(F2_MIN*fsample);   /* set min and max value to bound paramter */
+  max_value = (long)(F2_MAX*fsample);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current f1 */
+  f2 = (float)params[param_ptr_tmp][index_ab_tmp];  /* get current f2 */
+  if((f2-f1)<FWIDTH_MIN*fsample){   /* "push" f1 down to maintain minimum width */
+    f1 = f2 - FWIDTH_MIN*fsample;
+    params[param_ptr_tmp-1][index_ab_tmp] = (long)f1;   /* save modified f1 */
+  }
+  params[param_ptr_tmp+1][index_ab_tmp] = (long)((f1+f2)/2.0);  /* save updated fcenter */
+  params[param_ptr_tmp+2][index_ab_tmp] = (long)(f2-f1);        /* save updated fwidth */
+  iorder = (int)params[param_ptr_tmp+3][index_ab_tmp];  /* get current order */
+  goto compute_filt;
+
+case 24:    /* BPfcntr: */
+case 30:    /* BSfcntr: */
+  fwidth = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get fwidth */
+  min_value = (long)((F1_MIN*fsample + fwidth/2.0) + 0.5);  /* set min and max value to bound paramter */
+  max_value = (long)((F2_MAX*fsample - fwidth/2.0) + 0.5);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  fcenter = (float)params[param_ptr_tmp][index_ab_tmp]; /* get fcenter */
+  ftemp = fwidth/2.0;
+  f1 = fcenter - ftemp;
+  f2 = fcenter + ftemp;
+/*    if(f1<F1_MIN*fsample){    /* set f1 to minimum */
+/*      f1 = F1_MIN*fsample;
+    }
+    if(f2>F2_MAX*fsample){  /* set f2 to maxmum */
+/*      f2 = F2_MAX*fsample;
+    } */
+  params[param_ptr_tmp-2][index_ab_tmp] = (long)f1;     /* save modified f1 */
+  params[param_ptr_tmp-1][index_ab_tmp] = (long)f2;     /* save modified f2 */
+  params[param_ptr_tmp+1][index_ab_tmp] = (long)(f2 - f1);  /* save modified fwidth */
+  iorder = (int)params[param_ptr_tmp+2][index_ab_tmp];  /* get current order */
+  goto compute_filt;
+
+case 25:    /* BPfwdth: */
+case 31:    /* BSfwdth: */
+  min_value = (long)(FWIDTH_MIN*fsample);   /* set min and max value to bound paramter */
+  max_value = (long)((F2_MAX - F1_MIN)*fsample + 0.5);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  fcenter = (float)params[param_ptr_tmp-1][index_ab_tmp];   /* get fcenter */
+  fwidth = (float)params[param_ptr_tmp][index_ab_tmp];      /* get fwidth */
+  ftemp = fwidth/2.0;                                          
+  f1 = fcenter - ftemp;
+  f2 = fcenter + ftemp;
+  if(f1<F1_MIN*fsample){    /* set f1 to minimum */
+    f1 = F1_MIN*fsample;
+    f2 = f1 + fwidth;
+  }
+  if(F2_MAX*fsample<f2){    /* set f2 to maxmum */
+    f2 = F2_MAX*fsample;
+    f1 = f2 - fwidth;
+  }
+  params[param_ptr_tmp-3][index_ab_tmp] = (long)f1;     /* save modified f1 */
+  params[param_ptr_tmp-2][index_ab_tmp] = (long)f2;     /* save modified f2 */
+  params[param_ptr_tmp-1][index_ab_tmp] = (long)((f1 + f2)/2.0);    /* save modified fcenter */
+  iorder = (int)params[param_ptr_tmp+1][index_ab_tmp];  /* get current order */
+ compute_filt:
+  compute_fir(f1, f2, iorder, index_ab_tmp);    /* Compute and load FIR filter coefficients for LP, HP, BP or BS */
+  break;
+
+case 34:    /* Nfnotch: */
+case 37:    /* INfcntr: */
+  min_value = (long)(FNFNOTCH_MIN*fsample); /* set min and max value to bound paramter */
+  max_value = (long)(FNFNOTCH_MAX*fsample);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp][index_ab_tmp];      /* get current fnotch */
+  f2 = (float)params[param_ptr_tmp+1][index_ab_tmp];    /* get current fwdth */
+  goto compute_n;
+  
+case 35:    /* Nfwidth: */
+case 38:    /* INfwdth: */
+  min_value = (long)(FNFWIDTH_MIN*fsample); /* set min and max value to bound paramter */
+  max_value = (long)(FNFWIDTH_MAX*fsample);
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  f1 = (float)params[param_ptr_tmp-1][index_ab_tmp];    /* get current fnotch */
+  f2 = (float)params[param_ptr_tmp][index_ab_tmp];      /* get current fwdth */
+ compute_n:
+  compute_notch(f1, f2, index_ab_tmp);  /* compute and load notch coefficients */
+  break;
+
+case 40:    /* UForder: */
+  min_value = (long)(3);    /* set min and max value to bound parameter */
+  if(params[6][0]==2){      /* if Ch A Only */
+    max_value = (long)(256);    /* allow long filters on Ch A */
+  }
+  else{
+    max_value = (long)(128);  
+  }
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  params[param_ptr_tmp+1][index_ab_tmp] = 1L;   /* set coef. poiner to 1 when changing order */
+  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
+  goto load_user;
+
+case 41:    /* UFtap: */
+  iorder = (int)params[param_ptr_tmp-1][index_ab_tmp];  /* get current order */
+  min_value = 1L;   /* set min and max value to bound paramter */
+  max_value = (long)iorder; /* limmit max to current order */
+
+  cursor_temp = cursor_pos;                 /* save cursor position */
+
+  itemp = (int)params[param_ptr_tmp][index_ab_tmp] - 1; /* get current coef. tap index */
+  ltemp = params[NPARAMSTRUCT + (itemp>>1)][index_ab_tmp];      /* get pair of coefs */
+  if(itemp&1){
+    disp_num((long)(ltemp>>16), 11, 6, 0);  /* disp odd (1,3,...) coefs */
+  }
+  else{
+    disp_num((long)((int)(ltemp&0x0000ffff)), 11, 6, 0);    /* disp even (0,2,...) coefs */
+  }
+
+  disp_text("", cursor_temp, 0);    /* put cursor back */
+
+  if(params_changed_copy==1) return;    /* update only min_value and max_value */
+  
+ load_user:  
+  load_userfir(iorder, index_ab_tmp);   /* Load User FIR filter coefficients */
+  break;
+
+default:
+  break;
+}   /* end switch(param_ptr_tmp) */
+    
+}
+
+
+/**************************************************************************
+ * compute_fir
+ * This function computes and loads FIR coefficients for LP, HP, BP and BS
+ * filters based on the currently selected function in params[0][index_ab_tmp].
+ *
+ **************************************************************************/
+void compute_fir(float f1, float f2, int iorder, int index_ab_tmp)
+{
+int i, itemp, max_flag, iorderm1, iorderm1d2, iorderd2;
+float ftemp1, ftemp2, d2fsf1, d2fsf2, coef_max;
+float coefs[128];
+
+iorderm1 = iorder-1;
+iorderm1d2 = iorderm1>>1;
+iorderd2 = iorder>>1;
+
+/* Compute modified-Blackman-window (coefs are from filt.m 'aopt'), if nessesary: */
+if(iorder!=iorder_old){
+  ftemp1 = (float)(iorder-1);
+  for(i=0;i<=iorderm1d2;i++){   /* loop over half of the window (including center if odd) */
+    ftemp2 = (PIT2*(float)(i))/ftemp1;
+    window[i] = 0.48216433063585 - 0.48550251793519*cos(ftemp2) + 0.03233315142896*cos(2*ftemp2);
+  }
+  iorder_old = iorder;
+}
+
+/* Compute FIR filter coefficients: */
+ftemp1 = 2.0/fsample;   /* compute some temp vars once */
+d2fsf1 = ftemp1*f1;
+d2fsf2 = ftemp1*f2;
+switch((int)params[0][index_ab_tmp]){   /* switch on index of currently selected function */
+case 2: /* LowPass */
+  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
+    if(newer_value()) return;   /* a newer encoder value arrived: abandon (main() recomputes with it) */
+    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);   /* fix: can speed up by avoiding /2.0 */
+    coefs[i] = window[i]*sin(d2fsf1*ftemp1)/ftemp1;
+  }
+  if(iorder&1){     /* if iorder odd, compute center coef[] */
+    coefs[i] = window[i]*d2fsf1;    /* update center coef */
+  }
+  break;
+    
+case 3: /* HighPass */
+  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
+    if(newer_value()) return;
+    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
+    coefs[i] = window[i]*(sin(ftemp1) - sin(d2fsf1*ftemp1))/ftemp1;
+  }
+  if(iorder&1){     /* if iorder odd, compute center coef[] */
+    coefs[i] = window[i]*(1.0 - d2fsf1);    /* update center coef for HP filter */
+  }
+  break;
+    
+case 4: /* BandPass */
+  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
+    if(newer_value()) return;
+    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
+    coefs[i] = window[i]*(sin(d2fsf2*ftemp1) - sin(d2fsf1*ftemp1))/ftemp1;
+  }
+  if(iorder&1){     /* if iorder odd, compute center coef[] */
+    coefs[i] = window[i]*(d2fsf2 - d2fsf1); /* update center coef for BP filter */
+  }
+  break;
+    
+case 5: /* BandStop */
+  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
+    if(newer_value()) return;
+    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
+    coefs[i] = window[i]*(sin(ftemp1) + sin(d2fsf1*ftemp1) - sin(d2fsf2*ftemp1))/ftemp1;
+  }
+  if(iorder&1){     /* if iorder odd, compute center coef[] */
+    coefs[i] = window[i]*(1.0 + d2fsf1 - d2fsf2);   /* update center coef for BS filter */
+  }
+  break;
+
+default:
+  break;
+}   /* end switch */
+
+/* Determine quantization scale factor: */
+coef_max = coefs[iorderm1d2];   /* get center coef (maximum coef) */
+max_flag = (0.4999<coef_max);   /* store coef_max>0.4999 flag */
+ftemp1 = max_flag ? 32768.0:65536.0;    /* save quantization scale factor */
+
+if(live_flag){
+  fir_live(coefs, iorder, index_ab_tmp);  /* load coefs. while the filter runs */
+  return;
+}
+
+/* Load the scale, quantize, and load filter coefs: */
+out_gain |= 0x0400;     /* mute the outputs */
+
+
+itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
+if(itemp&1){
+  func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the fir_coef[] */
+  data_ptr_a = 0x03ff - iorderm1;   /* point to first used Ch A filter state data (in B1: 300h-3ffh) */
+  orderm2_a = iorderm1-1;               /* load assembly language constant */
+  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+  for(i=0;i<=iorderm1d2;i++){
+    fir_coef[i] = fir_coef[iorderm1-i] = (int)(ftemp1*coefs[i] + 0.5);  /* write coefs to first and second half of filter A locations */
+  }
+  asm(" setc    CNF     ; map internal memory block B0 into Program space");
+  func_addr_a = (unsigned)(max_flag ? &fir_15_a:&fir_16_a); /* set function A */
+}
+
+if(itemp&2){
+  func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the fir_coef[] */
+  data_ptr_b = 0x037f - iorderm1;   /* point to first used Ch B filter state data (in B1: 300h-37fh) */
+  orderm2_b = iorderm1-1;               /* load assembly language constant */
+  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+  for(i=0;i<=iorderm1d2;i++){
+    fir_coef[i+128] = fir_coef[iorderm1+128-i] = (int)(ftemp1*coefs[i] + 0.5);  /* write coefs to first and second half of filter A locations */
+  }
+  asm(" setc    CNF     ; map internal memory block B0 into Program space");
+  func_addr_b = (unsigned)(max_flag ? &fir_15_b:&fir_16_b); /* set function B */
+}
+
+
+wait_n_samples(iorder); /* wait for ~order sampling intervals for transient to propagate */
+out_gain &= ~0x0400;        /* un-mute the outputs */
+
+}
+
+
+/**************************************************************************
+ * fir_live
+ * Loads the FIR coefs. from compute_fir() while the filter keeps running
+ * (live_flag, see morph_update()). The ISR reads fir_coef[] from program
+ * space, so the coefs. are written MORPH_CHUNK pairs at a time with the
+ * interrupts off (B0 is back in program space before the next sample).
+ * The scale of the running function is always kept: a scale change would
+ * need all coefs. and the function at once. With fir_16_x a tap of 0.5
+ * or more is clipped and the bank is flagged in morph_clip, so that
+ * morph_finish() loads it with fir_15_x.
+ *
+ **************************************************************************/
+void fir_live(float *coefs, int iorder, int index_ab_tmp)
+{
+int i, j, itemp, iorderm1, iorderm1d2, base, run_15;
+float ftemp, fcoef;
+
+iorderm1 = iorder-1;
+iorderm1d2 = iorderm1>>1;
+
+itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
+if(itemp&1){
+  run_15 = (func_addr_a==(unsigned)&fir_15_a);
+}
+else{
+  run_15 = (func_addr_b==(unsigned)&fir_15_b);
+}
+ftemp = run_15 ? 32768.0:65536.0;   /* quantization scale factor of the running function */
+for(i=0;i<=iorderm1d2;i++){
+  fcoef = ftemp*coefs[i] + 0.5;
+  if(fcoef>32767.0){        /* (only with fir_16_x) */
+    fcoef = 32767.0;
+    morph_clip |= 1<<index_ab_tmp;
+  }
+  if(fcoef<-32768.0){
+    fcoef = -32768.0;
+    morph_clip |= 1<<index_ab_tmp;
+  }
+  live_coefs[i] = (int)fcoef;
+}
+
+for(base=0;base<=128;base+=128){    /* filter A, then filter B locations */
+  if(!(itemp&(base ? 2:1))) continue;
+  i = 0;
+  while(i<=iorderm1d2){
+    asm(" setc    INTM    ; no sample interrupt while B0 is in Data space");
+    asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+    for(j=0;(j<MORPH_CHUNK)&&(i<=iorderm1d2);j++,i++){
+      fir_coef[base+i] = fir_coef[base+iorderm1-i] = live_coefs[i];
+    }
+    asm(" setc    CNF     ; map internal memory block B0 into Program space");
+    asm(" clrc    INTM    ; enable interrupts");
+  }
+}
+}
+
+
+/**************************************************************************
+ * load_userfir
+ * This function computes and loads FIR coefficients for user specifed
+ * filters based on the currently selected function in params[0][index_ab_tmp].
+ *
+ **************************************************************************/
+void load_userfir(int iorder, int index_ab_tmp)
+{
+int i, j, itemp, iorderm1, iorderm1d2;
+long ltemp;
+
+iorderm1 = iorder-1;
+iorderm1d2 = iorderm1>>1;
+
+out_gain |= 0x0400;     /* mute the outputs */
+  
+itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
+if(itemp&1){
+  func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the fir_coef[] */
+  data_ptr_a = 0x03ff - iorderm1;   /* point to first used Ch A filter state data (in B1: 300h-3ffh) */
+  orderm2_a = iorderm1-1;               /* load assembly language constant */
+  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+  j = 0;    /* starting position for filter A */
+  for(i=0;i<=iorderm1d2;i++){
+    ltemp = params[NPARAMSTRUCT + i][index_ab_tmp]; /* get pair of coefs */
+    fir_coef[j++] = (int)(ltemp&0x0000ffff);        /* write even coefs to filter A locations */
+    fir_coef[j++] = (int)(((unsigned long)ltemp)>>16);  /* write odd coefs to filter A locations */
+  }
+  asm(" setc    CNF     ; map internal memory block B0 into Program space");
+  func_addr_a = (unsigned)&fir_15_a; /* set function A */
+}
+
+if(itemp&2){
+  func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the fir_coef[] */
+  data_ptr_b = 0x037f - iorderm1;   /* point to first used Ch B filter state data (in B1: 300h-37fh) */
+  orderm2_b = iorderm1-1;               /* load assembly language constant */
+  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+  j = 128;  /* starting position for filter B */
+  for(i=0;i<=iorderm1d2;i++){
+    ltemp = params[NPARAMSTRUCT + i][index_ab_tmp]; /* get pair of coefs */
+    fir_coef[j++] = (int)(ltemp&0x0000ffff);        /* write even coefs to filter A locations */
+    fir_coef[j++] = (int)(((unsigned long)ltemp)>>16);  /* write odd coefs to filter A locations */
+  }
+  asm(" setc    CNF     ; map internal memory block B0 into Program space");
+  func_addr_b = (unsigned)&fir_15_b; /* set function B */
+}
+
+wait_n_samples(iorder); /* wait for ~order sampling intervals for transient to propagate */
+out_gain &= ~0x0400;        /* un-mute the outputs */
+
+}
+
+
+/**************************************************************************
+ * compute_notch
+ * This function computes and loads IIR coefficients for the Notch and Inverse Notch
+ * filters based on the currently selected function in params[0][index_ab_tmp].
+ *
+ **************************************************************************/
+void compute_notch(float fn, float fw, int index_ab_tmp)
+{
+int* iptr;
+int itemp;
+unsigned coef_temp;
+float t1, t2, t3, k1, k2, c1, c2, d1, d2, g1, g2;
+
+/* k1 = -cos(2*PI*fn/fsample);  /* compute k1 from fnotch */
+k1 = -sin(2*PI*fn/fsample + PID2);  /* compute k1 from fnotch (use sin() to save memory) */
+t1 = PI*fw/fsample;
+/* t2 = cos(t1); */
+t2 = sin(t1 + PID2);
+t3 = sin(t1);
+k2 = (t2-t3)/(t2+t3);       /* compute k2 from fwidth */
+/* c1 = sqrt(1.0 - k1*k1);      /* compute normalization c1 */
+/* c2 = sqrt(1.0 - k2*k2);      /* compute normalization c2 */
+
+/* c1 = .5930;
+c2 = .0196;
+d1 = (1.0 - k1*k1)/c1;
+d2 = (1.0 - k2*k2)/c2; */
+
+d1 = -1;
+d2 = -1;
+c1 = (1.0 - k1*k1)/d1;
+c2 = (1.0 - k2*k2)/d2;
+
+/* Compute ideal notch filter coefficients: */
+switch((int)params[0][index_ab_tmp]){   /* switch on index of currently selected function */
+case 6: /* Notch */
+  /* gain params (g1 and g2) must be in range [-4,4) */
+  g1 = 0.5;
+  g2 = 0.0;
+  break;
+  
+case 7: /* Inverse Notch */
+  /* gain params (g1 and g2) must be in range [-4,4) */
+  g1 = 0.0;
+  g2 = 0.5;
+  break;
+
+default:
+  break;
+}   /* end switch */
+
+
+/* Load quantized coefs: */
+if(!live_flag){
+  out_gain |= 0x0400;     /* mute the outputs */
+}
+
+/* With live_flag the filter keeps running: the coefs. are written to the
+   other of two coef. sets, then coef_ptr_x is switched between two samples: */
+itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
+if(itemp&1){
+  if(live_flag){
+    coef_temp = (coef_ptr_a==0x0380) ? 0x038a:0x0380;
+  }
+  else{
+    func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the coefdata[] */
+    coef_temp = 0x0380;
+  }
+  data_ptr_a = 0x03ff;  /* point to first used Ch A filter state data */
+  /* Write coefs to filter A locations: */
+  iptr = (int*)&coefdata[coef_temp - 0x0300];   /* get address of first coef to write */
+  *iptr++ = (int)(32768*c2 + 0.5);  /* c2 */
+  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 */
+  *iptr++ = (int)(32768*d2 + 0.5);  /* d2 */
+  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 (copy) */
+  *iptr++ = (int)(32768*c1 + 0.5);  /* c1 */
+  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 */
+  *iptr++ = (int)(32768*d1 + 0.5);  /* d1 */
+  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 (copy) */
+  *iptr++ = (int)(8192*g1 + 0.5);   /* g1 */
+  *iptr++ = (int)(8192*g2 + 0.5);   /* g2 */
+  coef_ptr_a = coef_temp;
+  func_addr_a = (unsigned)&notch_a; /* set function A */
+}
+
+if(itemp&2){
+  if(live_flag){
+    coef_temp = (coef_ptr_b==0x0300) ? 0x030a:0x0300;
+  }
+  else{
+    func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the coefdata[] */
+    coef_temp = 0x0300;
+  }
+  data_ptr_b = 0x037f;  /* point to first used Ch B filter state data */
+  /* Write coefs to filter B locations: */
+  iptr = (int*)&coefdata[coef_temp - 0x0300];   /* get address of first coef to write */
+  *iptr++ = (int)(32768*c2 + 0.5);  /* c2 */
+  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 */
+  *iptr++ = (int)(32768*d2 + 0.5);  /* d2 */
+  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 (copy) */
+  *iptr++ = (int)(32768*c1 + 0.5);  /* c1 */
+  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 */
+  *iptr++ = (int)(32768*d1 + 0.5);  /* d1 */
+  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 (copy) */
+  *iptr++ = (int)(8192*g1 + 0.5);   /* g1 */
+  *iptr++ = (int)(8192*g2 + 0.5);   /* g2 */
+  coef_ptr_b = coef_temp;
+  func_addr_b = (unsigned)&notch_b; /* set function B */
+}
+  
+/* wait_n_samples(???);     /* fix: wait for ??? sampling intervals for transient to propagate */
+if(!live_flag){
+  out_gain &= ~0x0400;        /* un-mute the outputs */
+}
+
+}
+
+
+/**************************************************************************
+ * set_all_gains
+ * Sets all optimal CODEC gains and attenuations for the current function.
+ *
+ **************************************************************************/
+void set_all_gains(void)
+{
+float cl, ftemp;
+
+/* Compute the optimal input gain for the CODEC and the scale factor for the VU Meters: */                  
+/* Channel A: */
+cl = (float)params[3][0];   /* get FullScalIn value */
+for(gopt_a=1;gopt_a<16;gopt_a++){
+  ftemp = (16.0*in_cal_levels[gopt_a]*cl)/max_in_level; /* calulate eqs. 8 & 9 in Gain cal. notes */
+  if(2.0<=ftemp){
+    break;  /* break out of for loop */
+  }
+}
+gopt_a--;
+out_gain = (out_gain&(~0x000f))|gopt_a;     /* update the CODEC gain A */
+scale_k_a = max_in_level/(8.0*in_cal_levels[gopt_a]*cl);    /* compute VU Meter scale factor */
+
+/* Channel B: */
+/* cl = (float)params[3][0];    /* get FullScalIn value */
+for(gopt_b=1;gopt_b<16;gopt_b++){
+  ftemp = (16.0*in_cal_levels[gopt_b]*cl)/max_in_level; /* calulate eqs. 8 & 9 in Gain cal. notes */
+  if(2.0<=ftemp){
+    break;  /* break out of for loop */
+  }
+}
+gopt_b--;
+out_gain = (out_gain&(~0x00f0))|(gopt_b<<4);        /* update the CODEC gain B */
+scale_k_b = max_in_level/(8.0*in_cal_levels[gopt_b]*cl);    /* compute VU Meter scale factor */
+
+/* Set the gains for Ch A and Ch B: */
+if(params[6][0]){   /* Mode:A&B Separate or Mode: Ch A Only */
+  gain(0);  /* Calculate setting of gain constant and output attenuator for Ch A */
+  gain(1);  /* Calculate setting of gain constant and output attenuator for Ch B */
+}
+else{   /* Mode:A&B Common */
+  gain(2);  /* Calculate setting of gain constant and output attenuator for Ch A and B */
+}
+
+}
+
+
+/**************************************************************************
+ * gain
+ * Calculate setting of gain constant and output attenuator setting based
+ * on the current function setting and index_ab_tmp.
+ *
+ **************************************************************************/
+void gain(int index_ab_tmp)
+{
+int itemp;
+float tgain, tlin, ftemp;
+
+/* set gain fixfix: if 256*ftemp > 32767 we must limit max_value*/
+tgain = 0.01*(float)params[param_ptr_end[(int)params[0][index_ab_tmp]]][index_ab_tmp];  /* get gain parameter for the current func */
+
+itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
+/* Set gain for Ch A, Ch B or both: */
+if(itemp&1){
+  tlin = 16.0*in_cal_levels[gopt_a]/max_in_level;   /* compute Lin(gopt_a) for calulation below */
+  ftemp = tgain/(tlin*scale_k_a);   /* calulate eq. 13 in Gain cal. notes */
+  for(aopt_a=1;aopt_a<32;aopt_a++){
+    if(out_cal[aopt_a]<=fabs(ftemp)){
+      break;    /* break out of for loop */
+    }
+  }
+  aopt_a--;
+  out_atten = (out_atten&(~0x01f0))|(aopt_a<<4);    /* update the CODEC attenuation A */
+  ftemp = tgain/(out_cal[aopt_a]*tlin);         /* compute output gain factor */
+  t_reg_scale_a = (int)(256.0*ftemp + 0.5);         /* convert to scaled integer for use in assembly */
+}
+if(itemp&2){
+  tlin = 16.0*in_cal_levels[gopt_b]/max_in_level;   /* compute Lin(gopt_b) for calulation below */
+  ftemp = tgain/(tlin*scale_k_b);   /* calulate eq. 13 in Gain cal. notes */
+  for(aopt_b=1;aopt_b<32;aopt_b++){
+    if(out_cal[aopt_b]<=fabs(ftemp)){
+      break;    /* break out of for loop */
+    }
+  }
+  aopt_b--;
+  out_atten = (out_atten&(~0x3e00))|(aopt_b<<9);    /* update the CODEC attenuation B */
+  ftemp = tgain/(out_cal[aopt_b]*tlin);         /* compute output gain factor */
+  t_reg_scale_b = (int)(256.0*ftemp + 0.5);         /* convert to scaled integer for use in assembly */
+}
+
+/* out_atten = (out_atten&(~0x3ff0))|(aopt_a<<4)|(aopt_b<<9);   /* update the CODEC attenuations */
+
+
+}
+
+
+/**************************************************************************
+ * vu_update
+ * This function updates the VU level meter. This function is called every
+ * 5ms when displaying the VU meters. This fact is used to decay the
+ * levels between the peaks.
+ *
+ **************************************************************************/
+void vu_update(void)
+{
+int temp_pos;
+unsigned vu_temp;
+char carray[3];
+
+carray[2] = 0;
+
+vu_temp = convert_to_vu(scale_k_a, in_a_hold);  /* Compute VU level for in_a */
+if(vu_temp>=in_a_vu_level){ /* get peak level for VU Meter */
+  in_a_vu_level = vu_temp;
+}
+
+vu_temp = convert_to_vu(scale_k_b, in_b_hold);  /* Compute VU level for in_b */
+if(vu_temp>=in_b_vu_level){ /* get peak level for VU Meter */
+  in_b_vu_level = vu_temp;
+}
+
+vu_temp = convert_to_vu(scale_k_a, out_a_hold); /* Compute VU level for out_a */
+if(vu_temp>=out_a_vu_level){    /* get peak level for VU Meter */
+  out_a_vu_level = vu_temp;
+}
+
+vu_temp = convert_to_vu(scale_k_b, out_b_hold); /* Compute VU level for out_b */
+if(vu_temp>=out_b_vu_level){    /* get peak level for VU Meter */
+  out_b_vu_level = vu_temp;
+}
+
+/* Write the VU levels to LCD: */
+temp_pos = cursor_pos;                  /* save cursor position */
+carray[0] = vu_chars[in_a_vu_level];    /* get VU character */
+carray[1] = vu_chars[in_b_vu_level];    /* get VU character */
+disp_text(carray, 10, -1);
+
+carray[0] = vu_chars[out_a_vu_level];   /* get VU character */
+carray[1] = vu_chars[out_b_vu_level];   /* get VU character */
+disp_text(carray, 15, -1);
+
+disp_text("", temp_pos, 0); /* put cursor back */
+
+
+/* Decay all the VU Meters together: */
+if((vu_counter++)>=VU_DECAY){
+  vu_counter = 0;
+  in_a_hold = 0;
+  in_b_hold = 0;
+  out_a_hold = 0;
+  out_b_hold = 0;
+  if(in_a_vu_level>0){
+    in_a_vu_level--;
+  }
+  if(in_b_vu_level>0){
+    in_b_vu_level--;
+  }
+  if(out_a_vu_level>0){
+    out_a_vu_level--;
+  }
+  if(out_b_vu_level>0){
+    out_b_vu_level--;
+  }
+}
+
+}
+
+
+/**************************************************************************
+ * convert_to_vu
+ * This function converts to a log scale for the VU level meter.
+ *
+ **************************************************************************/
+unsigned convert_to_vu(float scale, int signal)
+{
+
+float ftemp;
+int itemp;
+
+ftemp = scale*(float)(signal);  /* fix: + 1.0 scale the peak held value */
+if(32767.0<ftemp){  /*if ftemp>0x7fff then clip */
+  ftemp = 32767.0;
+}
+
+#if(0)  /* 3 dB per division */
+itemp = (int)ftemp;
+if(itemp==32767) return 12;     /* use number larger than 9 to force "X" to hold longer */
+else if(itemp>=23170) return 8; /* -3dB down, 32768*(1/sqrt(2)) */
+else if(itemp>=16384) return 7; /* -6dB down, 32768*(1/sqrt(2*2)) */
+else if(itemp>=11585) return 6; /* -9dB down, 32768*(1/sqrt(2*2*2)) */
+else if(itemp>=8192) return 5;
+else if(itemp>=5793) return 4;
+else if(itemp>=4096) return 3;
+else if(itemp>=2896) return 2;
+else if(itemp>=2048) return 1;
+else return 0;
+
+#else   /* 6 dB per division */
+itemp = (int)ftemp;
+if(itemp==32767) return 12;     /* use number larger than 9 to force "X" to hold longer */
+else if(itemp>=16384) return 8; /* -6dB down, 32768*(1/sqrt(4)) */
+else if(itemp>=8192) return 7;  /* -12dB down, 32768*(1/sqrt(4*4)) */
+else if(itemp>=4096) return 6;  /* -18dB down, 32768*(1/sqrt(4*4*4)) */
+else if(itemp>=2048) return 5;
+else if(itemp>=1024) return 4;
+else if(itemp>=512) return 3;
+else if(itemp>=256) return 2;
+else if(itemp>=128) return 1;
+else return 0;
+
+#endif
+}
+
+
+/**************************************************************************
+ * led_update
+ * This function updates the overload LEDs. This function is called every
+ * 5ms. This fact is used to reset the LEDs after some hold time.
+ *
+ **************************************************************************/
+void led_update(void)
+{
+
+
+/* set overload LEDs to reflect the status of the overload bits: */
+out_atten = ((in_error_stick & 0x0100)>>5)|(out_atten & (~0x0008));
+out_atten = ((in_error_stick & 0x0200)>>7)|(out_atten & (~0x0004));
+/* led_counter = 0; */
+
+if((led_counter++)>=OVERFLOW_STICK){
+  led_counter = 0;
+  in_error_stick = in_error_stick & (~0x0100);  /* unstick overload A bit */
+  in_error_stick = in_error_stick & (~0x0200);  /* unstick overload B bit */
+}
+
+
+}
+
+
+/**************************************************************************
+ * telem_update
+ * Called every 5ms while "telem" is on. Keeps the peak levels and CLIP
+ * bits, and every telem_period calls sends a frame with opcode
+ * BIN_TELEM + BIN_ACK and the payload (2 byte values are MS byte first):
+ *
+ *  peak |in A|, |in B|, |out A|, |out B| since the last frame (2 bytes each)
+ *  CLIP bits (1 - A overload, 2 - B overload)
+ *  CPU headroom in % (time left for the foreground, see idle_spins())
+ *  rx_overruns, rx_framing, rx_full (2 bytes each, see "serstat")
+ *
+ * The "telem" command starts each module in its own slot (group_slot
+ * times one frame time, TELEM_CHARS), so the modules of a rack that got
+ * it together take turns. The period must hold every slot up to ours,
+ * and "telem" fails if "group" has not assigned a slot.
+ * A module does not hear commands while it sends (TX_ECHO), so the host
+ * should send between the rounds of frames.
+ *
+ **************************************************************************/
+void telem_update(void)
+{
+int i;
+unsigned payload[16];
+
+portfff5 &= ~0x0200;    /* suspend delta interupts (vu_update() also uses the holds) */
+if(in_a_hold>telem_peak[0]) telem_peak[0] = in_a_hold;
+if(in_b_hold>telem_peak[1]) telem_peak[1] = in_b_hold;
+if(out_a_hold>telem_peak[2]) telem_peak[2] = out_a_hold;
+if(out_b_hold>telem_peak[3]) telem_peak[3] = out_b_hold;
+if(!(assembly_flag&3)){ /* VU Meter off: reset the holds here */
+  in_a_hold = 0;
+  in_b_hold = 0;
+  out_a_hold = 0;
+  out_b_hold = 0;
+}
+portfff5 |= 0x0200;     /* re-enable delta interupts */
+telem_clip |= (in_error_stick>>8)&3;
+
+if((++telem_count)<telem_period){
+  return;
+}
+telem_count = 0;
+if(((tx_write_ptr - tx_read_ptr)&(TX_BUF_LEN-1))>(TX_BUF_LEN - 32)){
+  return;   /* no room for the frame (25 bytes): skip it (sent late it would leave our slot),
+               the peaks and CLIP bits go into the next frame */
+}
+
+for(i=0;i<4;i++){
+  payload[2*i] = telem_peak[i]>>8;
+  payload[2*i+1] = telem_peak[i]&0xff;
+  telem_peak[i] = 0;
+}
+payload[8] = telem_clip;
+telem_clip = 0;
+i = (int)((100L*idle_spins())/idle_max);
+payload[9] = (i>100) ? 100:i;
+payload[10] = rx_overruns>>8;
+payload[11] = rx_overruns&0xff;
+payload[12] = rx_framing>>8;
+payload[13] = rx_framing&0xff;
+payload[14] = rx_full>>8;
+payload[15] = rx_full&0xff;
+xmit_frame(BIN_TELEM + BIN_ACK, payload, 16);
+}
+
+
+/**************************************************************************
+ * idle_spins
+ * Returns how many times a delta_t() loop runs in IDLE_USEC. The
+ * interrupts take the rest of the time, so idle_spins()/idle_max is the
+ * fraction of the CPU left over by the sample and serial interrupts.
+ *
+ **************************************************************************/
+unsigned idle_spins(void)
+{
+unsigned count_start, n;
+
+n = 0;
+count_start = portfffa;
+while(delta_t(count_start)<IDLE_USEC){
+  n++;
+}
+return n;
+}
+
+
+/**************************************************************************
+ * store
+ * This function stores the filter module's settings in FLASH memory sector 3 (or 8).
+ *
+ * Flash memory format:
+ *  0x6000  Sector header:  generation
+ *  0x6001                  SECTOR_TAG
+ *  0x6002  First record:   next_loc -  pointer to next records start
+ *  0x6003                  prev_loc -  pointer to previous record start (0 for first record)
+ *  0x6004                  Record format version (RECORD_VERSION)
+ *  0x6005                  Serial Number (low byte)
+ *  0x6006                  Serial Number (high byte)
+ *  0x6007                  loc_code -  memory location code (0 to LAST_MEM_LOC, BASE_LOC, SNAP_LOC
+ *                                      or GROUP_LOC)
+ *  0x6008 ...              Module state variables: params[][] (see pack_record())
+ *
+ *          Second record: ... (records are variable length: next_loc - ptr)
+ *
+ * A delta record has RECORD_DELTA set in its format version and holds only the
+ * words that differ from the last full record of the same location:
+ *  +6                      base_loc -  pointer to the full record it is relative to
+ *  +7                      length of the full record
+ *  +8 ...                  index, word pairs: record[index] = word
+ * Changes of more than DELTA_MAX words are saved as a new full record.
+ *
+ * The records are kept in FLASH sector 3 (0x6000) or sector 8 (0xe000). Each
+ * sector starts with a header: generation (0 to 0x7fff), SECTOR_TAG. The
+ * first record is at 0x6002 (or 0xe002). When the current sector is full the
+ * refresh (compact_records()) erases the idle sector and writes the latest
+ * state of each location into it, then programs its header with the next
+ * generation. The sector with the newer valid header is current (see
+ * index_records()), so the old sector keeps all the records until the new one
+ * is complete. (A sector 3 without a header holds records from 0x6000, as
+ * before V2.35.)
+ *
+ * The refresh starts the sector with a base record (loc_code BASE_LOC) of the
+ * current settings and saves each location as a delta record relative to it
+ * (or as a full record if it differs too much). A location that has no record
+ * of its own yet is also stored relative to the base record, so locations that
+ * differ in a few parameters take a few words each.
+ *
+ **************************************************************************/
+void store(void)
+{
+unsigned ptr, current_loc, base_ptr=0, nbase, nrecord, nwrite;
+unsigned *wrecord;
+long show_usec=500000;  /* time for human to read display */
+
+min_value = 0;  /* set min and max value to bound parameter */
+max_value = LAST_MEM_LOC;
+
+if(params_changed_copy!=3){ /* return if no press action is flaged */
+  return;
+}
+
+current_loc = (unsigned)params[10][0];
+
+portfff5 &= ~0x0200;    /* suspend delta interrupts while storing (the filters keep running) */
+disp_num(current_loc, 1, 8, 0); /* write: "9 Stored" */
+disp_text(" Stored ", 9, 0);
+beep(75, 400);                  /* Beep speaker */
+
+ptr = rec_end;      /* first blank location (from the index) */
+if(rec_ptr[current_loc]){
+  base_ptr = rec_base[current_loc]; /* full record of current_loc */
+}
+else{
+  base_ptr = rec_common;            /* base record of the refresh (if any) */
+}
+
+nrecord = pack_record();    /* save params[][] into record[] */
+wrecord = record;           /* record to write */
+nwrite = nrecord;
+
+if(base_ptr){   /* build a delta record in flash_data[DELTA_BUF ...] */
+  read_flash(base_ptr, 1, &nbase);  /* next_loc of the full record */
+  nbase -= base_ptr;                /* length of the full record */
+  if(nbase>RECORD_LENGTH){
+    disp_text("Error-MemCorrupt", 1, -1);   /* write LCD */
+    show_usec = 1500000;
+    goto store_out;
   }
-  else{
-    max_value = (long)(128);  
+  read_flash(base_ptr, nbase, flash_data);  /* read the full record */
+  nwrite = make_delta(record, nrecord, flash_data, nbase, base_ptr, &flash_data[DELTA_BUF]);
+  if(nwrite){
+    wrecord = &flash_data[DELTA_BUF];
   }
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  params[param_ptr_tmp+1][index_ab_tmp] = 1L;   /* set coef. poiner to 1 when changing order */
-  iorder = (int)params[param_ptr_tmp][index_ab_tmp];    /* get current order */
-  goto load_user;
+  else{                         /* too many changes: save a new full record */
+    nwrite = nrecord;
+    base_ptr = 0;
+  }
+}
 
-case 41:    /* UFtap: */
-  iorder = (int)params[param_ptr_tmp-1][index_ab_tmp];  /* get current order */
-  min_value = 1L;   /* set min and max value to bound paramter */
-  max_value = (long)iorder; /* limmit max to current order */
+if(nwrite>(rec_sector + 0x1fff - ptr)){ /* if current record too big to fit into remaining FLASH */
+  compact_records(current_loc, 0);      /* refresh FLASH (into the idle sector) */
+  goto store_out;
+}
 
-  cursor_temp = cursor_pos;                 /* save cursor position */
+/* Store current state to location ptr: */
+record_header(wrecord, ptr, nwrite, rec_last, current_loc, wrecord!=record);
 
-  itemp = (int)params[param_ptr_tmp][index_ab_tmp] - 1; /* get current coef. tap index */
-  ltemp = params[NPARAMSTRUCT + (itemp>>1)][index_ab_tmp];      /* get pair of coefs */
-  if(itemp&1){
-    disp_num((long)(ltemp>>16), 11, 6, 0);  /* disp odd (1,3,...) coefs */
-  }
-  else{
-    disp_num((long)((int)(ltemp&0x0000ffff)), 11, 6, 0);    /* disp even (0,2,...) coefs */
-  }
+/* Sneek other state variables into spare locations of params[][] if nessary: */
+/*params[1][1] =  */
 
-  disp_text("", cursor_temp, 0);    /* put cursor back */
+flash_locked = 0;   /* unlock flash */
+if(prog_flash(ptr, nwrite, wrecord, 0, "inStore2")){    /* program FLASH, don't erase */
+  index_records();  /* the record may be partly written */
+}
+else{
+  rec_ptr[current_loc] = ptr;       /* update the index */
+  rec_len[current_loc] = nwrite;
+  rec_base[current_loc] = base_ptr ? base_ptr:ptr;
+  rec_last = ptr;
+  rec_end = ptr + nwrite;
+}
 
-  if(params_changed_copy==1) return;    /* update only min_value and max_value */
-  
- load_user:  
-  load_userfir(iorder, index_ab_tmp);   /* Load User FIR filter coefficients */
-  break;
 
-default:
-  break;
-}   /* end switch(param_ptr_tmp) */
-    
+/* read_flash(0x6000, 0x2000, flash_data);  /* fix: read sector 3  for inspection */
+
+store_out:
+defer(restore_disp, show_usec); /* display parameter state after human read display */
+hold_knob(show_usec);
+portfff5 |= 0x0200;     /* re-enable delta interupts */
+sw_down = 0;            /* this is required to get the curssor flashing again */
 }
 
 
 /**************************************************************************
- * compute_fir
- * This function computes and loads FIR coefficients for LP, HP, BP and BS
- * filters based on the currently selected function in params[0][index_ab_tmp].
+ * recall
+ * This function recalls the filter module's settings from FLASH memory sector 3 (or 8).
  *
  **************************************************************************/
-void compute_fir(float f1, float f2, int iorder, int index_ab_tmp)
+void recall(void)
 {
-int i, itemp, max_flag, iorderm1, iorderm1d2, iorderd2;
-float ftemp1, ftemp2, d2fsf1, d2fsf2, coef_max;
-float coefs[128];
 
-iorderm1 = iorder-1;
-iorderm1d2 = iorderm1>>1;
-iorderd2 = iorder>>1;
+unsigned current_loc;
+long show_usec=600000;  /* time for human to read display (longer than store) */
 
-/* Compute modified-Blackman-window (coefs are from filt.m 'aopt'), if nessesary: */
-if(iorder!=iorder_old){
-  ftemp1 = (float)(iorder-1);
-  for(i=0;i<=iorderm1d2;i++){   /* loop over half of the window (including center if odd) */
-    ftemp2 = (PIT2*(float)(i))/ftemp1;
-    window[i] = 0.48216433063585 - 0.48550251793519*cos(ftemp2) + 0.03233315142896*cos(2*ftemp2);
-  }
-  iorder_old = iorder;
+min_value = 0;  /* set min and max value to bound parameter */
+max_value = LAST_MEM_LOC;
+
+if(params_changed_copy!=3){ /* return if no press action is flaged */
+  return;
 }
 
-/* Compute FIR filter coefficients: */
-ftemp1 = 2.0/fsample;   /* compute some temp vars once */
-d2fsf1 = ftemp1*f1;
-d2fsf2 = ftemp1*f2;
-switch((int)params[0][index_ab_tmp]){   /* switch on index of currently selected function */
-case 2: /* LowPass */
-  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
-    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);   /* fix: can speed up by avoiding /2.0 */
-    coefs[i] = window[i]*sin(d2fsf1*ftemp1)/ftemp1;
-  }
-  if(iorder&1){     /* if iorder odd, compute center coef[] */
-    coefs[i] = window[i]*d2fsf1;    /* update center coef */
-  }
-  break;
-    
-case 3: /* HighPass */
-  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
-    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
-    coefs[i] = window[i]*(sin(ftemp1) - sin(d2fsf1*ftemp1))/ftemp1;
-  }
-  if(iorder&1){     /* if iorder odd, compute center coef[] */
-    coefs[i] = window[i]*(1.0 - d2fsf1);    /* update center coef for HP filter */
-  }
-  break;
-    
-case 4: /* BandPass */
-  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
-    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
-    coefs[i] = window[i]*(sin(d2fsf2*ftemp1) - sin(d2fsf1*ftemp1))/ftemp1;
-  }
-  if(iorder&1){     /* if iorder odd, compute center coef[] */
-    coefs[i] = window[i]*(d2fsf2 - d2fsf1); /* update center coef for BP filter */
-  }
-  break;
-    
-case 5: /* BandStop */
-  for(i=0;i<iorderd2;i++){  /* loop over half of filter (less center if odd) */
-    ftemp1 = PI*((float)(i) - ((float)iorderm1)/2.0);
-    coefs[i] = window[i]*(sin(ftemp1) + sin(d2fsf1*ftemp1) - sin(d2fsf2*ftemp1))/ftemp1;
-  }
-  if(iorder&1){     /* if iorder odd, compute center coef[] */
-    coefs[i] = window[i]*(1.0 + d2fsf1 - d2fsf2);   /* update center coef for BS filter */
-  }
-  break;
+current_loc = (unsigned)params[11][0];
 
-default:
-  break;
-}   /* end switch */
+portfff5 &= ~0x0200;    /* suspend delta interupts while recalling (the current filters keep running) */
+disp_num(current_loc, 1, 7, 0); /* write: "9 Recalled" */
+disp_text(" Recalled", 8, 0);   /* write LCD */
+beep(75, 400);                  /* Beep speaker */
 
-/* Determine quantization scale factor: */
-coef_max = coefs[iorderm1d2];   /* get center coef (maximum coef) */
-max_flag = (0.4999<coef_max);   /* store coef_max>0.4999 flag */
-ftemp1 = max_flag ? 32768.0:65536.0;    /* save quantization scale factor */
+if(rec_ptr[current_loc]==0){   /* desired location not in memory, so don't recall */
+ recall_error:
+/*  disp_text("Recall Error    ", 1, -1);   /* write LCD */
+  disp_text("Location Blank! ", 1, -1); /* write LCD */
+  show_usec = 1600000;
+  goto recall_out;
+}
 
-/* Load the scale, quantize, and load filter coefs: */
-out_gain |= 0x0400;     /* mute the outputs */
+/* Read FLASH record[] */
+if(read_record(rec_ptr[current_loc], rec_len[current_loc], record)==0){  /* read FLASH */
+  goto recall_error;
+}
+unpack_record();    /* load params[][] from record[] */
 
 
-itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
-if(itemp&1){
-  func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the fir_coef[] */
-  data_ptr_a = 0x03ff - iorderm1;   /* point to first used Ch A filter state data (in B1: 300h-3ffh) */
-  orderm2_a = iorderm1-1;               /* load assembly language constant */
-  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
-  for(i=0;i<=iorderm1d2;i++){
-    fir_coef[i] = fir_coef[iorderm1-i] = (int)(ftemp1*coefs[i] + 0.5);  /* write coefs to first and second half of filter A locations */
-  }
-  asm(" setc    CNF     ; map internal memory block B0 into Program space");
-  func_addr_a = (unsigned)(max_flag ? &fir_15_a:&fir_16_a); /* set function A */
-}
+recall_out:
 
-if(itemp&2){
-  func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the fir_coef[] */
-  data_ptr_b = 0x037f - iorderm1;   /* point to first used Ch B filter state data (in B1: 300h-37fh) */
-  orderm2_b = iorderm1-1;               /* load assembly language constant */
-  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
-  for(i=0;i<=iorderm1d2;i++){
-    fir_coef[i+128] = fir_coef[iorderm1+128-i] = (int)(ftemp1*coefs[i] + 0.5);  /* write coefs to first and second half of filter A locations */
-  }
-  asm(" setc    CNF     ; map internal memory block B0 into Program space");
-  func_addr_b = (unsigned)(max_flag ? &fir_15_b:&fir_16_b); /* set function B */
+install_params(1);  /* set up the CODEC and the DSP functions from params[][] */
+
+min_value = 0;  /* reset min and max value to bound parameter because it was changed in update_dsp() */
+max_value = LAST_MEM_LOC;
+
+/* params_changed = 2;      /* flag main loop to update DSP */
+defer(restore_disp, show_usec); /* display parameter state after human read display */
+hold_knob(show_usec);
+portfff5 |= 0x0200;     /* re-enable delta interupts */
+sw_down = 0;            /* this is required to get the curssor flashing again */
 }
 
 
-wait_n_samples(iorder); /* wait for ~order sampling intervals for transient to propagate */
-out_gain &= ~0x0400;        /* un-mute the outputs */
+/**************************************************************************
+ * install_params
+ * Sets the sampling rate, CODEC gains and the DSP functions from all of
+ * params[][] (after recall() or bin_load()), and points the display to the
+ * top level function.
+ *  dsp -   1 - set up the DSP functions
+ *          0 - they are already running (loaded by snap_load())
+ *
+ **************************************************************************/
+void install_params(int dsp)
+{
+
+morph_ticks = 0;    /* (ends a "morph") */
+set_fsample();  /* if nessasary, set the sampling rate (freqs should not be a out of bounds!) */
+auto_vu_count = (int)params[2][0];  /* restart counter; set to 0 or 1 depending on RevertToLevels */
+assembly_flag = (int)params[5][0] ? (assembly_flag|8):(assembly_flag&(~8)); /* set/clear the white noise flag for assembly code */
+assembly_flag = (int)params[7][0] ? (assembly_flag|4):(assembly_flag&(~4)); /* set/clear the cascade flag for assembly code */
+
+/* reset VU variables: (keeps VUs from bouncing back down when recalling. Optional) */
+in_a_hold = 0;
+in_b_hold = 0;
+out_a_hold = 0;
+out_b_hold = 0;
+in_a_vu_level = 0;
+in_b_vu_level = 0;
+out_a_vu_level = 0;
+out_b_vu_level = 0;
+
+/* Display top level function: */
+param_ptr = 0;      /* point function parameter */
+flag_options = 0;   /* don't point to options section */
+index_ab = params[6][0] ? 0:2;  /* if Mode:A&B Common (params[6][0]==0) then index common params, else index A params */   
 
+set_all_gains();    /* set optimal CODEC gains and attenuations */
+
+if(dsp==0){
+  return;
+}
+
+/* Set the current function: */
+if(params[6][0]==0){    /* Mode:A&B Common */
+  update_dsp(param_ptr_start[(int)params[0][2]],2); /* Initialize the current function */
+}
+else if(params[6][0]==1){ /* Mode:A&B Separate */
+  update_dsp(param_ptr_start[(int)params[0][0]],0); /* Initialize the current function */
+  update_dsp(param_ptr_start[(int)params[0][1]],1); /* Initialize the current function */
+}
+else{                   /* Mode:Ch A Only */
+  func_addr_b = (unsigned)&no_func_b;   /* set Ch B to no_func so Ch A can run long filter */
+  update_dsp(param_ptr_start[(int)params[0][0]],0); /* Initialize the current function */
+}
 }
 
 
 /**************************************************************************
- * load_userfir
- * This function computes and loads FIR coefficients for user specifed
- * filters based on the currently selected function in params[0][index_ab_tmp].
+ * morph_start
+ * Starts a "morph" to the settings of memory location loc over msec ms.
+ * params[][] gets the new settings, except the gains and frequencies of
+ * the running functions (rows MORPH_FIRST ...), which morph_step() moves
+ * from their current values every 5ms. The outputs are never muted.
+ * If the Mode, SampleRate, a function or a filter order differs (or a
+ * UserFIR is running) there is nothing to interpolate, and the settings
+ * are installed at once (as by recall()).
+ * Returns 0 if OK, 1 if the location is blank.
  *
  **************************************************************************/
-void load_userfir(int iorder, int index_ab_tmp)
+int morph_start(unsigned loc, long msec)
 {
-int i, j, itemp, iorderm1, iorderm1d2;
-long ltemp;
+int i, bank, func, banks;
+long mode, rate, funcs[3];
 
-iorderm1 = iorder-1;
-iorderm1d2 = iorderm1>>1;
+if(morph_ticks){
+  morph_finish(0);
+}
+if((rec_ptr[loc]==0)||(read_record(rec_ptr[loc], rec_len[loc], record)==0)){
+  return 1;
+}
 
-out_gain |= 0x0400;     /* mute the outputs */
-  
-itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
-if(itemp&1){
-  func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the fir_coef[] */
-  data_ptr_a = 0x03ff - iorderm1;   /* point to first used Ch A filter state data (in B1: 300h-3ffh) */
-  orderm2_a = iorderm1-1;               /* load assembly language constant */
-  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
-  j = 0;    /* starting position for filter A */
-  for(i=0;i<=iorderm1d2;i++){
-    ltemp = params[NPARAMSTRUCT + i][index_ab_tmp]; /* get pair of coefs */
-    fir_coef[j++] = (int)(ltemp&0x0000ffff);        /* write even coefs to filter A locations */
-    fir_coef[j++] = (int)(((unsigned long)ltemp)>>16);  /* write odd coefs to filter A locations */
+/* Save the current settings and load the new ones: */
+for(i=0;i<MORPH_ROWS;i++){
+  for(bank=0;bank<3;bank++){
+    morph_from[i][bank] = params[MORPH_FIRST+i][bank];
+  }
+}
+for(bank=0;bank<3;bank++){
+  funcs[bank] = params[0][bank];
+}
+mode = params[6][0];
+rate = params[4][0];
+unpack_record();    /* load params[][] from record[] */
+for(i=0;i<MORPH_ROWS;i++){
+  for(bank=0;bank<3;bank++){
+    morph_to[i][bank] = params[MORPH_FIRST+i][bank];
   }
-  asm(" setc    CNF     ; map internal memory block B0 into Program space");
-  func_addr_a = (unsigned)&fir_15_a; /* set function A */
 }
 
-if(itemp&2){
-  func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the fir_coef[] */
-  data_ptr_b = 0x037f - iorderm1;   /* point to first used Ch B filter state data (in B1: 300h-37fh) */
-  orderm2_b = iorderm1-1;               /* load assembly language constant */
-  asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
-  j = 128;  /* starting position for filter B */
-  for(i=0;i<=iorderm1d2;i++){
-    ltemp = params[NPARAMSTRUCT + i][index_ab_tmp]; /* get pair of coefs */
-    fir_coef[j++] = (int)(ltemp&0x0000ffff);        /* write even coefs to filter A locations */
-    fir_coef[j++] = (int)(((unsigned long)ltemp)>>16);  /* write odd coefs to filter A locations */
+/* Find the banks to morph (all banks of the Mode or none): */
+banks = (mode==0) ? 4:((mode==1) ? 3:1);
+morph_banks = banks;
+if((params[6][0]!=mode)||(params[4][0]!=rate)||(msec<5)){
+  morph_banks = 0;
+}
+for(bank=0;bank<3;bank++){
+  if(!(banks&(1<<bank))) continue;
+  func = (int)params[0][bank];
+  if((params[0][bank]!=funcs[bank])||(func>7)){     /* other function, UserFIR or Sine */
+    morph_banks = 0;
+  }
+  else if((func>=2)&&(func<=5)){                    /* LP, HP, BP or BS: same order? */
+    i = param_ptr_end[func] - 1 - MORPH_FIRST;
+    if(morph_from[i][bank]!=morph_to[i][bank]) morph_banks = 0;
   }
-  asm(" setc    CNF     ; map internal memory block B0 into Program space");
-  func_addr_b = (unsigned)&fir_15_b; /* set function B */
 }
 
-wait_n_samples(iorder); /* wait for ~order sampling intervals for transient to propagate */
-out_gain &= ~0x0400;        /* un-mute the outputs */
+if(morph_banks==0){     /* install the new settings at once */
+  params_changed_copy = 2;
+  install_params(1);
+  params_changed_copy = 1;
+  update_dsp(param_ptr, index_ab);    /* update min_value and max_value for the display */
+  update_disp_left();     /* update display to reflect parameter settings */
+  update_disp_right(1);
+  return 0;
+}
 
+for(i=0;i<MORPH_ROWS;i++){  /* the filters still run the current values */
+  for(bank=0;bank<3;bank++){
+    params[MORPH_FIRST+i][bank] = morph_from[i][bank];
+  }
+}
+morph_ticks = (msec>(5L*32767)) ? 32767:(int)(msec/5);
+morph_count = 0;
+morph_next = 0;
+morph_clip = 0;
+disp_num((long)loc, 1, 7, 0);   /* write: "9 Morphing" */
+disp_text(" Morphing", 8, 0);
+return 0;
 }
 
 
 /**************************************************************************
- * compute_notch
- * This function computes and loads IIR coefficients for the Notch and Inverse Notch
- * filters based on the currently selected function in params[0][index_ab_tmp].
+ * morph_step
+ * Called every 5ms during a "morph". Sets the interpolated gains and
+ * frequencies and reloads the filters of the next morphed bank (the banks
+ * take turns), then counts the 5ms intervals this took. Ends the morph at
+ * the new settings.
  *
  **************************************************************************/
-void compute_notch(float fn, float fw, int index_ab_tmp)
+void morph_step(void)
 {
-int* iptr;
-int itemp;
-float t1, t2, t3, k1, k2, c1, c2, d1, d2, g1, g2;
-
-/* k1 = -cos(2*PI*fn/fsample);  /* compute k1 from fnotch */
-k1 = -sin(2*PI*fn/fsample + PID2);  /* compute k1 from fnotch (use sin() to save memory) */
-t1 = PI*fw/fsample;
-/* t2 = cos(t1); */
-t2 = sin(t1 + PID2);
-t3 = sin(t1);
-k2 = (t2-t3)/(t2+t3);       /* compute k2 from fwidth */
-/* c1 = sqrt(1.0 - k1*k1);      /* compute normalization c1 */
-/* c2 = sqrt(1.0 - k2*k2);      /* compute normalization c2 */
-
-/* c1 = .5930;
-c2 = .0196;
-d1 = (1.0 - k1*k1)/c1;
-d2 = (1.0 - k2*k2)/c2; */
-
-d1 = -1;
-d2 = -1;
-c1 = (1.0 - k1*k1)/d1;
-c2 = (1.0 - k2*k2)/d2;
-
-/* Compute ideal notch filter coefficients: */
-switch((int)params[0][index_ab_tmp]){   /* switch on index of currently selected function */
-case 6: /* Notch */
-  /* gain params (g1 and g2) must be in range [-4,4) */
-  g1 = 0.5;
-  g2 = 0.0;
-  break;
-  
-case 7: /* Inverse Notch */
-  /* gain params (g1 and g2) must be in range [-4,4) */
-  g1 = 0.0;
-  g2 = 0.5;
-  break;
-
-default:
-  break;
-}   /* end switch */
-
-
-/* Load quantized coefs: */
-out_gain |= 0x0400;     /* mute the outputs */
+unsigned count_start;
+int i, bank;
+float frac;
 
-itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
-if(itemp&1){
-  func_addr_a = (unsigned)&no_func_a; /* get more CPU time to write the coefdata[] */
-  data_ptr_a = 0x03ff;  /* point to first used Ch A filter state data */
-  /* Write coefs to filter A locations: */
-  iptr = (int*)&coefdata[0x80]; /* get address of first coef to write */
-  *iptr++ = (int)(32768*c2 + 0.5);  /* c2 */
-  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 */
-  *iptr++ = (int)(32768*d2 + 0.5);  /* d2 */
-  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 (copy) */
-  *iptr++ = (int)(32768*c1 + 0.5);  /* c1 */
-  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 */
-  *iptr++ = (int)(32768*d1 + 0.5);  /* d1 */
-  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 (copy) */
-  *iptr++ = (int)(8192*g1 + 0.5);   /* g1 */
-  *iptr++ = (int)(8192*g2 + 0.5);   /* g2 */
-  func_addr_a = (unsigned)&notch_a; /* set function A */
+count_start = portfffa;     /* grab current timer value */
+if((++morph_count)>=morph_ticks){
+  morph_finish(1);
+  return;
 }
-
-if(itemp&2){
-  func_addr_b = (unsigned)&no_func_b; /* get more CPU time to write the coefdata[] */
-  data_ptr_b = 0x037f;  /* point to first used Ch B filter state data */
-  /* Write coefs to filter B locations: */
-  iptr = (int*)&coefdata[0];    /* get address of first coef to write */
-  *iptr++ = (int)(32768*c2 + 0.5);  /* c2 */
-  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 */
-  *iptr++ = (int)(32768*d2 + 0.5);  /* d2 */
-  *iptr++ = (int)(32768*k2 + 0.5);  /* k2 (copy) */
-  *iptr++ = (int)(32768*c1 + 0.5);  /* c1 */
-  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 */
-  *iptr++ = (int)(32768*d1 + 0.5);  /* d1 */
-  *iptr++ = (int)(32768*k1 + 0.5);  /* k1 (copy) */
-  *iptr++ = (int)(8192*g1 + 0.5);   /* g1 */
-  *iptr++ = (int)(8192*g2 + 0.5);   /* g2 */
-  func_addr_b = (unsigned)&notch_b; /* set function B */
+frac = (float)morph_count/(float)morph_ticks;
+do{             /* one bank per step, so a step stays well inside the 32ms of delta_t() */
+  bank = morph_next;
+  morph_next = (bank==2) ? 0:(bank + 1);
+}while(!(morph_banks&(1<<bank)));
+for(i=0;i<MORPH_ROWS;i++){
+  params[MORPH_FIRST+i][bank] = morph_value(i, bank, frac);
 }
-  
-/* wait_n_samples(???);     /* fix: wait for ??? sampling intervals for transient to propagate */
-out_gain &= ~0x0400;        /* un-mute the outputs */
-
+morph_update(bank);
+morph_count += delta_t(count_start)/5000;   /* time the step took (one compute_fir() at most) */
 }
 
 
 /**************************************************************************
- * set_all_gains
- * Sets all optimal CODEC gains and attenuations for the current function.
+ * morph_value
+ * Returns the value of params[MORPH_FIRST+i][bank] at frac (0 to 1) of a
+ * "morph". Gains are interpolated linearly, frequencies geometrically
+ * (the same number of octaves per step).
  *
  **************************************************************************/
-void set_all_gains(void)
+long morph_value(int i, int bank, float frac)
 {
-float cl, ftemp;
+int k;
+float from, to;
 
-/* Compute the optimal input gain for the CODEC and the scale factor for the VU Meters: */                  
-/* Channel A: */
-cl = (float)params[3][0];   /* get FullScalIn value */
-for(gopt_a=1;gopt_a<16;gopt_a++){
-  ftemp = (16.0*in_cal_levels[gopt_a]*cl)/max_in_level; /* calulate eqs. 8 & 9 in Gain cal. notes */
-  if(2.0<=ftemp){
-    break;  /* break out of for loop */
-  }
+from = (float)morph_from[i][bank];
+to = (float)morph_to[i][bank];
+if(from==to){
+  return morph_to[i][bank];
 }
-gopt_a--;
-out_gain = (out_gain&(~0x000f))|gopt_a;     /* update the CODEC gain A */
-scale_k_a = max_in_level/(8.0*in_cal_levels[gopt_a]*cl);    /* compute VU Meter scale factor */
-
-/* Channel B: */
-/* cl = (float)params[3][0];    /* get FullScalIn value */
-for(gopt_b=1;gopt_b<16;gopt_b++){
-  ftemp = (16.0*in_cal_levels[gopt_b]*cl)/max_in_level; /* calulate eqs. 8 & 9 in Gain cal. notes */
-  if(2.0<=ftemp){
-    break;  /* break out of for loop */
+for(k=0;k<10;k++){
+  if(param_ptr_end[k]==(MORPH_FIRST+i)){    /* gain */
+    return (long)(from + frac*(to - from));
   }
 }
-gopt_b--;
-out_gain = (out_gain&(~0x00f0))|(gopt_b<<4);        /* update the CODEC gain B */
-scale_k_b = max_in_level/(8.0*in_cal_levels[gopt_b]*cl);    /* compute VU Meter scale factor */
-
-/* Set the gains for Ch A and Ch B: */
-if(params[6][0]){   /* Mode:A&B Separate or Mode: Ch A Only */
-  gain(0);  /* Calculate setting of gain constant and output attenuator for Ch A */
-  gain(1);  /* Calculate setting of gain constant and output attenuator for Ch B */
-}
-else{   /* Mode:A&B Common */
-  gain(2);  /* Calculate setting of gain constant and output attenuator for Ch A and B */
+if((from<=0.0)||(to<=0.0)){
+  return (long)(from + frac*(to - from));
 }
-
+return (long)(from*exp(frac*log(to/from)) + 0.5);
 }
 
 
 /**************************************************************************
- * gain
- * Calculate setting of gain constant and output attenuator setting based
- * on the current function setting and index_ab_tmp.
+ * morph_update
+ * Loads the gain and the filter coefs. of bank from params[][] while the
+ * filter keeps running (live_flag: compute_fir() writes the coefs. a few
+ * at a time between samples and compute_notch() switches between two
+ * coef. sets).
  *
  **************************************************************************/
-void gain(int index_ab_tmp)
+void morph_update(int bank)
 {
-int itemp;
-float tgain, tlin, ftemp;
+int func;
+
+func = (int)params[0][bank];
+live_flag = 1;
+params_changed_copy = 2;
+gain(bank);
+if(func>=2){    /* LP, HP, BP, BS, Notch or Inverse Notch */
+  update_dsp(param_ptr_start[func], bank);
+}
+live_flag = 0;
+}
 
-/* set gain fixfix: if 256*ftemp > 32767 we must limit max_value*/
-tgain = 0.01*(float)params[param_ptr_end[(int)params[0][index_ab_tmp]]][index_ab_tmp];  /* get gain parameter for the current func */
 
-itemp = index_ab_tmp + 1;   /* itemp: 1-A, 2-B, 3-Common */
-/* Set gain for Ch A, Ch B or both: */
-if(itemp&1){
-  tlin = 16.0*in_cal_levels[gopt_a]/max_in_level;   /* compute Lin(gopt_a) for calulation below */
-  ftemp = tgain/(tlin*scale_k_a);   /* calulate eq. 13 in Gain cal. notes */
-  for(aopt_a=1;aopt_a<32;aopt_a++){
-    if(out_cal[aopt_a]<=fabs(ftemp)){
-      break;    /* break out of for loop */
+/**************************************************************************
+ * morph_finish
+ * Ends a "morph".
+ *  done -  1 - at the new settings: loads them and displays the top level
+ *              function (as recall() does)
+ *          0 - where it is (a parameter was changed): the interpolated
+ *              values stay, the other new settings are set up
+ * A FIR bank that needed fir_15_x while fir_16_x ran (see fir_live()) is
+ * loaded again here, the usual way.
+ *
+ **************************************************************************/
+void morph_finish(int done)
+{
+int i, bank;
+
+morph_ticks = 0;
+if(done){
+  for(bank=0;bank<3;bank++){
+    if(morph_banks&(1<<bank)){
+      for(i=0;i<MORPH_ROWS;i++){
+        params[MORPH_FIRST+i][bank] = morph_to[i][bank];
+      }
+      morph_update(bank);
     }
   }
-  aopt_a--;
-  out_atten = (out_atten&(~0x01f0))|(aopt_a<<4);    /* update the CODEC attenuation A */
-  ftemp = tgain/(out_cal[aopt_a]*tlin);         /* compute output gain factor */
-  t_reg_scale_a = (int)(256.0*ftemp + 0.5);         /* convert to scaled integer for use in assembly */
 }
-if(itemp&2){
-  tlin = 16.0*in_cal_levels[gopt_b]/max_in_level;   /* compute Lin(gopt_b) for calulation below */
-  ftemp = tgain/(tlin*scale_k_b);   /* calulate eq. 13 in Gain cal. notes */
-  for(aopt_b=1;aopt_b<32;aopt_b++){
-    if(out_cal[aopt_b]<=fabs(ftemp)){
-      break;    /* break out of for loop */
-    }
+for(bank=0;bank<3;bank++){
+  if(morph_clip&(1<<bank)){ /* fir_live() clipped a tap: load the filter with fir_15_x (mutes briefly) */
+    params_changed_copy = 2;
+    update_dsp(param_ptr_start[(int)params[0][bank]], bank);
   }
-  aopt_b--;
-  out_atten = (out_atten&(~0x3e00))|(aopt_b<<9);    /* update the CODEC attenuation B */
-  ftemp = tgain/(out_cal[aopt_b]*tlin);         /* compute output gain factor */
-  t_reg_scale_b = (int)(256.0*ftemp + 0.5);         /* convert to scaled integer for use in assembly */
 }
-
-/* out_atten = (out_atten&(~0x3ff0))|(aopt_a<<4)|(aopt_b<<9);   /* update the CODEC attenuations */
+morph_clip = 0;
+if(done){
+  params_changed_copy = 2;
+  install_params(0);  /* the filters already run the new settings */
+  params_changed_copy = 1;
+  update_dsp(param_ptr, index_ab);    /* update min_value and max_value for the display */
+  update_disp_left();     /* update display to reflect parameter settings */
+  update_disp_right(1);
+}
+else{
+  auto_vu_count = (int)params[2][0];  /* restart counter; set to 0 or 1 depending on RevertToLevels */
+  assembly_flag = (int)params[5][0] ? (assembly_flag|8):(assembly_flag&(~8)); /* set/clear the white noise flag for assembly code */
+  assembly_flag = (int)params[7][0] ? (assembly_flag|4):(assembly_flag&(~4)); /* set/clear the cascade flag for assembly code */
+  set_all_gains();    /* set optimal CODEC gains and attenuations */
+}
+}
 
 
+/**************************************************************************
+ * bin_dump
+ * Sends all settings (params[][] including the UserFIR taps) in a reply
+ * frame with opcode BIN_DUMP + BIN_ACK. The payload is RECORD_VERSION then
+ * record[6 ...] from pack_record(), 2 bytes per word (MS byte first; each
+ * long of params[][] is two words, LS word first).
+ *
+ **************************************************************************/
+void bin_dump(void)
+{
+int i, n;
+
+n = pack_record();
+flash_data[0] = RECORD_VERSION>>8;
+flash_data[1] = RECORD_VERSION&0xff;
+for(i=6;i<n;i++){
+  flash_data[2*i-10] = record[i]>>8;
+  flash_data[2*i-9] = record[i]&0xff;
+}
+xmit_frame(BIN_DUMP + BIN_ACK, flash_data, 2*n - 10);
 }
 
 
 /**************************************************************************
- * vu_update
- * This function updates the VU level meter. This function is called every
- * 5ms when displaying the VU meters. This fact is used to decay the
- * levels between the peaks.
+ * bin_load
+ * Loads all settings from a BIN_LOAD frame payload (data, nbytes; see
+ * bin_dump()) and sets up the DSP once. Returns the bin_execute() status:
+ * 0 - OK, 2 - bad length, 3 - bad parameter (wrong RECORD_VERSION, a bad
+ * UserFIR section or a parameter out of its min/max). params[][] is not
+ * changed on error.
  *
  **************************************************************************/
-void vu_update(void)
+int bin_load(unsigned *data, int nbytes)
 {
-int temp_pos;
-unsigned vu_temp;
-char carray[3];
-
-carray[2] = 0;
+int i, j, n, bank, flags, nwords;
+unsigned *uptr;
+float ftemp;
 
-vu_temp = convert_to_vu(scale_k_a, in_a_hold);  /* Compute VU level for in_a */
-if(vu_temp>=in_a_vu_level){ /* get peak level for VU Meter */
-  in_a_vu_level = vu_temp;
+nwords = nbytes>>1;
+if((nbytes&1)||(nwords<(1 + 6*NPARAMSTRUCT + 3 + 2))||(nwords>(RECORD_LENGTH - 5))){
+  return 2;
 }
-
-vu_temp = convert_to_vu(scale_k_b, in_b_hold);  /* Compute VU level for in_b */
-if(vu_temp>=in_b_vu_level){ /* get peak level for VU Meter */
-  in_b_vu_level = vu_temp;
+if(((data[0]<<8)|data[1])!=RECORD_VERSION){
+  return 3;
+}
+for(i=1;i<nwords;i++){
+  record[i+5] = (data[2*i]<<8)|data[2*i+1];
 }
 
-vu_temp = convert_to_vu(scale_k_a, out_a_hold); /* Compute VU level for out_a */
-if(vu_temp>=out_a_vu_level){    /* get peak level for VU Meter */
-  out_a_vu_level = vu_temp;
+/* Check the record (see pack_record()) before loading it: */
+for(bank=0;bank<3;bank++){
+  if((record[6+2*bank]>=(param_struct[0].flag&0x00ff))||record[7+2*bank]){    /* FUNC */
+    return 3;
+  }
+}
+if((record[6+2*3*6]>=(param_struct[6].flag&0x00ff))||record[7+2*3*6]){  /* Mode */
+  return 3;
+}
+j = 6 + 6*NPARAMSTRUCT;
+for(bank=0;bank<3;bank++){
+  if(j>=(nwords + 5)){
+    return 2;
+  }
+  flags = record[j]>>12;
+  n = record[j]&0x0fff;
+  if((flags>2)||(n>256)){
+    return 3;
+  }
+  j += 1 + (flags ? (n+1)>>1 : n);
+}
+if((j + 2)!=(nwords + 5)){  /* group words (not loaded) */
+  return 2;
 }
 
-vu_temp = convert_to_vu(scale_k_b, out_b_hold); /* Compute VU level for out_b */
-if(vu_temp>=out_b_vu_level){    /* get peak level for VU Meter */
-  out_b_vu_level = vu_temp;
+/* Range check every parameter of every bank (as set_param() does): */
+uptr = (unsigned*)(&params[0][0]);
+for(i=0;i<6*NPARAMSTRUCT;i++){  /* swap params[][] and the record's params */
+  n = uptr[i];
+  uptr[i] = record[6+i];
+  record[6+i] = n;
+}
+ftemp = fsample;
+fsample = params[4][0] ? 48000.0:8000.0;    /* the record's SampleRate (see set_fsample()) */
+n = 0;
+for(i=0;i<NPARAMSTRUCT;i++){
+  for(bank=0;bank<3;bank++){
+    if((i>=OPTIONS_START)&&(i<=OPTIONS_END)){   /* options are in bank 0 */
+      if(bank||(i==1)||(i==9)||(i>11)) continue;
+    }
+    else if(i==41){     /* UFtap (the taps are checked above) */
+      continue;
+    }
+    param_limits(i, bank);
+    if((bank==0)&&(max_value==128)){
+      max_value = 256;  /* Ch A may keep a long filter order from Mode:Ch A Only */
+    }
+    if((params[i][bank]<min_value)||(params[i][bank]>max_value)){
+      n = 1;
+    }
+  }
 }
+fsample = ftemp;
+for(i=0;i<6*NPARAMSTRUCT;i++){  /* swap back */
+  j = uptr[i];
+  uptr[i] = record[6+i];
+  record[6+i] = j;
+}
+if(n){
+  return 3;
+}
+record[2] = RECORD_VERSION;
 
-/* Write the VU levels to LCD: */
-temp_pos = cursor_pos;                  /* save cursor position */
-carray[0] = vu_chars[in_a_vu_level];    /* get VU character */
-carray[1] = vu_chars[in_b_vu_level];    /* get VU character */
-disp_text(carray, 10, -1);
+func_addr_a = (unsigned)&no_func_a; /* reduce ISR overhead while loading */
+func_addr_b = (unsigned)&no_func_b;
+unpack_record();    /* load params[][] from record[] */
+params_changed_copy = 2;
+install_params(1);
 
-carray[0] = vu_chars[out_a_vu_level];   /* get VU character */
-carray[1] = vu_chars[out_b_vu_level];   /* get VU character */
-disp_text(carray, 15, -1);
+params_changed_copy = 1;
+update_dsp(param_ptr, index_ab);    /* update min_value and max_value for the display */
+update_disp_left();     /* update display to reflect parameter settings */
+update_disp_right(1);
+return 0;
+}
 
-disp_text("", temp_pos, 0); /* put cursor back */
 
+/**************************************************************************
+ * pack_record
+ * Saves params[][] into record[6...] and returns the record length
+ * (including the 6 word header):
+ *
+ *  record[6 ...]   params[0 to NPARAMSTRUCT-1][0 to 2] (two words each)
+ *  then for each bank (A, B, Common):
+ *                  UserFIR header: (flags<<12) | n
+ *                      flags: 0 - n taps follow
+ *                             1 - symmetric, the first (n+1)/2 taps of order n follow
+ *                             2 - antisymmetric, the first (n+1)/2 taps of order n follow
+ *                  taps (one per word)
+ *  then            group_slot, group_mask (RECORD_GROUPS and later)
+ *
+ * The group words are written into every record. main() only uses
+ * location 0's copy at power up if there is no group record (see
+ * group_save()), and recall() leaves the group as it is.
+ *
+ * Trailing zero taps are not saved. A filter of order n (UForder) is saved
+ * as symmetric or antisymmetric if it is, and the taps above n are zero.
+ *
+ **************************************************************************/
+int pack_record(void)
+{
+int i, j, n, bank, last, flags;
+unsigned *uptr;
 
-/* Decay all the VU Meters together: */
-if((vu_counter++)>=VU_DECAY){
-  vu_counter = 0;
-  in_a_hold = 0;
-  in_b_hold = 0;
-  out_a_hold = 0;
-  out_b_hold = 0;
-  if(in_a_vu_level>0){
-    in_a_vu_level--;
+j = 6;
+uptr = (unsigned*)(&params[0][0]);  /* point to beginning of params[i][] */
+for(i=0;i<6*NPARAMSTRUCT;i++){
+  record[j++] = *uptr++;            /* read params[][] words */
+}
+
+for(bank=0;bank<3;bank++){
+  for(last=256;last>0;last--){      /* find last non zero tap */
+    if(get_tap(last-1, bank)) break;
   }
-  if(in_b_vu_level>0){
-    in_b_vu_level--;
+  n = (int)params[40][bank];        /* UForder */
+  flags = 0;
+  if((last>0)&&(last<=n)){          /* test for symmetric or antisymmetric */
+    flags = 3;
+    for(i=0;i<((n+1)>>1);i++){
+      if(get_tap(n-1-i, bank)!=get_tap(i, bank)) flags &= ~1;
+      if(get_tap(n-1-i, bank)!=-get_tap(i, bank)) flags &= ~2;
+    }
+    if(flags==3) flags = 1;         /* (only if the taps are -32768) */
   }
-  if(out_a_vu_level>0){
-    out_a_vu_level--;
+  if(flags){
+    record[j++] = (flags<<12)|n;
+    n = (n+1)>>1;                   /* save first half only */
   }
-  if(out_b_vu_level>0){
-    out_b_vu_level--;
+  else{
+    record[j++] = n = last;
+  }
+  for(i=0;i<n;i++){
+    record[j++] = get_tap(i, bank);
   }
 }
-
+record[j++] = group_slot;
+record[j++] = group_mask;
+return j;
 }
 
 
 /**************************************************************************
- * convert_to_vu
- * This function converts to a log scale for the VU level meter.
+ * unpack_record
+ * Loads params[][] from record[] (see pack_record()). The group words are
+ * only copied to record_groups[] (main() uses them from location 0).
  *
  **************************************************************************/
-unsigned convert_to_vu(float scale, int signal)
+void unpack_record(void)
 {
+int i, j, n, bank, flags;
+unsigned *uptr;
 
-float ftemp;
-int itemp;
+j = 6;
+uptr = (unsigned*)(&params[0][0]);  /* point to beginning of params[i][] */
+for(i=0;i<6*NPARAMSTRUCT;i++){
+  *uptr++ = record[j++];            /* write params[][] words */
+}
 
-ftemp = scale*(float)(signal);  /* fix: + 1.0 scale the peak held value */
-if(32767.0<ftemp){  /*if ftemp>0x7fff then clip */
-  ftemp = 32767.0;
+for(bank=0;bank<3;bank++){
+  flags = record[j]>>12;
+  n = record[j++]&0x01ff;
+  for(i=0;i<256;i++){
+    set_tap(i, bank, 0);            /* clear all taps */
+  }
+  for(i=0;i<(flags ? (n+1)>>1 : n);i++){
+    set_tap(i, bank, (int)record[j++]);
+  }
+  if(flags){
+    userfir_expand(n, (n+1)>>1, bank, flags);
+  }
+}
+if((record[2]&~RECORD_DELTA)>=RECORD_GROUPS){  /* record has the group words */
+  record_groups[0] = record[j];
+  record_groups[1] = record[j+1];
+}
+else{
+  record_groups[0] = 0;
+  record_groups[1] = 0;
+}
 }
 
-#if(0)  /* 3 dB per division */
-itemp = (int)ftemp;
-if(itemp==32767) return 12;     /* use number larger than 9 to force "X" to hold longer */
-else if(itemp>=23170) return 8; /* -3dB down, 32768*(1/sqrt(2)) */
-else if(itemp>=16384) return 7; /* -6dB down, 32768*(1/sqrt(2*2)) */
-else if(itemp>=11585) return 6; /* -9dB down, 32768*(1/sqrt(2*2*2)) */
-else if(itemp>=8192) return 5;
-else if(itemp>=5793) return 4;
-else if(itemp>=4096) return 3;
-else if(itemp>=2896) return 2;
-else if(itemp>=2048) return 1;
-else return 0;
 
-#else   /* 6 dB per division */
-itemp = (int)ftemp;
-if(itemp==32767) return 12;     /* use number larger than 9 to force "X" to hold longer */
-else if(itemp>=16384) return 8; /* -6dB down, 32768*(1/sqrt(4)) */
-else if(itemp>=8192) return 7;  /* -12dB down, 32768*(1/sqrt(4*4)) */
-else if(itemp>=4096) return 6;  /* -18dB down, 32768*(1/sqrt(4*4*4)) */
-else if(itemp>=2048) return 5;
-else if(itemp>=1024) return 4;
-else if(itemp>=512) return 3;
-else if(itemp>=256) return 2;
-else if(itemp>=128) return 1;
-else return 0;
+/**************************************************************************
+ * record_bad
+ * Checks record format version and serial number in first 5 locations of record[].
+ * Returns 0 if record OK
+ *         1 if record bad
+ *
+ **************************************************************************/
+int record_bad(void)
+{
 
-#endif
+return ( ((record[2]&~RECORD_DELTA)<RECORD_VERSION_MIN)||((record[2]&~RECORD_DELTA)>RECORD_VERSION)||
+         (record[3]!=*((unsigned*)(&serial_number)))||
+         (record[4]!=*((unsigned*)(&serial_number)+1))                       );
 }
 
 
 /**************************************************************************
- * led_update
- * This function updates the overload LEDs. This function is called every
- * 5ms. This fact is used to reset the LEDs after some hold time.
+ * read_record
+ * Reads the record of length n at ptr in FLASH (from the index) into dest[]
+ * and returns its length (0 if the record is bad). A delta record (see
+ * store()) is returned as a full record: the full record it is based on with
+ * the changed words written over it, under the delta record's header (without
+ * RECORD_DELTA). A full record takes one read_flash().
  *
  **************************************************************************/
-void led_update(void)
+unsigned read_record(unsigned ptr, unsigned n, unsigned *dest)
 {
+unsigned i, nfull, base;
 
-
-/* set overload LEDs to reflect the status of the overload bits: */
-out_atten = ((in_error_stick & 0x0100)>>5)|(out_atten & (~0x0008));
-out_atten = ((in_error_stick & 0x0200)>>7)|(out_atten & (~0x0004));
-/* led_counter = 0; */
-
-if((led_counter++)>=OVERFLOW_STICK){
-  led_counter = 0;
-  in_error_stick = in_error_stick & (~0x0100);  /* unstick overload A bit */
-  in_error_stick = in_error_stick & (~0x0200);  /* unstick overload B bit */
+if(n>RECORD_LENGTH){
+  return 0;
+}
+read_flash(ptr, n, dest);
+if(!(dest[2]&RECORD_DELTA)){    /* full record */
+  return n;
 }
 
+if(n>(DELTA_MAX+2)){
+  return 0;
+}
+for(i=0;i<n;i++){
+  delta_record[i] = dest[i];    /* move the delta record out of the way */
+}
+nfull = delta_record[7];
+base = delta_record[6];         /* base_loc */
+if((base<rec_sector)||(base>=ptr)||(nfull>RECORD_LENGTH)){
+  return 0;
+}
+read_flash(base, 1, &i);        /* next_loc of the full record */
+i -= base;                      /* length of the full record */
+if(i>RECORD_LENGTH){
+  return 0;
+}
+read_flash(base, i, dest);      /* read the full record */
 
+for(i=8;(i+1)<n;i+=2){          /* write the changed words over it */
+  if(delta_record[i]<nfull){
+    dest[delta_record[i]] = delta_record[i+1];
+  }
+}
+for(i=0;i<6;i++){
+  dest[i] = delta_record[i];
+}
+dest[2] &= ~RECORD_DELTA;
+return nfull;
 }
 
 
 /**************************************************************************
- * store
- * This function stores the filter module's settings in FLASH memory sector 3.
- *
- * Flash memory format:
- *  0x6000  First record:   next_loc -  pointer to next records start
- *  0x6001                  prev_loc -  pointer to previous record start (0 for first record)
- *  0x6002                  Firmware Version
- *  0x6003                  Serial Number (low byte)
- *  0x6004                  Serial Number (high byte)
- *  0x6005                  loc_code -  memory location code (0 to 9)
- *  0x6006 ...              Module state variables: params[][]
- *
- *          Second record: ...
+ * index_records
+ * Finds the current record sector (3 or 8) and builds the index of its
+ * records (rec_ptr[] etc., see store()), so store() and recall() don't have
+ * to walk the records. store() keeps the index up to date.
+ * Returns 0 if the records are OK
+ *         1 if a record is bad (the index holds the records before it)
  *
  **************************************************************************/
-void store(void)
+int index_records(void)
 {
-int i, j, itemp;
-int retrieved_flag[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};  /* 10 memory locations max. */
-unsigned next_loc, prev_loc=0, loc_code, ptr, ptr_m1=0;
-unsigned current_loc;
-unsigned fd_ptr, fd_ptr_m1=0, nrecord;
-unsigned* uptr;                                                 
-
-min_value = 0;  /* set min and max value to bound parameter */
-max_value = LAST_MEM_LOC;
+unsigned ptr, loc, header3[2], header8[2];
 
-if(params_changed_copy!=3){ /* return if no press action is flaged */
-  return;
+for(loc=0;loc<=LAST_MEM_LOC;loc++){
+  rec_ptr[loc] = 0;
 }
-
-nrecord = RECORD_LENGTH;
-
-current_loc = (unsigned)params[10][0];
-
-func_addr_temp_a = func_addr_a; /* save the current A function */
-func_addr_temp_b = func_addr_b; /* save the current B function */
-func_addr_a = (unsigned)&no_func_a; /* reduce ISR overhead, required for read_flash() and prog_flash() */
-func_addr_b = (unsigned)&no_func_b;
-
-portfff5 &= ~0x0200;    /* suspend delta interrupts while storing */
-disp_num(current_loc, 1, 8, 0); /* write: "9 Stored" */
-disp_text(" Stored ", 9, 0);
-beep(75, 400);                  /* Beep speaker */
-
-/* search for end of record data in FLASH */
-ptr = 0x6000;   /* point to first record */
-read_flash(ptr, 5, record);     /* read part of record header */
-next_loc = record[0];
-while(next_loc!=0xffff){
+rec_common = 0;
+rec_snap = 0;
+rec_group = 0;
+rec_last = 0;
+
+read_flash(0x6000, 2, header3); /* read the sector headers */
+read_flash(0xe000, 2, header8);
+if(SECTOR_OK(header8)&&(!SECTOR_OK(header3)||(header8[0]==((header3[0] + 1)&0x7fff)))){
+  rec_sector = 0xe000;
+  rec_gen = header8[0];
+  ptr = 0xe002;
+}
+else if(SECTOR_OK(header3)){
+  rec_sector = 0x6000;
+  rec_gen = header3[0];
+  ptr = 0x6002;
+}
+else{   /* records written before V2.35 (or blank) */
+  rec_sector = 0x6000;
+  rec_gen = 0x7fff;
+  ptr = 0x6000;
+}
+read_flash(ptr, 7, record);     /* read record header and base_loc */
+while(record[0]!=0xffff){
   /* Check for valid version and SN in each record: */
-  if(record_bad()){ /* if error in record */
-    goto store_error;
-  }
-  ptr_m1 = ptr;                 /* save pointer history */
-  ptr = next_loc;               /* point to next location */
-  read_flash(ptr, 5, record);   /* read part of record header */
-  next_loc = record[0];
-}
-/* ptr now points to first blank location, ptr_m1 points to previous location. */
-
-if(nrecord>(0x7fff - ptr)){ /* if current record too big to fit into remaining FLASH */
-/* if(nrecord>(0x6000+2000 - ptr)){ /* fix: if current record too big to fit into remaining FLASH */
-/* disp_text("Refreshing FLASH", 1, 0); /* write LCD */
-/* wait(500000);            /* wait */
-  /* Refresh FLASH by reading latest contents and re-saving: */
-  fd_ptr = 0;           /* point to first location in flash_data[] array */
-  prev_loc = ptr_m1;    /* point to last record in FLASH */
-  retrieved_flag[current_loc] = 1;  /* flag current location, because we will store it later */
-  do{   /* search backwords for valid records */
-    do{
-      ptr = prev_loc;               /* point to previous location */
-      read_flash(ptr, 6, record);   /* read previous header */
-      next_loc = record[0];
-      prev_loc = record[1];
-      loc_code = record[5];
-      if(record_bad()){ /* test for error in record */
-       store_error:
-        disp_text("Error-MemCorrupt", 1, -1);   /* write LCD */
-        wait(1500000);
-        goto store_out;
-      }
-    } while((prev_loc!=0)&&(retrieved_flag[loc_code]==1)); /* loop while retreiving duplicated records */
-    
-    if(retrieved_flag[loc_code]==0){    /* if at a valid record */
-      /* Read record (at ptr) and append to flash_data[]: */
-      /* leave ptr at first blank location and ptr_m1 to previous location */
-      read_flash(ptr, nrecord, &flash_data[fd_ptr]);    /* read FLASH */
-      flash_data[fd_ptr] = fd_ptr + nrecord + 0x6000;   /* next_loc update*/
-      flash_data[fd_ptr+1] = fd_ptr_m1 + 0x6000;        /* prev_loc update*/
-      fd_ptr_m1 = fd_ptr;               /* store pointer history */
-      fd_ptr += nrecord;                /* compute the next flash_data[] pointer */
-      retrieved_flag[loc_code] = 1;     /* flag loc_code record as retreved */
-    }
-  } while(prev_loc!=0); /* loop until begining of FLASH */
-  
-  /* Erase FLASH and save all memory records from flash_data[]: */
-  flash_data[1] = 0;    /* force 0 for first prev_loc */
-  flash_locked = 0;     /* unlock flash */
-  itemp = prog_flash(0x6000, fd_ptr, flash_data, 1, "inStore1");    /* erase and program FLASH with flash_data[] */
-  if(itemp){
-    goto store_out;
+  if(record_bad()||((record[5]>LAST_MEM_LOC)&&(record[5]!=BASE_LOC)&&(record[5]!=SNAP_LOC)&&(record[5]!=GROUP_LOC))||(record[0]<=ptr)){
+    rec_end = ptr;
+    return 1;
+  }
+  loc = record[5];
+  if(loc==BASE_LOC){            /* base record of the refresh */
+    rec_common = ptr;
+  }
+  else if(loc==SNAP_LOC){       /* DSP state snapshot */
+    rec_snap = ptr;
+  }
+  else if(loc==GROUP_LOC){      /* group assignment */
+    rec_group = ptr;
   }
-  ptr = fd_ptr + 0x6000;                    /* compute pointer for below */
-  /* ptr_m1 = ptr - RECORD_LENGTH;      This give a compiler ERROR!!!!!! */
-  ptr_m1 = ptr - nrecord;
+  else{
+    rec_ptr[loc] = ptr;
+    rec_len[loc] = record[0] - ptr;
+    rec_base[loc] = (record[2]&RECORD_DELTA) ? record[6]:ptr;
+  }
+  rec_last = ptr;
+  ptr = record[0];              /* point to next location */
+  read_flash(ptr, 7, record);   /* read record header and base_loc */
 }
-
-/* Store current state to location ptr: */
-record[0] = ptr + nrecord;                  /* next_loc value for new record */
-record[1] = ptr_m1;                         /* prev_loc value for new record */
-record[2] = VERSION;                        /* Version for new record */
-record[3] = *((unsigned*)(&serial_number));     /* first word of SN */
-record[4] = *((unsigned*)(&serial_number)+1);   /* second word of SN */
-record[5] = current_loc;                    /* loc_code for new record */
-
-/* Sneek other state variables into spare locations of params[][] if nessary: */
-/*params[1][1] =  */
-
-/* Save params[][] into record[]: */
-j=6;
-uptr = (unsigned*)(&params[0][0]);  /* point to beginning of params[i][] */
-for(i=0;i<NPARAMS;i++){
-  record[j++] = *uptr++;                    /* read first word from params[i][0] */
-  record[j++] = *uptr++;                    /* read second word from params[i][0] */
-  record[j++] = *uptr++;                    /* read first word from params[i][1] */
-  record[j++] = *uptr++;                    /* read second word from params[i][1] */
-  record[j++] = *uptr++;                    /* read first word from params[i][2] */
-  record[j++] = *uptr++;                    /* read second word from params[i][2] */
+rec_end = ptr;
+return 0;
 }
-/* record[j++] =    /* more data... */
-
-flash_locked = 0;   /* unlock flash */
-prog_flash(ptr, nrecord, record, 0, "inStore2");    /* program FLASH, don't erase */
 
 
-/* read_flash(0x6000, 0x2000, flash_data);  /* fix: read sector 3  for inspection */
+/**************************************************************************
+ * make_delta
+ * Builds a delta record (see store()) in delta[] of the full record full[]
+ * (length n) relative to the full record base[] (length nbase) that is at
+ * base_ptr in FLASH. The header words 0 to 5 are left to the caller.
+ * Returns the length of the delta record, or 0 if it would be longer than
+ * DELTA_MAX (save a full record instead).
+ *
+ **************************************************************************/
+unsigned make_delta(unsigned *full, unsigned n, unsigned *base, unsigned nbase, unsigned base_ptr, unsigned *delta)
+{
+unsigned i, nd=8;
 
-store_out:
-func_addr_a = func_addr_temp_a; /* reset the function */
-func_addr_b = func_addr_temp_b; /* reset the function */
-wait(500000);           /* wait(500000) for human to read display */
-update_disp_left();     /* display parameter state */
-update_disp_right(1);
-portfff5 |= 0x0200;     /* re-enable delta interupts */
-sw_down = 0;            /* this is required to get the curssor flashing again */
+for(i=6;i<n;i++){
+  if((i>=nbase)||(base[i]!=full[i])){   /* word changed */
+    if(nd>=DELTA_MAX){
+      return 0;
+    }
+    delta[nd++] = i;
+    delta[nd++] = full[i];
+  }
+}
+delta[6] = base_ptr;    /* base_loc */
+delta[7] = n;           /* length of the full record */
+return nd;
 }
 
 
 /**************************************************************************
- * recall
- * This function recalls the filter module's settings from FLASH memory sector 3.
+ * record_header
+ * Writes the 6 word header of the record rec[] of length n that will be
+ * programmed at ptr (see store()). delta is 1 for a delta record.
  *
  **************************************************************************/
-void recall(void)
+void record_header(unsigned *rec, unsigned ptr, unsigned n, unsigned prev_loc, unsigned loc_code, int delta)
 {
 
-int i, j;
-unsigned next_loc, prev_loc=0, loc_code, ptr, ptr_m1=0, current_loc;
-unsigned desired_loc_ptr=0, nrecord;
-unsigned* uptr;
-
-min_value = 0;  /* set min and max value to bound parameter */
-max_value = LAST_MEM_LOC;
-
-if(params_changed_copy!=3){ /* return if no press action is flaged */
-  return;
+rec[0] = ptr + n;                           /* next_loc value for new record */
+rec[1] = prev_loc;                          /* prev_loc value for new record */
+rec[2] = RECORD_VERSION | (delta ? RECORD_DELTA:0); /* record format version for new record */
+rec[3] = *((unsigned*)(&serial_number));    /* first word of SN */
+rec[4] = *((unsigned*)(&serial_number)+1);  /* second word of SN */
+rec[5] = loc_code;                          /* loc_code for new record */
 }
 
-nrecord = RECORD_LENGTH;
-
-current_loc = (unsigned)params[11][0];
-
-func_addr_a = (unsigned)&no_func_a; /* reduce ISR overhead, required for read_flash() and prog_flash() */
-func_addr_b = (unsigned)&no_func_b;
-
-portfff5 &= ~0x0200;    /* suspend delta interupts while recalling */
-disp_num(current_loc, 1, 7, 0); /* write: "9 Recalled" */
-disp_text(" Recalled", 8, 0);   /* write LCD */
-beep(75, 400);                  /* Beep speaker */
 
-/* search for end of record data in FLASH */
-ptr = 0x6000;   /* point to first record */
-read_flash(ptr, 6, record); /* read part of header */
-next_loc = record[0];
-loc_code = record[5];
-while(next_loc!=0xffff){
-  if(record_bad()){ /* Error: memory not properly erased or is corrupted */
-    goto recall_error;
+/**************************************************************************
+ * compact_records
+ * Refreshes the FLASH records (see store()): erases the idle record sector,
+ * writes a base record of the current settings and the latest state of each
+ * location into it, then switches to it. current_loc (or every location if
+ * all is 1) is saved as the current settings (none if current_loc is
+ * LAST_MEM_LOC+1). The group assignment (if any) is saved last.
+ * Returns 0 if OK
+ *         1 if error (the current sector is unchanged)
+ *
+ **************************************************************************/
+int compact_records(unsigned current_loc, int all)
+{
+unsigned loc, sector, fd_ptr, base_fd, prev_loc, nrecord, n, nd, header[2];
+unsigned *full;
+
+sector = (rec_sector==0x6000) ? 0xe000:0x6000;
+flash_data[0] = 0xffff;     /* leave the header blank (programmed last, below) */
+flash_data[1] = 0xffff;
+fd_ptr = 2;                 /* point to first record in flash_data[] array */
+
+/* Base record: the current settings */
+nrecord = pack_record();    /* save params[][] into record[] */
+for(n=6;n<nrecord;n++){
+  flash_data[fd_ptr+n] = record[n];
+}
+record_header(&flash_data[fd_ptr], sector + fd_ptr, nrecord, 0, BASE_LOC, 0);
+base_fd = fd_ptr;
+prev_loc = sector + fd_ptr;
+fd_ptr += nrecord;
+
+for(loc=0;loc<=LAST_MEM_LOC;loc++){
+  if(all||(loc==current_loc)){  /* the current settings */
+    full = &flash_data[base_fd];
+    n = nrecord;
+  }
+  else if(rec_ptr[loc]){        /* the latest state of loc (as a full record) */
+    full = record;
+    n = read_record(rec_ptr[loc], rec_len[loc], record);
+    if(n==0){
+      disp_text("Error-MemCorrupt", 1, -1); /* write LCD */
+      wait(1500000);
+      return 1;
+    }
   }
-  if(loc_code==current_loc){    /* loc_code == desired location */
-    desired_loc_ptr = ptr;      /* point to a valid memory location */
+  else{                         /* blank location */
+    continue;
   }
-  ptr_m1 = ptr;     /* save pointer history */
-  ptr = next_loc;   /* point to next location */
-  read_flash(ptr, 6, record);   /* read part of header */
-  next_loc = record[0];
-  loc_code = record[5];
+  if((fd_ptr + DELTA_MAX)>0x1fff){
+    goto compact_full;
+  }
+  nd = make_delta(full, n, &flash_data[base_fd], nrecord, sector + base_fd, &flash_data[fd_ptr]);
+  if(nd==0){                    /* save a full record */
+    if((fd_ptr + n)>0x1fff){
+     compact_full:
+      disp_text("Error-MemoryFull", 1, -1);    /* write LCD */
+      wait(1500000);
+      return 1;
+    }
+    for(nd=6;nd<n;nd++){
+      flash_data[fd_ptr+nd] = full[nd];
+    }
+    nd = n;
+  }
+  record_header(&flash_data[fd_ptr], sector + fd_ptr, nd, prev_loc, loc, nd!=n);
+  prev_loc = sector + fd_ptr;
+  fd_ptr += nd;
 }
-/* ptr now points to first blank location, ptr_m1 points to previous location. */
 
-if(desired_loc_ptr==0){ /* desired location not in memory, so don't recall */
- recall_error:
-/*  disp_text("Recall Error    ", 1, -1);   /* write LCD */
-  disp_text("Location Blank! ", 1, -1); /* write LCD */
-  wait(1000000);
-  goto recall_out;
+if(group_mask&GROUP_SET){   /* the group record (see group_save()) */
+  if((fd_ptr + GROUP_LENGTH)>0x1fff){
+    goto compact_full;
+  }
+  flash_data[fd_ptr+6] = group_slot;
+  flash_data[fd_ptr+7] = group_mask;
+  record_header(&flash_data[fd_ptr], sector + fd_ptr, GROUP_LENGTH, prev_loc, GROUP_LOC, 0);
+  fd_ptr += GROUP_LENGTH;
 }
 
-/* Read FLASH record[] */
-read_flash(desired_loc_ptr, nrecord, record);   /* read FLASH */
+/* Erase the idle sector and save all memory records from flash_data[]: */
+flash_locked = 0;   /* unlock flash */
+if(prog_flash(sector, fd_ptr, flash_data, 1, "inStore1")){  /* erase and program FLASH with flash_data[] */
+  return 1;
+}
 
-/* Load into params[][] from record[]: */
-j=6;
-uptr = (unsigned*)(&params[0][0]);  /* point to beginning of params[i][] */
-for(i=0;i<NPARAMS;i++){
-  *uptr++ = record[j++];                    /* write first word to params[i][0] */
-  *uptr++ = record[j++];                    /* write second word to params[i][0] */
-  *uptr++ = record[j++];                    /* write first word to params[i][1] */
-  *uptr++ = record[j++];                    /* write second word to params[i][1] */
-  *uptr++ = record[j++];                    /* write first word to params[i][2] */
-  *uptr++ = record[j++];                    /* write second word to params[i][2] */
+/* Switch to the refreshed sector: */
+header[0] = (rec_gen + 1)&0x7fff;   /* next generation */
+header[1] = SECTOR_TAG;             /* (programmed after the generation) */
+flash_locked = 0;   /* unlock flash */
+n = prog_flash(sector, 2, header, 0, "inSwitch");
+index_records();    /* index the new sector */
+return n;
 }
-/* = record[j++] /* more data... */
 
 
-recall_out:
+/**************************************************************************
+ * snap_save
+ * Saves a snapshot of the DSP state (the ISR variables, fir_coef[] and
+ * coefdata[]) in a record with loc_code SNAP_LOC, after location 0 has been
+ * recalled at power up:
+ *  record[6]       location 0 record the snapshot was made from (rec_ptr[0])
+ *  record[7]       address of no_func_a (the snapshot is only used by the same build)
+ *  record[8]       VERSION
+ *  record[9]       params[4][0] (SampleRate)
+ *  record[10 ...]  out_gain, out_atten, t_reg_scale_a/b, func_addr_a/b, coef_ptr_a/b,
+ *                  data_ptr_a/b, orderm2_a/b, assembly_flag (cascade and noise bits)
+ *  record[23 ...]  fir_coef[], then coefdata[]
+ * Storing location 0 or a refresh makes the snapshot stale, and the next
+ * power up saves a new one. Nothing is saved if the sector is too full (the
+ * next store refreshes it).
+ *
+ **************************************************************************/
+void snap_save(void)
+{
+unsigned i, ptr, func_a, func_b;
+unsigned *uptr;
 
-set_fsample();  /* if nessasary, set the sampling rate (freqs should not be a out of bounds!) */
-auto_vu_count = (int)params[2][0];  /* restart counter; set to 0 or 1 depending on RevertToLevels */
-assembly_flag = (int)params[5][0] ? (assembly_flag|8):(assembly_flag&(~8)); /* set/clear the white noise flag for assembly code */
-assembly_flag = (int)params[7][0] ? (assembly_flag|4):(assembly_flag&(~4)); /* set/clear the cascade flag for assembly code */
+ptr = rec_end;
+if((rec_ptr[0]==0)||(SNAP_LENGTH>(rec_sector + 0x1fff - ptr))){
+  return;
+}
 
-/* reset VU variables: (keeps VUs from bouncing back down when recalling. Optional) */
-in_a_hold = 0;
-in_b_hold = 0;
-out_a_hold = 0;
-out_b_hold = 0;
-in_a_vu_level = 0;
-in_b_vu_level = 0;
-out_a_vu_level = 0;
-out_b_vu_level = 0;
+uptr = &flash_data[6];
+*uptr++ = rec_ptr[0];
+*uptr++ = (unsigned)&no_func_a;
+*uptr++ = VERSION;
+*uptr++ = (unsigned)params[4][0];
+*uptr++ = out_gain&~0x0400;     /* (not muted) */
+*uptr++ = out_atten&~0x000c;    /* (CLIP LEDs off) */
+*uptr++ = t_reg_scale_a;
+*uptr++ = t_reg_scale_b;
+*uptr++ = func_a = func_addr_a;
+*uptr++ = func_b = func_addr_b;
+*uptr++ = coef_ptr_a;
+*uptr++ = coef_ptr_b;
+*uptr++ = data_ptr_a;
+*uptr++ = data_ptr_b;
+*uptr++ = orderm2_a;
+*uptr++ = orderm2_b;
+*uptr++ = assembly_flag&0x000c;
+
+func_addr_a = (unsigned)&no_func_a; /* the functions can't run while B0 is read */
+func_addr_b = (unsigned)&no_func_b;
+asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can read it");
+for(i=0;i<256;i++){
+  *uptr++ = fir_coef[i];
+}
+asm(" setc    CNF     ; map internal memory block B0 into Program space");
+func_addr_a = func_a;
+func_addr_b = func_b;
+for(i=0;i<256;i++){
+  *uptr++ = coefdata[i];
+}
 
-/* Display top level function: */
-param_ptr = 0;      /* point function parameter */
-flag_options = 0;   /* don't point to options section */
-index_ab = params[6][0] ? 0:2;  /* if Mode:A&B Common (params[6][0]==0) then index common params, else index A params */   
+record_header(flash_data, ptr, SNAP_LENGTH, rec_last, SNAP_LOC, 0);
+flash_locked = 0;   /* unlock flash */
+if(prog_flash(ptr, SNAP_LENGTH, flash_data, 0, "in Snap ")){
+  index_records();  /* the record may be partly written */
+}
+else{
+  rec_snap = ptr;   /* update the index */
+  rec_last = ptr;
+  rec_end = ptr + SNAP_LENGTH;
+}
+}
 
-set_all_gains();    /* set optimal CODEC gains and attenuations */
 
+/**************************************************************************
+ * group_save
+ * Saves the group assignment (group_slot, group_mask) in a record with
+ * loc_code GROUP_LOC, so it is kept over a power cycle without storing
+ * a location:
+ *  record[6]       group_slot
+ *  record[7]       group_mask
+ * Nothing is written if the latest group record holds the same words. If
+ * the sector is too full, it is refreshed (compact_records() writes the
+ * group record too).
+ *
+ **************************************************************************/
+void group_save(void)
+{
+unsigned ptr;
 
-/* Set the current function: */
-if(params[6][0]==0){    /* Mode:A&B Common */
-  update_dsp(param_ptr_start[(int)params[0][2]],2); /* Initialize the current function */
-}
-else if(params[6][0]==1){ /* Mode:A&B Separate */
-  update_dsp(param_ptr_start[(int)params[0][0]],0); /* Initialize the current function */
-  update_dsp(param_ptr_start[(int)params[0][1]],1); /* Initialize the current function */
+if(rec_group){
+  read_flash(rec_group + 6, 2, &flash_data[6]);
+  if((flash_data[6]==group_slot)&&(flash_data[7]==group_mask)){
+    return;
+  }
 }
-else{                   /* Mode:Ch A Only */
-  func_addr_b = (unsigned)&no_func_b;   /* set Ch B to no_func so Ch A can run long filter */
-  update_dsp(param_ptr_start[(int)params[0][0]],0); /* Initialize the current function */
+ptr = rec_end;
+if(GROUP_LENGTH>(rec_sector + 0x1fff - ptr)){
+  compact_records(LAST_MEM_LOC+1, 0);   /* refresh FLASH (into the idle sector) */
+  return;
 }
-min_value = 0;  /* reset min and max value to bound parameter because it was changed in update_dsp() */
-max_value = LAST_MEM_LOC;
 
-wait(600000);           /* wait(600000) for human to read display (longer than store) */
-
-/* params_changed = 2;      /* flag main loop to update DSP */
-update_disp_left();     /* display parameter state */
-update_disp_right(1);
-portfff5 |= 0x0200;     /* re-enable delta interupts */
-sw_down = 0;            /* this is required to get the curssor flashing again */
+flash_data[6] = group_slot;
+flash_data[7] = group_mask;
+record_header(flash_data, ptr, GROUP_LENGTH, rec_last, GROUP_LOC, 0);
+flash_locked = 0;   /* unlock flash */
+if(prog_flash(ptr, GROUP_LENGTH, flash_data, 0, "in Group")){
+  index_records();  /* the record may be partly written */
+}
+else{
+  rec_group = ptr;  /* update the index */
+  rec_last = ptr;
+  rec_end = ptr + GROUP_LENGTH;
+}
 }
 
 
 /**************************************************************************
- * record_bad
- * Checks Vesion and serial number in first 5 locations of record[].
- * Returns 0 if record OK
- *         1 if record bad
+ * snap_load
+ * Starts the DSP functions from the snapshot saved by snap_save(), if it was
+ * made from the current location 0 record by this build.
+ * Returns 1 if the functions were started
+ *         0 if not (no valid snapshot)
  *
  **************************************************************************/
-int record_bad(void)
+int snap_load(void)
 {
+unsigned i;
+unsigned *uptr;
 
-return ( (record[2]!=VERSION)||(record[3]!=*((unsigned*)(&serial_number)))||
-         (record[4]!=*((unsigned*)(&serial_number)+1))                       );
+if((rec_snap==0)||(rec_ptr[0]==0)){
+  return 0;
+}
+read_flash(rec_snap, SNAP_LENGTH, flash_data);
+if((flash_data[6]!=rec_ptr[0])||(flash_data[7]!=(unsigned)&no_func_a)||(flash_data[8]!=VERSION)){
+  return 0;
+}
+
+uptr = &flash_data[9];
+params[4][0] = *uptr++;
+set_fsample();          /* set the CODEC sampling rate */
+out_gain = *uptr++;
+out_atten = *uptr++;
+t_reg_scale_a = *uptr++;
+t_reg_scale_b = *uptr++;
+uptr += 2;              /* (functions are set last) */
+coef_ptr_a = *uptr++;
+coef_ptr_b = *uptr++;
+data_ptr_a = *uptr++;
+data_ptr_b = *uptr++;
+orderm2_a = *uptr++;
+orderm2_b = *uptr++;
+assembly_flag = (assembly_flag&~0x000c)|*uptr++;
+
+asm(" clrc    CNF     ; map internal memory block B0 into Data space so we can write it");
+for(i=0;i<256;i++){
+  fir_coef[i] = *uptr++;
+}
+asm(" setc    CNF     ; map internal memory block B0 into Program space");
+for(i=0;i<256;i++){
+  coefdata[i] = *uptr++;
+}
+func_addr_a = flash_data[14];   /* start the functions */
+func_addr_b = flash_data[15];
+return 1;
 }
 
 
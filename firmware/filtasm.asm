@@ -58,6 +58,7 @@ _assembly_flag  .usect  "bank2",1   ; used to flag the assembly code from C code
                                     ; 15 (LSB)      Flags VU Meter peak hold code (also uses bit 14)
                                     ; 13            Flags cascade Ch A and Ch B
                                     ; 12            Flags the white noise generator
+                                    ; 11            Flags peak hold for telemetry (telem_update())
 
 _coef_ptr_a  .usect "bank2",1   ; used to point to starting address of filter A coefs (changed in c-code to ping-pong)
             .global  _coef_ptr_a
@@ -81,6 +82,8 @@ _kf80fh     .usect  "bank2",1   ; define memory for costants (for speed)
 _kfff0h     .usect  "bank2",1   ; define memory for costants (for speed)
             .global  _kfff0h    ; value assigned in c-code
 
+            .global  _knob_samples  ; defined in c-code (bank2 is full)
+
 
 ; Reserve FIR filter coeficient storage for two channels in internal DATA memory.
 ; FIR: Two filters up to 128 taps each are stored or one long filter up to 256 taps
@@ -509,15 +512,27 @@ rand_skip:
         or      _in_error       ; logical OR with current error code to set any bits
         sacl    _in_error_stick ; save new sticky error code
 
+; Count samples since the last knob turn for c-code (txrxint_c() clears it, holds at 7fffh):
+        ldp     #_knob_samples  ; (a c variable, not in bank2)
+        lacl    _knob_samples
+        sub     #7fffh          ; ACC <- count - 7fffh
+        bcnd    knob_hold,GEQ   ; hold at 7fffh (0.68 sec. at 48 Ksps)
+        lacl    _knob_samples
+        add     #1
+        sacl    _knob_samples
+knob_hold:
+        ldp     #temp           ; Load data pointer to page 0 again
+
 ; Call to _func_addr_a:
         lacl    _func_addr_a    ; get the current A function address ...
         cala                    ; and call it
 
 
-        bit     _assembly_flag, 15  ; vu_flag -> TC
-        bcnd    rint_out_b,NTC  ; skip peak hold if flag not set
+        lacl    _assembly_flag  ; get flags
+        and     #0011h          ; VU Meter or telemetry peak hold flag (bit 15 or 11)
+        bcnd    rint_out_b,EQ   ; skip peak hold if neither flag set
 ;       b   rint_out_b
-; Hold peak values for VU Meter functionality in c-code (overflow mode (ovm) must be set):
+; Hold peak values for VU Meter and telemetry in c-code (overflow mode (ovm) must be set):
         lacc    _in_a,16        ; load ACC with data
         abs                     ; |data| -> ACC
         sub     _in_a_hold,16   ; ACC - hold -> ACC
@@ -0,0 +1,205 @@
+function results = parse_fuzz(port, sn, baud, ncases, seed)
+% This function exercises the Versa-Filter serial command parser
+% (parse_command() in filt.c) with a corpus of valid commands and with
+% random mutations of them. Use one module on the RS-232 port.
+%
+% Call as:
+% results = parse_fuzz(port, sn, baud, ncases, seed);
+%
+%   port    -   serial port name (default 'COM1')
+%   sn      -   serial number of the module under test (e.g. 132001)
+%   baud    -   baud rate (default 9600)
+%   ncases  -   number of mutated commands to send (default 500)
+%   seed    -   random seed, so a failing run can be repeated (default 0)
+%
+% After every test command the host sends "echo" with a sequence number
+% and waits for it to come back. A missing echo is reported as a hang
+% (the parser never returned to the start state, or the receive buffer
+% overflowed). The failing command is saved in results.hangs.
+%
+% Build the firmware with PARSE_STATS set to 1 to also get the parser
+% timing from the "parsestat" command:
+%   chars/sec       - state machine throughput (excluding command execution)
+%   max cycles/char - worst state machine time for one character
+%   max exec ms     - worst command execution time
+%   aborts          - UserFIR/program commands aborted with the DSP functions
+%                     off; before V2.22 each of these left the audio muted
+%
+% Commands that write the FLASH (Store, program), recall settings or
+% reset the module (Initialize, reset) are never sent.
+
+if(nargin<1), port = 'COM1'; end
+if(nargin<3), baud = 9600; end
+if(nargin<4), ncases = 500; end
+if(nargin<5), seed = 0; end
+
+CLKOUT1 = 2*12.288e6;       % DSP cycle rate
+USEC = 1.0579e-6;           % the filt.c delta_t() "~microsecond"
+PARSE_TIMEOUT = 2.0;        % filt.c PARSE_TIMEOUT (400*5ms)
+
+rand('state', seed);
+addr = sprintf('at sn:%d ', sn);
+
+% Corpus of valid commands (without the "at sn:" header):
+corpus = { ...
+  'Mode:A&B Common', 'func:LowPass', 'LPfcut:1000', 'LPfcut', ...
+  'LPorder:64', 'LPgain:1.00', 'func:Notch', 'Nfnotch:60', 'func', ...
+  'Mode:A&BSeparate', 'aFUNC:BandPass', 'aBPf1:500', 'aBPf2:2000', ...
+  'bFUNC:HighPass', 'bHPfcut:300', 'bHPorder', 'Mode:A&B Common', ...
+  'Levels', 'Firmware', 'Serial No', 'display:Fuzz Test', 'display', ...
+  'func:UserFIR: 100 -200 300 -400 32767 -32768', ...
+  'func:UserFIR: 1 2 3', ...
+  'func:UserFIR: 1 2 x3 4', ...     % aborted UserFIR (bad character)
+  'func:UserFIR:: 5', ...
+  'sendsn', 'quietsn', ...
+  'at sn:1 at all display', 'aaaat', 'at at at', ...
+  repmat('a', 1, 40), repmat(' ', 1, 40), ...
+  sprintf('display:%s', repmat('x', 1, 30)), ...
+  sprintf('%s:1', repmat('p', 1, 30))};
+alphabet = ['a':'z' 'A':'Z' '0':'9' ' :-.,&' 13 0 255];
+
+fid = serial(port, 'baudrate', baud, 'terminator', 'cr', 'timeout', 1, ...
+  'inputbuffersize', 4096, 'outputbuffersize', 4096);
+fopen(fid);
+
+results.hangs = {};
+results.sent = 0;
+seq = 0;
+have_stats = 0;
+
+% Clear the parse statistics:
+fprintf(fid, '%sparsestat\r', addr);
+[st, have_stats] = read_stats(fid);
+fprintf(fid, '%squietsn\r', addr);
+
+% Replay the corpus, then the mutations:
+for k = 1:(length(corpus) + ncases)
+  if(k<=length(corpus))
+    cmd = [addr corpus{k}];
+  else
+    cmd = mutate(addr, corpus, alphabet);
+  end
+  fwrite(fid, [cmd 13]);
+  results.sent = results.sent + length(cmd) + 1;
+  seq = seq + 1;
+  if(~sync(fid, addr, seq, 1.0))
+    % The parser may be waiting for more UserFIR coefs.; let PARSE_TIMEOUT expire:
+    pause(PARSE_TIMEOUT + 0.5);
+    fwrite(fid, 13);
+    seq = seq + 1;
+    if(~sync(fid, addr, seq, 1.0))
+      results.hangs{end+1} = cmd;
+      fprintf('Hang after command %d: %s\n', k, printable(cmd));
+    end
+  end
+end
+
+% Throughput: send the corpus back to back, then one sync:
+burst = '';
+for k = 1:length(corpus)
+  burst = [burst addr corpus{k} 13];
+end
+tic;
+fwrite(fid, burst);
+seq = seq + 1;
+if(~sync(fid, addr, seq, 10))
+  results.hangs{end+1} = 'burst';
+  disp('Hang (or receive buffer overflow) during burst');
+end
+results.burst_cps = length(burst)/toc;
+
+fprintf(fid, '%sloudsn\r', addr);
+fprintf(fid, '%sdisplay\r', addr);
+fprintf(fid, '%sparsestat\r', addr);
+[st, have_stats] = read_stats(fid);
+fclose(fid);
+
+fprintf('%d commands, %d chars sent, %d hangs\n', length(corpus) + ncases, ...
+  results.sent, length(results.hangs));
+fprintf('burst: %.0f chars/sec over the wire at %d baud\n', results.burst_cps, baud);
+if(have_stats)
+  results.chars = st(1);
+  results.parse_cps = st(1)/(st(2)*USEC);
+  results.max_cycles = st(3)*USEC*CLKOUT1;
+  results.max_exec_ms = st(4)*USEC*1e3;
+  results.aborts = st(5);
+  fprintf('parser: %.0f chars/sec, max %.0f cycles/char (%.0f us), max exec %.1f ms, %d aborts\n', ...
+    results.parse_cps, results.max_cycles, st(3)*USEC*1e6, results.max_exec_ms, results.aborts);
+  fprintf('usable baud rate (parser only): %.0f\n', 10*results.parse_cps);
+else
+  disp('No "parsestat" reply (firmware built with PARSE_STATS 0).');
+end
+
+
+function ok = sync(fid, addr, seq, timeout)
+% Sends an echo command and waits for it to come back.
+tag = sprintf('s%d', seq);
+fprintf(fid, '%secho:%s\r', addr, tag);
+ok = 0;
+tic;
+while(toc<timeout)
+  line = fgetl(fid);
+  if(ischar(line) && strcmp(deblank(line), tag))
+    ok = 1;
+    return;
+  end
+end
+
+
+function [st, ok] = read_stats(fid)
+% Reads the 5 lines sent by "parsestat".
+st = zeros(1,5);
+ok = 1;
+for i = 1:5
+  line = fgetl(fid);
+  v = str2double(line);
+  if(~ischar(line) || isnan(v))
+    ok = 0;
+    return;
+  end
+  st(i) = v;
+end
+
+
+function cmd = mutate(addr, corpus, alphabet)
+% Returns a random mutation of a corpus command. Mutations that could
+% write the FLASH or reset the module are rejected.
+while(1)
+  cmd = [addr corpus{ceil(rand*length(corpus))}];
+  for n = 1:ceil(3*rand)
+    i = ceil(rand*length(cmd));
+    c = alphabet(ceil(rand*length(alphabet)));
+    switch(ceil(6*rand))
+    case 1  % replace a character
+      cmd(i) = c;
+    case 2  % insert a character
+      cmd = [cmd(1:i) c cmd(i+1:end)];
+    case 3  % delete a character
+      cmd(i) = [];
+    case 4  % truncate
+      cmd = cmd(1:i);
+    case 5  % repeat a piece
+      j = min(length(cmd), i + ceil(8*rand));
+      cmd = [cmd(1:j) cmd(i:end)];
+    case 6  % splice in another command
+      cmd = [cmd(1:i) corpus{ceil(rand*length(corpus))}];
+    end
+    if(isempty(cmd)), cmd = addr; end
+  end
+  % (parameter names match on their first letters: "st" is Store:)
+  if(isempty(regexp(lower(cmd), '(^|[^a-z])(st|rec|ini|reset|program)', 'once')))
+    return;
+  end
+end
+
+
+function str = printable(cmd)
+% Shows control characters as <nn>.
+str = '';
+for c = double(cmd)
+  if(c<32 || c>126)
+    str = [str sprintf('<%d>', c)];
+  else
+    str = [str char(c)];
+  end
+end
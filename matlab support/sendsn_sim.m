@@ -0,0 +1,109 @@
+function sendsn_sim(nmods, bauds, ntrials)
+% This function simulates serial number discovery of Versa-Filter modules
+% sharing one RS-232 multi-drop bus. It compares the original "sendsn"
+% command (random backoff, host quiets each module it hears with "quietsn")
+% with the "slotsn" command (slots selected by the serial number bits,
+% host walks a binary tree of serial numbers).
+%
+% Call as:
+% sendsn_sim(nmods, bauds, ntrials);
+%
+%   nmods   -   vector of number of modules on the bus (default [4 8 16 32])
+%   bauds   -   vector of baud rates (default [9600 19200 38400])
+%   ntrials -   number of Monte Carlo trials per case (default 200)
+%
+% Two transmissions that overlap on the bus are both lost (garbled).
+% Both random and consecutive (one rack) serial numbers are simulated.
+% Prints the mean time to enumerate all modules, the worst time, and the
+% fraction of transmitted serial numbers that collided.
+%
+% The constants below must match filt.c.
+
+if(nargin<1), nmods = [4 8 16 32]; end
+if(nargin<2), bauds = [9600 19200 38400]; end
+if(nargin<3), ntrials = 200; end
+
+SENDSN_WAIT = 22;       % max wait time for sendsn command (in multiples of 32767us)
+SLOTSN_BITS = 5;        % default number of slot bits for the slotsn command
+SLOTSN_CHARS = 13;      % slotsn slot length in character times
+SUB_BITS = 2;           % slot bits used by the host for collided branches
+USEC = 1.0579e-6;       % the filt.c wait() "~microsecond"
+
+for sn_type = 1:2
+  if(sn_type==1)
+    disp('Random serial numbers:');
+  else
+    disp('Consecutive serial numbers (one rack):');
+  end
+  disp('  baud    N | sendsn: mean(s) max(s) collide | slotsn: mean(s) max(s) collide');
+  for baud = bauds
+    tchar = 10/baud;            % one character (start + 8 data + stop bits)
+    tframe = 11*tchar;          % 10 char serial number + CR
+    for n = nmods
+      t1 = zeros(ntrials,1); c1 = zeros(ntrials,2);
+      t2 = zeros(ntrials,1); c2 = zeros(ntrials,2);
+      for trial = 1:ntrials
+        if(sn_type==1)
+          sn = 100000 + randperm(900000, n) - 1;
+        else
+          sn = 100000 + floor(899000*rand) + (0:(n-1));
+        end
+
+        % Original sendsn: random backoff, quiet every module heard cleanly:
+        active = true(1,n);
+        t = 0; ntx = 0; ncoll = 0;
+        while(1)
+          t = t + (length('at all sendsn')+1)*tchar;
+          idx = find(active);
+          tstart = SENDSN_WAIT*floor(32768*rand(1,length(idx)))*USEC;  % wait(SENDSN_WAIT*rand())
+          ok = clean(tstart, tframe);
+          ntx = ntx + length(idx);
+          ncoll = ncoll + sum(~ok);
+          t = t + SENDSN_WAIT*32767*USEC + tframe;     % host listens for the whole window
+          if(isempty(idx))
+            break;                                  % silent round: done
+          end
+          heard = idx(ok);
+          active(heard) = false;
+          t = t + length(heard)*(length('at sn:123456 quietsn')+1)*tchar;
+        end
+        t1(trial) = t; c1(trial,:) = [ncoll ntx];
+
+        % slotsn: walk the serial number tree, least significant bits first:
+        queue = [SLOTSN_BITS 0 0];                  % [nbits shift res] of each query
+        t = 0; ntx = 0; ncoll = 0;
+        while(~isempty(queue))
+          nbits = queue(1,1); shift = queue(1,2); res = queue(1,3);
+          queue(1,:) = [];
+          cmd = sprintf('at all slotsn:%d %d %d\n', nbits, shift, res);
+          t = t + length(cmd)*tchar;
+          idx = find(mod(sn, 2^shift)==res);
+          slot = mod(floor(sn(idx)/2^shift), 2^nbits);
+          ntx = ntx + length(idx);
+          t = t + ((2^nbits - 1)*SLOTSN_CHARS*tchar*1.0579 + tframe);  % host listens to last slot
+          for s = unique(slot)
+            nslot = sum(slot==s);
+            if(nslot>1)
+              ncoll = ncoll + nslot;
+              queue(end+1,:) = [SUB_BITS shift+nbits res+s*2^shift];
+            end
+          end
+        end
+        t2(trial) = t; c2(trial,:) = [ncoll ntx];
+      end
+      fprintf('%6d %4d |         %6.2f %6.2f %6.3f  |         %6.2f %6.2f %6.3f\n', baud, n, ...
+        mean(t1), max(t1), sum(c1(:,1))/sum(c1(:,2)), ...
+        mean(t2), max(t2), sum(c2(:,1))/sum(c2(:,2)));
+    end
+  end
+  disp(' ');
+end
+
+
+function ok = clean(tstart, tframe)
+% Returns true for each transmission that did not overlap another one.
+ok = true(size(tstart));
+for i = 1:length(tstart)
+  others = tstart([1:(i-1) (i+1):end]);
+  ok(i) = all(abs(others - tstart(i)) >= tframe);
+end
@@ -30,7 +30,9 @@ figure, plot(f,abs(h)), grid on, zoom on
 % Write file that loads Common section of Versa-Filter with differentiator:
 fprintf(fid, 'at all Mode:A&B Common\n');
 fprintf(fid, 'at all FUNC:UserFIR:');
-fprintf(fid, ' %d', round(32768*diff_coefs));   % write coefs
+[payload, text] = vf_ufpack(round(32768*diff_coefs), 2);
+fprintf(fid, '%s', text);   % write coefs (first half only if (anti)symmetric, needs V2.24)
+%fprintf(fid, ' %d', round(32768*diff_coefs));   % write all coefs (older firmware)
 fprintf(fid, '\n');     % write final carriage return
 
 
@@ -0,0 +1,76 @@
+function [f, out] = vf_am29f010(cmd, f, addr, arg)
+% This function simulates the Am29F010 FLASH memory of a Versa-Filter
+% module the way the firmware sees it (see prog_flash() and read_flash()
+% in filt.c): 64K words (0 to 65535), each word two bytes (MS byte first),
+% in 8 sectors of 8192 words. A sector is erased to all ones and
+% programming can only clear bits. The time the module would take is added
+% up in f.time.
+%
+% Call as:
+% f = vf_am29f010('new');
+% f = vf_am29f010('erase', f, addr);            % erase the sector holding word addr
+% [f, ok] = vf_am29f010('program', f, addr, words);
+% [f, words] = vf_am29f010('read', f, addr, n);
+%
+%   f       -   struct: bytes (131072), time (sec.), erases (per sector),
+%               programmed (bytes), calls (program and read calls)
+%   ok      -   0 if a bit would have to go from 0 to 1 (prog_flash() error 4);
+%               the bytes before it are programmed
+%
+% Times: data sheet typicals for the FLASH, plus the prog_flash() and
+% read_flash() overhead (CLIP/IO2 settling, unlock writes and data polling
+% with interrupts off per byte).
+
+ERASE_S = 1.0;          % sector erase (typ.), including the erase verify
+PROG_US = 14;           % byte program (typ.)
+BYTE_US = 3;            % prog_flash() per byte (unlock, FLASH_ON/OFF, polling)
+READ_US = 1.5;          % read_flash() per word
+CALL_US = 850;          % per call: wait_n_samples(20) for CLIP and wait(400) for IO2
+
+switch(cmd)
+case 'new'
+  f.bytes = 255*ones(1, 131072);
+  f.time = 0;
+  f.erases = zeros(1, 8);
+  f.programmed = 0;
+  f.calls = 0;
+
+case 'erase'
+  s = floor(addr/8192);
+  f.bytes((16384*s + 1):(16384*(s+1))) = 255;
+  f.erases(s+1) = f.erases(s+1) + 1;
+  f.time = f.time + ERASE_S + CALL_US*1e-6;
+  f.calls = f.calls + 1;
+
+case 'program'
+  words = double(arg(:)');
+  if(floor(addr/8192)~=floor((addr + length(words) - 1)/8192))
+    error('vf_am29f010: program spans two sectors');
+  end
+  bytes = [floor(words/256); mod(words, 256)];
+  bytes = bytes(:)';
+  idx = 2*addr + (1:length(bytes));
+  old = f.bytes(idx);
+  out = 1;
+  bad = find(bitand(bitxor(old, bytes), bytes), 1);    % 0 -> 1 needed
+  if(~isempty(bad))
+    out = 0;
+    idx = idx(1:(bad-1));
+    bytes = bytes(1:(bad-1));
+    old = old(1:(bad-1));
+  end
+  nprog = sum(old~=bytes);
+  f.bytes(idx) = bytes;
+  f.programmed = f.programmed + nprog;
+  f.time = f.time + (nprog*PROG_US + length(idx)*BYTE_US + CALL_US)*1e-6;
+  f.calls = f.calls + 1;
+
+case 'read'
+  idx = 2*addr + (1:(2*arg));
+  out = f.bytes(idx(1:2:end))*256 + f.bytes(idx(2:2:end));
+  f.time = f.time + (arg*READ_US + CALL_US)*1e-6;
+  f.calls = f.calls + 1;
+
+otherwise
+  error('vf_am29f010: unknown command %s', cmd);
+end
@@ -0,0 +1,18 @@
+function bytes = vf_bytes(values, nbytes)
+% This function converts integers into bytes (MS byte first, 2's
+% complement) for a Versa-Filter binary frame payload (see vf_frame.m).
+%
+% Call as:
+% bytes = vf_bytes(values, nbytes);
+%
+%   values  -   vector of integers
+%   nbytes  -   bytes per value (2 for UserFIR taps, 4 for parameters)
+
+values = round(double(values(:)'));
+values(values<0) = values(values<0) + 2^(8*nbytes);    % 2's complement
+bytes = zeros(nbytes, length(values));
+for i = nbytes:-1:1
+  bytes(i,:) = mod(values, 256);
+  values = floor(values/256);
+end
+bytes = bytes(:)';
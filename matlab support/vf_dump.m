@@ -0,0 +1,44 @@
+function payload = vf_dump(fid, sn)
+% This function reads all settings of a Versa-Filter (firmware V2.30 and
+% later), including the UserFIR taps, with one binary frame. The result
+% can be loaded into other modules with opcode 5:
+%   fwrite(fid, vf_frame('all', 5, payload));
+%
+% Call as:
+% payload = vf_dump(fid, sn);
+%
+%   fid     -   open serial port (see vf_serial.m)
+%   sn      -   serial number of the module to read
+%
+%   payload -   bytes: format version (2 bytes), then the settings as
+%               saved in the FLASH (see pack_record() in filt.c)
+%
+% The serial port input buffer must hold the reply (up to 2200 bytes).
+
+fwrite(fid, vf_frame(sn, 4, []));
+
+% Find the reply frame: 2, serial number (3 bytes), 132, length (2 bytes):
+hdr = [];
+while(1)
+  byte = fread(fid, 1, 'uint8');
+  if(isempty(byte))
+    error('vf_dump: no reply from module %d', sn);
+  end
+  hdr = [hdr byte];
+  if(hdr(1)~=2)
+    hdr = [];
+  elseif(length(hdr)==7)
+    if(hdr(5)==132)
+      break;
+    end
+    hdr = [];
+  end
+end
+n = hdr(6)*256 + hdr(7);
+payload = fread(fid, n, 'uint8')';
+crc = fread(fid, 2, 'uint8')';
+
+check = vf_frame(hdr(2)*65536 + hdr(3)*256 + hdr(4), 132, payload);
+if((length(payload)~=n) || any(double(check(end-1:end))~=crc))
+  error('vf_dump: bad reply from module %d', sn);
+end
@@ -0,0 +1,73 @@
+function frame = vf_frame(sn, opcode, payload)
+% This function builds a Versa-Filter binary command frame (firmware
+% V2.23 and later). Send it with fwrite(fid, frame).
+%
+% Call as:
+% frame = vf_frame(sn, opcode, payload);
+%
+%   sn      -   serial number of the module, or 'all' for all modules,
+%               or 16773120 + g for the modules of group g (1 to 15, V2.32)
+%   opcode  -   1 - set parameters, 2 - load UserFIR coefs.,
+%               3 - load packed UserFIR coefs. (V2.24, see vf_ufpack.m),
+%               4 - dump all settings, 5 - load all settings (V2.30, see vf_dump.m)
+%               7 to 12 - firmware update (V2.39 and V2.40, see vf_fwupdate.m)
+%   payload -   vector of bytes (0 to 255)
+%
+% Frame: 2 (STX), serial number (3 bytes), opcode, length (2 bytes),
+% payload, CRC16 (2 bytes). Bytes are MS byte first. The CRC16 (CCITT,
+% start 0xffff) covers the serial number through the payload.
+%
+% A module that is addressed by its serial number answers with a frame
+% with opcode+128 and one status byte: 0 - OK, 1 - bad opcode,
+% 2 - bad length, 3 - bad parameter. Frames sent to 'all' are not answered.
+%
+% Payloads:
+%   opcode 1: [index bank value(4 bytes)] for each parameter, where index
+%             is the row of param_struct[] in filt.c (e.g. 16 - LPfcut),
+%             bank is 0 - A, 1 - B, 2 - Common, and value is the number
+%             the parameter shows times 10^(fractional digits) (LPgain 1.00 -> 100);
+%             rows are set in order (BPfcntr or BPfwdth also moves BPf1 and BPf2)
+%   opcode 2: [bank taps(2 bytes each)]
+%   opcode 3: [bank flags order(2 bytes) taps], see vf_ufpack.m
+%   opcode 4: none; the reply (opcode 132) carries the settings instead of a status
+%   opcode 5: the payload of an opcode 4 reply
+%
+% After "at sn:132001 telem:100" (V2.31) the module sends a frame with
+% opcode 134 every 100 ms: peak |in A| |in B| |out A| |out B| (2 bytes
+% each), CLIP bits (1 - A, 2 - B), CPU headroom (%), receive overruns,
+% framing errors, buffer full (2 bytes each). "telem:0" stops it.
+% Modules that get "telem" together send in turn, in the order of their
+% "group" ack slots (28 character times each, about 30 ms at 9600 baud).
+% A module refuses (ack error) a period too short for the slots up to its own,
+% or "telem" before "group" has given it a slot. A frame that finds the
+% transmit buffer full is skipped, not sent late.
+%
+% Examples:
+%   fwrite(fid, vf_frame(132001, 2, [2 vf_bytes(round(32768*coefs), 2)]));
+%   fwrite(fid, vf_frame('all', 1, [16 2 vf_bytes(1000, 4) 17 2 vf_bytes(64, 4)]));
+%   fwrite(fid, vf_frame('all', 5, vf_dump(fid, 132001)));     % clone 132001
+%
+% Each parameter, or each tap, is sent as binary instead of decimal
+% text, and all parameters of one frame are computed by the module once.
+
+if(ischar(sn))
+  sn = 2^24 - 1;        % all modules
+end
+
+payload = double(payload(:)');
+n = length(payload);
+body = [floor(sn/65536) mod(floor(sn/256), 256) mod(sn, 256) opcode floor(n/256) mod(n, 256) payload];
+
+crc = 65535;
+for byte = body
+  crc = bitxor(crc, byte*256);
+  for i = 1:8
+    if(bitand(crc, 32768))
+      crc = bitxor(mod(crc*2, 65536), 4129);     % 0x1021
+    else
+      crc = mod(crc*2, 65536);
+    end
+  end
+end
+
+frame = uint8([2 body floor(crc/256) mod(crc, 256)]);
@@ -0,0 +1,194 @@
+function ok = vf_fwupdate(fid, sn, image, delta)
+% This function updates the firmware of one or more Versa-Filters with
+% binary frames (firmware V2.39 and later). The image is streamed into the
+% backup code sectors of each module with a CRC32 per block, verified as a
+% whole, and only then installed into the main code sectors.
+%
+% Call as:
+% ok = vf_fwupdate(fid, sn, image, delta);
+%
+%   fid     -   open serial port (see vf_serial.m), with a timeout of 1 sec. or more
+%   sn      -   serial number of the module, or a vector of serial numbers:
+%               the blocks are sent once to all modules, then each module is
+%               asked how far it got and the missing blocks are sent to it
+%   image   -   bytes of the main code sectors 0, 1 and 2 (MS byte first, as
+%               sent by the "program:" command), up to 2*24568 bytes
+%   delta   -   1 to send only the blocks that differ from the installed
+%               firmware of all the modules (V2.40 and later, default 1)
+%
+%   ok      -   1 for each module that installed the image
+%
+% Frames (see vf_frame.m):
+%   opcode 7:  begin  [length in words (2 bytes) CRC32 (4 bytes)]
+%   opcode 8:  block  [word offset (2 bytes) CRC32 (4 bytes) words (up to 1024)]
+%   opcode 9:  status, answered with [receiving next_offset(2 bytes) length(2 bytes)]
+%   opcode 10: commit (verify, then install)
+%   opcode 11: hash [word offset (2 bytes) blocks], answered with the CRC32
+%              of each block of the installed firmware (V2.40)
+%   opcode 12: keep [word offset (2 bytes) length (2 bytes) CRC32 (4 bytes)]:
+%              copy an unchanged block of the installed firmware (V2.40)
+% Replies: 0 - OK, 3 - out of order, 4 - CRC error, 5 - FLASH error.
+%
+% The CRC32 (zip) is computed with the serial number words (bytes 132 to
+% 141 of the image) taken as zero: each module keeps its own serial number.
+% If the power fails while the image is installed, power up with the knob
+% pressed: the backup sectors then boot the new firmware, which finishes
+% the install.
+
+BLOCK = 1024;           % filt.c FW_BLOCK (words)
+ERASE_TIME = 12;        % sec. to erase the backup sectors (3 sectors, worst case)
+BLOCK_TIME = 0.2;       % sec. to program and read back one block
+INSTALL_TIME = 40;      % sec. to copy the image into the main sectors (worst case)
+
+if(nargin<4), delta = 1; end
+
+image = double(image(:)');
+if(mod(length(image), 2))
+  image = [image 255];
+end
+words = image(1:2:end)*256 + image(2:2:end);
+n = length(words);
+if(n>24568)
+  error('vf_fwupdate: image too long');
+end
+masked = words;
+masked(67:71) = 0;      % serial number words (SERIAL_LOC+2 to SERIAL_LOC+6)
+image_crc = crc32_words(masked);
+
+sn = sn(:)';
+ok = zeros(size(sn));
+if(length(sn)==1)
+  addr = sn;
+else
+  addr = 'all';
+end
+
+% Find the blocks that are the same in the installed firmware of every module:
+nblocks = ceil(n/BLOCK);
+keep = false(1, nblocks);
+if(delta)
+  keep(1:floor(n/BLOCK)) = true;        % (a short last block is always sent)
+  for k = 1:length(sn)
+    fwrite(fid, vf_frame(sn(k), 11, [0 0 24]));
+    h = reply(fid, sn(k), 11, 5);
+    if(length(h)~=96)
+      keep(:) = false;                  % older firmware: send the whole image
+      break;
+    end
+    for b = find(keep)
+      idx = ((b-1)*BLOCK+1):(b*BLOCK);
+      keep(b) = all(h((4*b-3):(4*b))==vf_bytes(crc32_words(masked(idx)), 4));
+    end
+  end
+end
+fprintf('vf_fwupdate: sending %d of %d blocks\n', sum(~keep), nblocks);
+
+% Begin and stream all blocks (unanswered if sent to all modules):
+fwrite(fid, vf_frame(addr, 7, [vf_bytes(n, 2) vf_bytes(image_crc, 4)]));
+if(ischar(addr))
+  pause(ERASE_TIME);
+elseif(failed(reply(fid, sn, 7, ERASE_TIME)))
+  error('vf_fwupdate: module %d could not start the update', sn);
+end
+for offset = 0:BLOCK:(n-1)
+  send_block(fid, addr, words, masked, offset, BLOCK, keep);
+  if(ischar(addr))
+    pause(BLOCK_TIME);
+  else
+    reply(fid, sn, 8, 2);
+  end
+end
+
+% Send each module the blocks it missed, then commit:
+for k = 1:length(sn)
+  for retry = 1:5
+    fwrite(fid, vf_frame(sn(k), 9, []));
+    st = reply(fid, sn(k), 9, 2);
+    if(length(st)<5)
+      continue;
+    end
+    next = st(2)*256 + st(3);
+    if(st(1)~=1)
+      % FLASH error (or no begin): start this module over
+      fwrite(fid, vf_frame(sn(k), 7, [vf_bytes(n, 2) vf_bytes(image_crc, 4)]));
+      if(failed(reply(fid, sn(k), 7, ERASE_TIME)))
+        continue;
+      end
+      next = 0;
+    end
+    for offset = next:BLOCK:(n-1)
+      send_block(fid, sn(k), words, masked, offset, BLOCK, keep);
+      if(failed(reply(fid, sn(k), 8, 2)))
+        break;
+      end
+    end
+    fwrite(fid, vf_frame(sn(k), 10, []));
+    if(~failed(reply(fid, sn(k), 10, ERASE_TIME + INSTALL_TIME)))
+      ok(k) = 1;
+      break;
+    end
+  end
+  if(~ok(k))
+    fprintf('vf_fwupdate: module %d not updated\n', sn(k));
+  end
+end
+
+
+function send_block(fid, addr, words, masked, offset, block, keep)
+% Sends the block of words at offset (a multiple of block), or a keep
+% frame if the installed block is the same.
+idx = (offset+1):min(offset+block, length(words));
+crc = vf_bytes(crc32_words(masked(idx)), 4);
+if(keep(offset/block + 1))
+  fwrite(fid, vf_frame(addr, 12, [vf_bytes(offset, 2) vf_bytes(length(idx), 2) crc]));
+else
+  fwrite(fid, vf_frame(addr, 8, [vf_bytes(offset, 2) crc vf_bytes(words(idx), 2)]));
+end
+
+
+function st = reply(fid, sn, opcode, timeout)
+% Returns the payload of the reply frame (opcode+128) from module sn, or
+% [] if none arrives within timeout sec.
+st = [];
+hdr = [];
+tic;
+while(toc<timeout)
+  byte = fread(fid, 1, 'uint8');
+  if(isempty(byte))
+    continue;
+  end
+  hdr = [hdr byte];
+  if(hdr(1)~=2)
+    hdr = [];
+  elseif(length(hdr)==7)
+    if((hdr(5)==opcode+128) && (hdr(2)*65536 + hdr(3)*256 + hdr(4)==sn))
+      len = hdr(6)*256 + hdr(7);
+      st = fread(fid, len + 2, 'uint8')';
+      st = st(1:len);
+      return;
+    end
+    hdr = [];
+  end
+end
+
+
+function bad = failed(st)
+% Returns 1 unless st is a status reply of 0 (OK). No reply ([]) is a failure.
+bad = isempty(st) || (st(1)~=0);
+
+
+function crc = crc32_words(words)
+% CRC32 (zip) of words, MS byte first.
+bytes = [floor(words/256); mod(words, 256)];
+crc = 4294967295;
+for byte = bytes(:)'
+  crc = bitxor(crc, byte);
+  for i = 1:8
+    if(bitand(crc, 1))
+      crc = bitxor(floor(crc/2), 3988292384);   % 0xedb88320
+    else
+      crc = floor(crc/2);
+    end
+  end
+end
+crc = bitxor(crc, 4294967295);
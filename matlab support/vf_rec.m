@@ -0,0 +1,511 @@
+function varargout = vf_rec(cmd, varargin)
+% This function reads, checks, compacts and builds the Versa-Filter FLASH
+% record sectors (sector 3 at 0x6000 and sector 8 at 0xe000, see store()
+% in filt.c, firmware V2.37 and later), writes them to a module, and
+% benchmarks store and recall on a simulated Am29F010 (see vf_am29f010.m).
+%
+% Call as:
+% recs = vf_rec('parse', sector, sn);
+% ok = vf_rec('check', sector, sn);
+% out = vf_rec('compact', sector, sn, outfile);
+% out = vf_rec('make', sn, presets, gen, start, outfile);
+% vf_rec('write', fid, sn, sector, start);
+% stats = vf_rec('bench', nops, seed, nchange);
+%
+% or from the command line, e.g.:
+%   vf_rec check sector3.bin 132001
+%   vf_rec compact sector3.bin 132001 sector8.bin
+%
+%   sector  -   8192 words of a record sector, or the name of a file with
+%               its 16384 bytes (MS byte first, as sent by "program:")
+%   sn      -   serial number of the module (records of other modules are bad)
+%   presets -   cell array of 100 vf_dump.m payloads (locations 0 to 99, [] for
+%               a blank location), or the name of a .mat file holding "presets".
+%               Location 0 (or the first preset) is also the base record.
+%   gen     -   sector generation (0 to 32767, default 0)
+%   start   -   24576 (0x6000, sector 3, default) or 57344 (0xe000, sector 8)
+%   outfile -   also save the result in this file (optional)
+%   fid     -   open serial port (see vf_serial.m)
+%   nops    -   number of store and recall operations (default 2000)
+%   seed    -   random seed (default 0)
+%   nchange -   words changed by each store (default 3)
+%
+%   recs    -   struct: start, gen (-1: no sector header, records written
+%               before V2.35), list (ptr, next, prev, version, delta, loc,
+%               base, n of each record), loc{1..100} (latest full record of
+%               each location, [] if blank), base (full base record, [] if
+%               none), snap (address of the snapshot record, 0 if none),
+%               group ([slot mask] of the latest group record, [] if none),
+%               free (blank words at the end), errors (cell of strings)
+%   out     -   the 8192 words of the new sector
+%
+% "compact" does what the firmware refresh does (compact_records()): it
+% writes the base record and the latest state of each location, as delta
+% records relative to the base, into the other sector with the next
+% generation (with the group record, if any). "make" builds a sector from
+% presets (without a group record: send "group" after "write"). To load presets into
+% a whole rack in one pass:
+%   for sn = [132001 132002 132003]
+%     vf_rec('write', fid, sn, vf_rec('make', sn, presets));
+%   end
+% "write" erases the other record sector, then sends the sector with the
+% "program:" command; the module indexes it at once (V2.41 and later).
+%
+% "bench" runs random store (with nchange changed words) and recall
+% operations through the store(), read_record() and compact_records()
+% logic of filt.c on the simulated FLASH and prints the times, the
+% refreshes and the sector erases.
+
+RECORD_VERSION = 225;   % filt.c RECORD_VERSION (and RECORD_VERSION_MIN 224)
+RECORD_DELTA = 32768;   % filt.c RECORD_DELTA
+SECTOR_TAG = 22099;     % filt.c SECTOR_TAG (0x5653)
+
+switch(cmd)
+case 'parse'
+  varargout{1} = parse(read_sector(varargin{1}), num(varargin{2}));
+
+case 'check'
+  recs = parse(read_sector(varargin{1}), num(varargin{2}));
+  nfull = sum(~[recs.list.delta]);
+  fprintf('sector 0x%04x, generation %d\n', recs.start, recs.gen);
+  fprintf('%d records (%d full, %d delta), %d locations, %d words free\n', ...
+    length(recs.list), nfull, length(recs.list) - nfull, ...
+    sum(~cellfun('isempty', recs.loc)), recs.free);
+  if(~isempty(recs.base))
+    disp('base record: yes');
+  end
+  if(recs.snap)
+    fprintf('snapshot record at 0x%04x\n', recs.snap);
+  end
+  if(~isempty(recs.group))
+    fprintf('group record: slot %d, groups 0x%04x\n', recs.group(1), bitand(recs.group(2), 65534));
+  end
+  for i = 1:length(recs.errors)
+    fprintf('error: %s\n', recs.errors{i});
+  end
+  varargout{1} = isempty(recs.errors);
+
+case 'compact'
+  sn = num(varargin{2});
+  recs = parse(read_sector(varargin{1}), sn);
+  base = recs.base;
+  if(isempty(base))
+    base = first_preset(recs.loc);
+  end
+  start = 24576 + 57344 - recs.start;       % the other sector
+  out = make_sector(sn, recs.loc, base, mod(recs.gen + 1, 32768), start, recs.group);
+  if(length(varargin)>=3)
+    write_file(varargin{3}, out);
+  end
+  varargout{1} = out;
+
+case 'make'
+  sn = num(varargin{1});
+  presets = varargin{2};
+  if(ischar(presets))
+    s = load(presets);
+    presets = s.presets;
+  end
+  gen = 0;
+  start = 24576;
+  if(length(varargin)>=3), gen = num(varargin{3}); end
+  if(length(varargin)>=4), start = num(varargin{4}); end
+  locs = cell(1, 100);
+  for i = 1:min(100, length(presets))
+    if(~isempty(presets{i}))
+      p = double(presets{i}(:)');
+      w = p(1:2:end)*256 + p(2:2:end);
+      if(w(1)~=RECORD_VERSION)
+        error('vf_rec: preset %d is not a RECORD_VERSION %d dump', i-1, RECORD_VERSION);
+      end
+      locs{i} = [0 0 RECORD_VERSION 0 0 i-1 w(2:end)];
+    end
+  end
+  out = make_sector(sn, locs, first_preset(locs), gen, start, []);
+  if(length(varargin)>=5)
+    write_file(varargin{5}, out);
+  end
+  varargout{1} = out;
+
+case 'write'
+  fid = varargin{1};
+  sn = num(varargin{2});
+  sector = read_sector(varargin{3});
+  start = 24576;
+  if(length(varargin)>=4), start = num(varargin{4}); end
+  program(fid, sn, 24576 + 57344 - start, 65535);  % erase the other sector
+  program(fid, sn, start, sector);
+
+case 'bench'
+  nops = 2000; seed = 0; nchange = 3;
+  if(length(varargin)>=1), nops = num(varargin{1}); end
+  if(length(varargin)>=2), seed = num(varargin{2}); end
+  if(length(varargin)>=3), nchange = num(varargin{3}); end
+  varargout{1} = bench(nops, seed, nchange);
+
+otherwise
+  error('vf_rec: unknown command %s', cmd);
+end
+
+
+function recs = parse(img, sn)
+% Walks the records of a sector like index_records() and read_record().
+img = double(img(:)');
+recs.errors = {};
+recs.list = struct('ptr', {}, 'next', {}, 'prev', {}, 'version', {}, ...
+  'delta', {}, 'loc', {}, 'base', {}, 'n', {});
+recs.loc = cell(1, 100);
+recs.base = [];
+recs.snap = 0;
+recs.group = [];
+if((img(2)==22099) && (img(1)<32768))     % SECTOR_TAG
+  recs.gen = img(1);
+  off = 2;
+else
+  recs.gen = -1;
+  off = 0;
+end
+recs.start = 24576;
+if(img(off+1)~=65535 && img(off+1)>=57344)
+  recs.start = 57344;
+end
+if((recs.gen<0) && (recs.start~=24576))
+  recs.errors{end+1} = 'sector 8 without a header';
+end
+start = recs.start;
+full = {};                                  % full records by offset
+while((off<8192) && (img(off+1)~=65535))
+  ptr = start + off;
+  next = img(off+1);
+  version = bitand(img(off+3), 32767);
+  loc = img(off+6);
+  if((next<=ptr) || (next>start+8192))
+    recs.errors{end+1} = sprintf('record 0x%04x: bad next_loc 0x%04x', ptr, next);
+    break;
+  end
+  if((version<224) || (version>225) || (img(off+4)~=mod(sn, 65536)) || (img(off+5)~=floor(sn/65536)))
+    recs.errors{end+1} = sprintf('record 0x%04x: bad version or serial number', ptr);
+    break;
+  end
+  if((loc>99) && (loc~=255) && (loc~=254) && (loc~=253))
+    recs.errors{end+1} = sprintf('record 0x%04x: bad loc_code %d', ptr, loc);
+    break;
+  end
+  rec = img((off+1):(next-start));
+  r.ptr = ptr; r.next = next; r.prev = rec(2); r.version = version;
+  r.delta = rec(3)>=32768; r.loc = loc; r.base = ptr; r.n = length(rec);
+  if(r.delta)
+    r.base = rec(7);
+    nfull = rec(8);
+    if((r.base<start) || (r.base>=ptr) || (length(full)<r.base-start+1) || isempty(full{r.base-start+1}))
+      recs.errors{end+1} = sprintf('record 0x%04x: bad base_loc 0x%04x', ptr, r.base);
+      break;
+    end
+    b = full{r.base-start+1};
+    b((length(b)+1):nfull) = 0;
+    b = b(1:nfull);
+    for i = 9:2:(length(rec)-1)
+      if(rec(i)<nfull)
+        b(rec(i)+1) = rec(i+1);
+      end
+    end
+    rec = [rec(1:6) b(7:end)];
+    rec(3) = version;
+  else
+    full{off+1} = rec;
+  end
+  recs.list(end+1) = r;
+  if(loc==255)
+    recs.base = rec;
+  elseif(loc==254)
+    recs.snap = ptr;
+  elseif(loc==253)                          % GROUP_LOC
+    recs.group = rec(7:8);
+  else
+    recs.loc{loc+1} = rec;
+  end
+  off = next - start;
+end
+recs.free = 8192 - off;
+if(any(img((off+1):end)~=65535))
+  recs.errors{end+1} = sprintf('programmed words after the last record (0x%04x)', start + off);
+end
+
+
+function img = make_sector(sn, locs, base, gen, start, group)
+% Builds a sector like compact_records(): header, base record, then each
+% location as a delta record relative to the base (or as a full record),
+% then the group record if group ([slot mask]) is not empty.
+DELTA_MAX = 128;                            % filt.c DELTA_MAX
+img = 65535*ones(1, 8192);
+if(isempty(base))
+  error('vf_rec: no settings');
+end
+off = 2;
+n = length(base);
+img((off+1):(off+n)) = header(base, start+off, n, 0, 255, sn, 0);
+base_ptr = start + off;
+prev = base_ptr;
+off = off + n;
+for loc = 0:99
+  full = locs{loc+1};
+  if(isempty(full))
+    continue;
+  end
+  if(off + DELTA_MAX > 8191)
+    error('vf_rec: memory full');
+  end
+  rec = make_delta(full, base, base_ptr, DELTA_MAX);
+  isdelta = ~isempty(rec);
+  if(~isdelta)
+    rec = full;
+    if(off + length(rec) > 8191)
+      error('vf_rec: memory full');
+    end
+  end
+  img((off+1):(off+length(rec))) = header(rec, start+off, length(rec), prev, loc, sn, isdelta);
+  prev = start + off;
+  off = off + length(rec);
+end
+if(~isempty(group))
+  if(off + 8 > 8191)
+    error('vf_rec: memory full');
+  end
+  img((off+1):(off+8)) = header([0 0 0 0 0 0 group], start+off, 8, prev, 253, sn, 0);
+end
+img(1:2) = [gen 22099];                     % SECTOR_TAG
+
+
+function d = make_delta(full, base, base_ptr, delta_max)
+% Delta record of full relative to base (see make_delta() in filt.c), or
+% [] if longer than delta_max words.
+n = length(full);
+d = [zeros(1, 6) base_ptr n];
+for i = 7:n
+  if((i>length(base)) || (base(i)~=full(i)))
+    if(length(d)>=delta_max)
+      d = [];
+      return;
+    end
+    d = [d i-1 full(i)];
+  end
+end
+
+
+function rec = header(rec, ptr, n, prev, loc, sn, delta)
+% Writes the 6 word record header (see record_header() in filt.c).
+rec(1:6) = [ptr+n prev 225+32768*delta mod(sn, 65536) floor(sn/65536) loc];
+
+
+function base = first_preset(locs)
+base = [];
+for i = 1:length(locs)
+  if(~isempty(locs{i}))
+    base = locs{i};
+    base(6) = 255;
+    return;
+  end
+end
+
+
+function img = read_sector(x)
+if(ischar(x))
+  fid = fopen(x, 'r');
+  if(fid<0)
+    error('vf_rec: can''t open %s', x);
+  end
+  bytes = fread(fid, inf, 'uint8')';
+  fclose(fid);
+  img = bytes(1:2:end)*256 + bytes(2:2:end);
+else
+  img = double(x(:)');
+end
+img((length(img)+1):8192) = 65535;
+
+
+function write_file(name, img)
+fid = fopen(name, 'w');
+fwrite(fid, [floor(img/256); mod(img, 256)], 'uint8');
+fclose(fid);
+
+
+function x = num(x)
+if(ischar(x))
+  x = str2double(x);
+end
+
+
+function program(fid, sn, start, words)
+% Sends words with the "program:" command (the module erases the sector first).
+bytes = [floor(words/256); mod(words, 256)];
+bytes = bytes(:)';
+fprintf(fid, 'at sn:%d program: s:%d l:%d d:', sn, start, length(words));
+pause(0.1);                                 % let the parser reach "program:" (XON, XOFF and 0x02 are data after it)
+fwrite(fid, bytes);
+fprintf(fid, '%08d', sum(bytes));
+pause(3 + length(bytes)*20e-6);             % erase and program
+
+
+function stats = bench(nops, seed, nchange)
+% Random store and recall operations on the simulated FLASH.
+RECLEN = 287;           % pack_record() length: 6 + 6*46 params + 3 UserFIR headers + 2 group words
+sn = 132001;
+rand('state', seed);
+settings = [zeros(1, 6) floor(65536*rand(1, RECLEN-6))];
+
+f = vf_am29f010('new');
+ix.start = 57344;       % blank FLASH: the first refresh writes sector 3
+ix.gen = 32767;
+[f, ix] = refresh(f, ix, settings, 0, 1, sn);
+
+tstore = []; trecall = []; trefresh = [];
+for k = 1:nops
+  loc = floor(100*rand^2);                  % the low locations are used most
+  if(rand<0.5)
+    i = 6 + ceil((RECLEN-6)*rand(1, nchange));
+    settings(i) = floor(65536*rand(1, nchange));
+    t = f.time;
+    [f, ix, refreshed] = store(f, ix, settings, loc, sn);
+    if(refreshed)
+      trefresh(end+1) = f.time - t;
+    else
+      tstore(end+1) = f.time - t;
+    end
+  elseif(ix.ptr(loc+1))
+    t = f.time;
+    [f, rec] = read_record(f, ix, ix.ptr(loc+1), ix.len(loc+1));
+    trecall(end+1) = f.time - t;
+    settings = [zeros(1, 6) rec(7:end)];
+  end
+end
+t = f.time;
+[f, ix] = index(f);
+stats.index_ms = 1e3*(f.time - t);
+stats.store_ms = 1e3*[mean(tstore) max(tstore)];
+stats.recall_ms = 1e3*[mean(trecall) max(trecall)];
+stats.refreshes = length(trefresh);
+stats.refresh_s = [mean(trefresh) max(trefresh)];
+stats.erases = f.erases;
+stats.programmed = f.programmed;
+
+fprintf('%d stores, %d recalls, %d words changed per store\n', ...
+  length(tstore) + length(trefresh), length(trecall), nchange);
+fprintf('store:   %6.1f ms mean, %6.1f ms max\n', stats.store_ms);
+fprintf('recall:  %6.1f ms mean, %6.1f ms max\n', stats.recall_ms);
+fprintf('refresh: %d, %4.2f s mean, %4.2f s max\n', stats.refreshes, stats.refresh_s);
+fprintf('erases:  sector 3: %d, sector 8: %d\n', f.erases(4), f.erases(8));
+fprintf('power up index: %.1f ms\n', stats.index_ms);
+
+
+function [f, ix, refreshed] = store(f, ix, full, loc, sn)
+% store() in filt.c.
+refreshed = 0;
+if(ix.ptr(loc+1))
+  base_ptr = ix.base(loc+1);
+else
+  base_ptr = ix.common;
+end
+rec = full;
+isdelta = 0;
+if(base_ptr)
+  [f, nbase] = vf_am29f010('read', f, base_ptr, 1);
+  [f, base] = vf_am29f010('read', f, base_ptr, nbase - base_ptr);
+  d = make_delta(full, base, base_ptr, 128);
+  if(~isempty(d))
+    rec = d;
+    isdelta = 1;
+  end
+end
+ptr = ix.end;
+if(length(rec)>(ix.start + 8191 - ptr))
+  [f, ix] = refresh(f, ix, full, loc, 0, sn);
+  refreshed = 1;
+  return;
+end
+rec = header(rec, ptr, length(rec), ix.last, loc, sn, isdelta);
+[f, ok] = vf_am29f010('program', f, ptr, rec);
+ix.ptr(loc+1) = ptr;
+ix.len(loc+1) = length(rec);
+if(isdelta)
+  ix.base(loc+1) = base_ptr;
+else
+  ix.base(loc+1) = ptr;
+end
+ix.last = ptr;
+ix.end = ptr + length(rec);
+
+
+function [f, rec] = read_record(f, ix, ptr, n)
+% read_record() in filt.c.
+[f, rec] = vf_am29f010('read', f, ptr, n);
+if(rec(3)>=32768)
+  d = rec;
+  [f, nbase] = vf_am29f010('read', f, d(7), 1);
+  [f, rec] = vf_am29f010('read', f, d(7), nbase - d(7));
+  rec((length(rec)+1):d(8)) = 0;
+  rec = rec(1:d(8));
+  for i = 9:2:(length(d)-1)
+    rec(d(i)+1) = d(i+1);
+  end
+  rec(1:6) = d(1:6);
+end
+
+
+function [f, ix] = refresh(f, ix, full, current_loc, all, sn)
+% compact_records() in filt.c.
+locs = cell(1, 100);
+for loc = 0:99
+  if(all || (loc==current_loc))
+    locs{loc+1} = full;
+  elseif(ix.ptr(loc+1))
+    [f, locs{loc+1}] = read_record(f, ix, ix.ptr(loc+1), ix.len(loc+1));
+  end
+end
+start = 24576 + 57344 - ix.start;
+img = make_sector(sn, locs, [full(1:5) 255 full(7:end)], mod(ix.gen + 1, 32768), start, []);
+n = 8192;
+while(img(n)==65535)
+  n = n - 1;
+end
+f = vf_am29f010('erase', f, start);
+[f, ok] = vf_am29f010('program', f, start + 2, img(3:n));
+[f, ok] = vf_am29f010('program', f, start, img(1:2));
+[f, ix] = index(f);
+
+
+function [f, ix] = index(f)
+% index_records() in filt.c.
+ix.ptr = zeros(1, 100); ix.len = zeros(1, 100); ix.base = zeros(1, 100);
+ix.common = 0; ix.last = 0;
+[f, h3] = vf_am29f010('read', f, 24576, 2);
+[f, h8] = vf_am29f010('read', f, 57344, 2);
+ok3 = (h3(2)==22099) && (h3(1)<32768);
+ok8 = (h8(2)==22099) && (h8(1)<32768);
+if(ok8 && (~ok3 || (h8(1)==mod(h3(1) + 1, 32768))))
+  ix.start = 57344; ix.gen = h8(1);
+else
+  ix.start = 24576; ix.gen = h3(1);
+end
+ptr = ix.start + 2;
+[f, r] = vf_am29f010('read', f, ptr, 7);
+while(r(1)~=65535)
+  loc = r(6);
+  if(loc==255)
+    ix.common = ptr;
+  elseif(loc<100)
+    ix.ptr(loc+1) = ptr;
+    ix.len(loc+1) = r(1) - ptr;
+    if(r(3)>=32768)
+      ix.base(loc+1) = r(7);
+    else
+      ix.base(loc+1) = ptr;
+    end
+  end
+  ix.last = ptr;
+  ptr = r(1);
+  if(ptr>ix.start + 8185)
+    break;                                  % (no room for another record)
+  end
+  [f, r] = vf_am29f010('read', f, ptr, 7);
+end
+ix.end = ptr;
@@ -1,4 +1,8 @@
 fid = serial('COM1','baudrate', 9600, 'terminator','cr');
+% Binary frames (vf_frame.m) and their replies may hold 17 (XON) and 19 (XOFF)
+% bytes, so do not use 'flowcontrol','software' on a port with binary traffic.
+% For ASCII commands only, XON/XOFF paces long commands (V2.29 and later):
+%fid = serial('COM1','baudrate', 9600, 'terminator','cr', 'flowcontrol','software');
 %fid = 1
 fopen(fid)
 
@@ -17,6 +21,37 @@ rtext = fscanf(fid);
 disp(rtext)
 end
 
+if(0)
+% Change several parameters with one filter computation (V2.25 and later):
+fprintf(fid,'at all begin\r');
+fprintf(fid,'at all bBPf1:500\r');
+fprintf(fid,'at all bBPf2:3000\r');
+fprintf(fid,'at all bBPorder:101\r');
+fprintf(fid,'at all commit\r');
+end
+
+if(0)
+% Group addressing (V2.32 and later). Put two modules in group 3 (ack slots 0 and 1):
+fprintf(fid,'at sn:132001 group:0 3\r');
+fprintf(fid,'at sn:132002 group:1 3\r');
+fprintf(fid,'at grp:3 Mode:A&B Common\r');
+fprintf(fid,'at grp:3 LPfcut:1000\r');
+% Each module answers in its slot: 128+slot (+32 on error), 192+commands executed:
+fprintf(fid,'at grp:3 ack\r');
+pause(0.1);
+acks = fread(fid, fid.BytesAvailable, 'uint8');
+ok = acks(1:2:end)<160 & mod(acks(2:2:end), 64)==2;
+slots = mod(acks(1:2:end), 32);     % acked slots (bitmap)
+end
+
+if(0)
+% Read and clear the receive error counters (V2.29 and later):
+fprintf(fid,'at sn:132001 serstat\r');
+rx_overruns = fscanf(fid,'%d')
+rx_framing = fscanf(fid,'%d')
+rx_full = fscanf(fid,'%d')
+end
+
 if(0)
 
 fs = 48000;     % sampling rate
@@ -0,0 +1,59 @@
+function [payload, text] = vf_ufpack(taps, bank, delta)
+% This function packs UserFIR taps for upload to a Versa-Filter
+% (firmware V2.24 and later). If the taps are symmetric or antisymmetric
+% only the first half is sent.
+%
+% Call as:
+% [payload, text] = vf_ufpack(taps, bank, delta);
+%
+%   taps    -   integer taps (e.g. round(32768*coefs))
+%   bank    -   0 - A, 1 - B, 2 - Common (binary payload only)
+%   delta   -   1 to send differences between taps (default 0)
+%
+%   payload -   bytes for a binary frame with opcode 3:
+%               fwrite(fid, vf_frame(sn, 3, payload));
+%               with delta, differences are sent as zigzag varints
+%   text    -   the same for the ASCII command:
+%               fprintf(fid, 'at all FUNC:UserFIR:%s\r', text);
+
+if(nargin<3), delta = 0; end
+
+taps = round(double(taps(:)'));
+n = length(taps);
+half = ceil(n/2);
+flags = 0;
+prefix = '';
+if(all(taps == fliplr(taps)))
+  flags = 1;
+  prefix = sprintf(' s%d', n);
+elseif(all(taps == -fliplr(taps)))
+  flags = 2;
+  prefix = sprintf(' a%d', n);
+end
+if(flags)
+  taps = taps(1:half);
+end
+
+if(delta)
+  values = diff([0 taps]);
+  flags = flags + 4;
+  prefix = [prefix ' d'];
+else
+  values = taps;
+end
+
+text = [prefix sprintf(' %d', values)];
+
+payload = [bank flags floor(n/256) mod(n, 256)];
+if(delta)
+  for v = values
+    z = 2*abs(v) - (v<0);         % zigzag: 0,-1,1,-2,... -> 0,1,2,3,...
+    while(z>=128)
+      payload = [payload 128+mod(z, 128)];
+      z = floor(z/128);
+    end
+    payload = [payload z];
+  end
+else
+  payload = [payload vf_bytes(values, 2)];
+end